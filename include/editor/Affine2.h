@@ -0,0 +1,79 @@
+#pragma once
+#include <d3dx9.h>
+#include <xmmintrin.h>
+#include <math.h>
+
+//! Two-dimensional affine transformation
+/** Uses row-vector convention of D3DX: point (x, y) is transformed to
+  * (x * a + y * c + tx, x * b + y * d + ty) and product A * B applies
+  * A first. Converted to 4x4 matrix only for render device. */
+struct Affine2
+{
+    //! Linear part (rows (a, b) and (c, d))
+    float a, b, c, d;
+    //! Translation
+    float tx, ty;
+
+    //! Constructor (uninitialized)
+    inline Affine2() {}
+    //! Constructor
+    inline Affine2( float a, float b, float c, float d, float tx, float ty )
+        : a(a), b(b), c(c), d(d), tx(tx), ty(ty) {}
+
+    //! Identity transformation
+    static inline Affine2 identity()
+        { return Affine2(1, 0, 0, 1, 0, 0); }
+    //! Translation
+    static inline Affine2 translation( float x, float y )
+        { return Affine2(1, 0, 0, 1, x, y); }
+    //! Scaling
+    static inline Affine2 scaling( float sx, float sy )
+        { return Affine2(sx, 0, 0, sy, 0, 0); }
+    //! Rotation (same direction as D3DXMatrixRotationZ)
+    /** \param  angle  angle in radians */
+    static inline Affine2 rotation( float angle )
+        { float s = sinf(angle), c = cosf(angle);
+          return Affine2(c, s, -s, c, 0, 0); }
+
+    //! Composition (this transformation is applied first)
+    inline Affine2 operator *( const Affine2 & m ) const
+    {
+        Affine2 r;
+        // Linear part: (a, a, c, c) * (A, B, A, B) + (b, b, d, d) * (C, D, C, D)
+        __m128 l = _mm_loadu_ps(&a), ml = _mm_loadu_ps(&m.a);
+        __m128 v = _mm_add_ps(
+            _mm_mul_ps(_mm_shuffle_ps(l, l, _MM_SHUFFLE(2, 2, 0, 0)), _mm_movelh_ps(ml, ml)),
+            _mm_mul_ps(_mm_shuffle_ps(l, l, _MM_SHUFFLE(3, 3, 1, 1)), _mm_movehl_ps(ml, ml)));
+        _mm_storeu_ps(&r.a, v);
+        r.tx = tx * m.a + ty * m.c + m.tx;
+        r.ty = tx * m.b + ty * m.d + m.ty;
+        return r;
+    }
+
+    //! Inverse transformation (identity for degenerate transformation)
+    inline Affine2 inverse() const
+    {
+        float det = a * d - b * c;
+        if (0 == det)
+            return identity();
+        float k = 1.0f / det;
+        Affine2 r(d * k, -b * k, -c * k, a * k, 0, 0);
+        r.tx = -(tx * r.a + ty * r.c);
+        r.ty = -(tx * r.b + ty * r.d);
+        return r;
+    }
+
+    //! Transform point
+    inline D3DXVECTOR2 transform( float x, float y ) const
+        { return D3DXVECTOR2(x * a + y * c + tx, x * b + y * d + ty); }
+    //! Transform point
+    inline D3DXVECTOR2 transform( const D3DXVECTOR2 & p ) const
+        { return transform(p.x, p.y); }
+
+    //! Convert to 4x4 matrix
+    inline D3DXMATRIX to_matrix() const
+        { return D3DXMATRIX(a,  b,  0, 0,
+                            c,  d,  0, 0,
+                            0,  0,  1, 0,
+                            tx, ty, 0, 1); }
+};
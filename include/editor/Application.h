@@ -6,6 +6,8 @@
 #include "Input.h"
 #include "Python.h"
 #include "Config.h"
+#include "WorkerPool.h"
+#include "FrameClock.h"
 
 //! Application and window management class.
 class ApplicationInstance
@@ -33,7 +35,7 @@ public:
     //! Pause game
     inline static void pause( bool pause = true )
         { paused = pause;
-          if (!paused) previous_ticks = GetTickCount(); }
+          if (!paused) frame_clock.reset(); }
     //! Resume game
     inline static void resume() { pause(false); }
     
@@ -49,8 +51,10 @@ public:
     static void on_script_reload();
 
     //! Screen repainting handler
-    /** WM_PAINT event handler */
-    inline void on_repaint() { on_frame(0, true); }
+    /** WM_PAINT and WM_TIMER event handler. Only changes since previous
+      * frame are drawn.
+      * @param  invalidate  true if window contents were lost */
+    void on_repaint( bool invalidate = false );
     
     //! Disable window automatic activation
     static inline void disable_autoactivation( bool disable )
@@ -97,9 +101,14 @@ public:
     void init();
     
     //! High-level game engine update and rendering function.
-    /** \param  dt               time step
+    /** \param  dt               time step in seconds
       * \param  just_redraw      true if no script update is needed */
-    void on_frame( DWORD dt, bool just_redraw = false );
+    void on_frame( float dt, bool just_redraw = false );
+    
+    //! Frame timer
+    /** Fixed update step is set by "fixed_update_rate" config value
+      * (updates per second, 0 for variable step). */
+    static FrameClock frame_clock;
     
 protected:
     //! Check if Direct3D devices were lost
@@ -111,6 +120,8 @@ protected:
     
     /* Undocumented properties */
     
+    // Background worker threads (declared first to be released last)
+    SINGLETON(WorkerPool) worker_pool;
     // File manager
     SINGLETON(FileManager) file_manager;
     // DirectInput manager
@@ -127,8 +138,6 @@ protected:
     // Python on_frame function object
     bp::object py_on_frame;
     
-    // Previous time
-    static DWORD previous_ticks;
 };
 //! Application singleton definition
 typedef Singleton<ApplicationInstance> Application;
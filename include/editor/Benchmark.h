@@ -0,0 +1,49 @@
+#pragma once
+#include "Tanita2.h"
+#include <string>
+#include <vector>
+
+//! Engine micro benchmarks
+/** Benchmarks exercise engine containers and math without window,
+  * devices and scripts, so they may be run on build machine. */
+class Benchmark
+{
+public:
+    //! Run benchmarks and report timings to log
+    /** Command line: -bench [name|all] [report_file]
+      * \param  args  command line */
+    static void run( const std::string & args );
+
+    //! Record timing of benchmarked operation
+    /** \param  name     operation name
+      * \param  count    number of operations
+      * \param  seconds  total time of operations */
+    void add( const std::string & name, int count, double seconds );
+    //! Add line to report
+    inline void note( const std::string & line ) { lines.push_back(line); }
+    //! Keep value computed by benchmarked code
+    /** Checksum is reported, so optimizer can not drop measured code. */
+    inline void keep( size_t value ) { checksum += value; }
+
+protected:
+    //! Constructor
+    inline Benchmark() : checksum(0) {}
+
+    //! Benchmark function
+    typedef void (*Function)( Benchmark & bench );
+    //! Registered benchmark
+    struct Entry
+    {
+        //! Benchmark name for command line
+        const char * name;
+        //! Benchmark function
+        Function function;
+    };
+    //! Registered benchmarks
+    static const Entry entries[];
+
+    //! Report lines
+    std::vector<std::string> lines;
+    //! Sum of kept values
+    size_t checksum;
+};
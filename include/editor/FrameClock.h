@@ -0,0 +1,73 @@
+#pragma once
+#include "Tanita2.h"
+#include <vector>
+
+//! High-resolution frame timer
+/** Time is measured by performance counter, which is monotonic and much
+  * finer than GetTickCount. With fixed time step set, frame time is
+  * quantized to whole steps and remainder is carried to next frame (its
+  * fraction of step may be used for interpolation). Durations of recent
+  * frames are kept for pacing statistics. */
+class FrameClock
+{
+public:
+    //! Number of recent frames kept for statistics
+    static const size_t history_size = 1024;
+
+    //! Constructor
+    FrameClock();
+
+    //! Get time since clock creation in seconds
+    double now() const;
+    //! Get time since previous frame in seconds
+    double get_elapsed() const;
+
+    //! Finish frame
+    /** Frame duration is recorded for statistics. Steps longer than
+      * max_step (breakpoints, window dragging) are clamped.
+      * \return time step for update in seconds (whole number of fixed steps if set) */
+    double tick();
+    //! Start timing from now (time since previous frame is dropped)
+    void reset();
+
+    //! Set fixed time step
+    /** \param  step  step in seconds (0 for variable step) */
+    void set_fixed_step( double step );
+    //! Get fixed time step in seconds (0 for variable step)
+    inline double get_fixed_step() const { return fixed_step; }
+    //! Get fraction of fixed step accumulated but not returned by tick yet
+    /** \return value in range [0, 1) (always 0 with variable step) */
+    inline double get_alpha() const
+        { return fixed_step > 0 ? accumulator / fixed_step : 0; }
+
+    //! Get frame duration percentile over recent frames
+    /** \param  percent  percentile in range [0, 100]
+      * \return duration in seconds (0 if no frames were recorded) */
+    double get_percentile( double percent ) const;
+    //! Get mean frame duration over recent frames in seconds
+    double get_mean() const;
+    //! Get number of recent frames kept for statistics
+    inline size_t get_frame_count() const { return history.size(); }
+    //! Forget recorded frame durations
+    void clear_stats();
+
+    //! Longest accepted time step in seconds
+    static const double max_step;
+
+protected:
+    //! Convert performance counter value to seconds since creation
+    double to_seconds( LONGLONG ticks ) const;
+
+    //! Performance counter frequency and value at creation
+    LONGLONG frequency, origin;
+    //! Performance counter value at previous frame
+    LONGLONG previous;
+    //! Fixed time step (0 for variable step)
+    double fixed_step;
+    //! Time not returned by tick yet
+    double accumulator;
+    //! Recent frame durations (ring)
+    std::vector<double> history;
+    //! Next ring position to write
+    size_t history_pos;
+};
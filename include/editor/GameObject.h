@@ -69,6 +69,15 @@ public:
     D3DXVECTOR2 get_absolute_position() const;
     //! Get absolute rotation (in degrees)
     float get_absolute_rotation() const;
+    
+    //! Set position (marks transformation dirty)
+    void set_position( const D3DXVECTOR2 & p );
+    //! Set scaling factor (marks transformation dirty)
+    void set_scale( const D3DXVECTOR2 & s );
+    //! Get rotation angle (in degrees)
+    inline float get_rotation() const { return rotation; }
+    //! Set rotation angle (marks transformation dirty)
+    void set_rotation( float angle );
 
 protected:
     //! Class for automatic management of children classes
@@ -120,10 +129,21 @@ protected:
     /** Should be called inside begin_update/end_update brackets */
     D3DXVECTOR2 to_local_coordinates( const D3DXVECTOR2 & v );
     
-    //! Cached transformation matrix
-    D3DXMATRIX transformation;
-    //! Inverse transformation matrix
-    D3DXMATRIX transformation_inv;
+    //! Get inverse transformation (calculated on first use after change)
+    const Affine2 & get_transformation_inv() const;
+    
+    //! Cached transformation
+    Affine2 transformation;
+    
+    //! Flag indicating that local transformation was changed by setter
+    bool transform_dirty;
+    //! Parent transformation used for cached transformation
+    Affine2 parent_transformation;
+    //! Local parameters used for cached transformation
+    /** Compared on update to catch in-place changes of
+      * position and scale components from python */
+    D3DXVECTOR2 cached_position, cached_scale;
+    float cached_rotation;
     
     //! Sounds
     tanita2_dict sounds;
@@ -137,6 +157,12 @@ protected:
     D3DXHANDLE param_texture;
     D3DXHANDLE param_texture_size;
 
+private:
+    //! Cached inverse transformation
+    mutable Affine2 transformation_inv;
+    //! Flag indicating that inverse transformation should be recalculated
+    mutable bool inverse_dirty;
+    
     // Friend class
     friend class Path;
 };
@@ -178,6 +204,8 @@ protected:
 class LayerImage: public GameObject
 {
 public:
+    //! Constructor
+    inline LayerImage() : tile_columns(0), tile_rows(0), tiles_compressed(false) {}
     //! Cleanup
     virtual ~LayerImage();
 
@@ -191,9 +219,44 @@ protected:
     //! Load image from direct path
     void direct_load_image( bp::object & texture_path, bool compressed );
 
+    //! Load image split to tiles
+    /** Tiles are images 0..columns*rows-1 of texture_path directory in
+      * row-major order, tile_size pixels square (right and bottom tiles
+      * may be smaller). Only tiles near visible area are kept loaded.
+      * Without grid size, texture_path is whole image which is split by
+      * PngFilter::split (resource packs contain only tiles, so grid size
+      * should be given there).
+      * \param  texture_path  path to whole image or to any image in tiles directory
+      * \param  columns, rows  tile grid size (0 - split whole image) */
+    void load_tiled_image( bp::object & texture_path, int columns, int rows, bool compressed );
+
+    //! Load tiles entering visible area and release tiles leaving it
+    /** At most tile_loads_per_frame tiles nearest to view center are
+      * loaded per call, so scrolling does not stall on reading many
+      * files at once. Tiles in margin around visible area are loaded
+      * in advance to hide this delay. */
+    void stream_tiles();
+    //! Release all tiles and forget tile grid
+    void release_tiles();
+
+    //! Tile width and height in pixels
+    static const int tile_size = 512;
+    //! Maximal number of tiles loaded by one stream_tiles call
+    /** Set from config value "tile_loads_per_frame" (default is 2) */
+    static int tile_loads_per_frame;
+
     //! Layer image
     SequenceID sequence;
     
+    //! Tiles directory
+    PATH tiles_path;
+    //! Tile grid size
+    int tile_columns, tile_rows;
+    //! Tiles are loaded as compressed textures
+    bool tiles_compressed;
+    //! Tile sequences (row-major, empty for unloaded tiles)
+    std::vector<SequenceID> tiles;
+    
     // Friend class
     friend class GameObject;
 };
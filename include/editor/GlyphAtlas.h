@@ -0,0 +1,46 @@
+#pragma once
+#include "Tanita2.h"
+#include "RenderDevice.h"
+#include <vector>
+
+//! Texture page with pre-rasterized font glyphs
+/** All 8-bit characters of font are rasterized once to A8R8G8B8 image
+  * (white color, glyph coverage in alpha channel). Strings are laid out
+  * on CPU to quads referencing this image. */
+class GlyphAtlas
+{
+public:
+    //! Rasterize font glyphs
+    /** \param  face    font face name
+      * \param  height  font height in pixels */
+    GlyphAtlas( const char * face, int height );
+
+    //! Lay out string to quads
+    /** Line breaks start new line at x.
+      * \param  text      string to lay out
+      * \param  x, y      top-left corner of text in render target pixels
+      * \param  color     text color
+      * \param  vertices  receives triangle list (six vertices per glyph) */
+    void layout( const std::string & text, int x, int y, D3DCOLOR color,
+                 std::vector<TextVertex> & vertices ) const;
+
+    //! Page width and height
+    int width, height;
+    //! Page image (top row first)
+    std::vector<DWORD> pixels;
+
+protected:
+    //! Glyph placement in page
+    struct Glyph
+    {
+        //! Left-top corner of glyph cell
+        short x, y;
+        //! Cell width (glyph advance)
+        short width;
+    };
+
+    //! Glyphs of all characters
+    Glyph glyphs[256];
+    //! Line height
+    int line_height;
+};
@@ -1,9 +1,12 @@
 #pragma once
 #include "Tanita2.h"
 #include "Templates.h"
+#include "RenderDevice.h"
+#include "Affine2.h"
 #include <d3d9.h>
 #include <d3dx9.h>
 #include <dxerr.h>
+#include <list>
 
 //! Rendering manager
 class Direct3DInstance
@@ -18,10 +21,17 @@ public:
     void update( DWORD dt );
     
     //! Clear screen
-    /** @param  color  color to clear */
+    /** Clearing is done by present() over area being redrawn.
+      * @param  color  color to clear */
     void clear( D3DCOLOR color );
     //! Present all geometry and flip buffers 
-    void present();
+    /** With dirty redraw enabled frame which doesn't differ from previous
+      * one isn't drawn, otherwise only changed area is redrawn if render
+      * device can preserve back buffer.
+      * @param  changed_only  draw only changes since previous frame */
+    void present( bool changed_only = false );
+    //! Redraw whole frame on next present (window contents were lost)
+    void invalidate();
 
     //! Get projection matrix
     inline const D3DXMATRIX & get_projection_matrix() const
@@ -30,16 +40,22 @@ public:
     inline const D3DXMATRIX & get_view_matrix() const
         { return matrix_view; }
 
-    //! Multiply current world matrix and push to stack
+    //! Multiply current world transformation and push to stack
     /** @param  new_transform  transformation to apply */
-    void push_transform( const D3DXMATRIX & new_transform );
-    //! Pop transformation matrix from stack
+    void push_transform( const Affine2 & new_transform );
+    //! Push already combined world transformation to stack
+    /** @param  world  transformation including all parent transformations */
+    void push_world_transform( const Affine2 & world );
+    //! Pop transformation from stack
     void pop_transform();
-    //! Get current transformation matrix (matrix stack top)
-    D3DXMATRIX get_transform();
+    //! Get current transformation (transformation stack top)
+    inline const Affine2 & get_transform() const
+        { return transform_stack.back(); }
 
 	// Flag indicating that we need to save screenshot
 	void save_screenshot( char * filename, int width, int height );
+    //! Wait until all requested screenshots are written
+    void wait_screenshots();
     
     // Texture memory manager
     class TextureManagerInstance;
@@ -62,12 +78,14 @@ public:
     //! TextureManagerInstance singleton definition
     typedef Singleton<EffectsManagerInstance> EffectsManager;
     
-    //! Text renderer
-    LPD3DXFONT text_drawer;
-    //! Line renderer
-    LPD3DXLINE line_drawer;
+    //! Rendering backend (all drawing goes through it)
+    RenderDevice * render_device;
     //! Zoom factor
     float zoom;
+    
+    //! Get size of visible area in world coordinates (depends on zoom)
+    inline D3DXVECTOR2 get_view_size() const
+        { return D3DXVECTOR2(1024 / zoom, 768 / zoom); }
   
     //! View and projection matrix setup
     void setup_matrices();
@@ -78,6 +96,10 @@ public:
     bool rtt_enabled;
     //! Hardware YUV conversion support flag
     bool hardware_yuv_enabled; 
+    //! Rendering on dedicated thread flag (config value "render_thread")
+    bool render_thread_enabled;
+    //! Redrawing only changed area flag (config value "dirty_redraw")
+    bool dirty_redraw_enabled;
 
 	//! Flag indicating that we need to save screenshot
 	static bool need_save_screenshot;
@@ -100,17 +122,32 @@ protected:
     
     //! Render state setup
     void setup_renderstate();
+    //! Create Direct3D device and rendering backend for it
+    void create_device();
     
     //! Near and far clipping planes
     static const int ZNear = 1, ZFar = 1000;
-    //! Matrix stack
-    LPD3DXMATRIXSTACK matrix_stack;
+    //! Transformation stack (never empty, bottom is identity)
+    std::vector<Affine2> transform_stack;
+
+    //! Color to clear screen with
+    D3DCOLOR clear_color;
+    //! Zoom factor of previously drawn frame
+    float drawn_zoom;
 
 	//! Values for saving  screenshot
 	std::string screenshot_name;
 	int screenshot_width;
 	int screenshot_height;
     
+    //! Background PNG encoding of screenshot
+    class ScreenshotJob;
+    //! Screenshots being encoded
+    std::list< boost::shared_ptr<ScreenshotJob> > screenshot_jobs;
+    //! Report errors of finished screenshot jobs and forget them
+    /** \param  wait  wait for unfinished jobs */
+    void collect_screenshot_jobs( bool wait );
+    
     //! Projection matrix
     D3DXMATRIX matrix_projection;
     //! View matrix
@@ -123,7 +160,7 @@ public:
     //! Check if device is lost and can be restored
     bool is_lost();
 
-    //! Device object
+    //! Device object (NULL if Direct3D is not used by render device)
     LPDIRECT3DDEVICE9 device;
     
     //! Clear rendering queue
@@ -4,12 +4,15 @@
 #include "Tanita2.h"
 #include "Python.h"
 #include <vector>
+#include <list>
+#include <map>
 
 //! Dictionary class with elements placed in creation order
 /** Usual associative containers doesn't obey any
   * element placement order. This container behaves alike
   * python::dict type but places elements in order of 
-  * element addition. */
+  * element addition. Keys are interned and located through
+  * hash index, so lookups don't call python comparison. */
 class tanita2_dict
 {
 public:
@@ -38,13 +41,48 @@ public:
     };
     // Friend
     friend class iterator;
+    
+    //! Elements of dictionary pinned for iteration
+    /** While snapshot exists, its elements stay alive and in place: changing
+      * dictionary makes dictionary own copy of elements. If dictionary isn't
+      * changed, iteration doesn't copy anything. */
+    class snapshot
+    {
+    public:
+        //! Pin elements of dictionary
+        inline snapshot( tanita2_dict & dict )
+            : dict(dict), values(dict._values.empty() ? NULL : &dict._values[0]),
+              count((int)dict._values.size())
+            { dict.iterating++; dict.pinned = true; }
+        //! Release pinned elements
+        inline ~snapshot()
+            { if (0 == --dict.iterating) { dict.retired.clear(); dict.pinned = false; } }
+        
+        //! Number of pinned elements
+        inline int size() const { return count; }
+        //! Get pinned value
+        inline bp::object & value( int i ) { return values[i]; }
+        
+    protected:
+        // Dictionary
+        tanita2_dict & dict;
+        // Pinned values
+        bp::object * values;
+        // Number of pinned values
+        int count;
+    };
+    // Friend
+    friend class snapshot;
 
     //! Constructor
-    inline tanita2_dict() {}
+    inline tanita2_dict() : iterating(0), pinned(false) {}
 
     //! Copy constructor
     explicit inline tanita2_dict( const tanita2_dict & d )
-        : _keys(d._keys), _values(d._values) {}
+        : _keys(d._keys), _values(d._values), _hashes(d._hashes), _index(d._index),
+          iterating(0), pinned(false) {}
+    //! Assignment
+    tanita2_dict & operator =( const tanita2_dict & d );
     
     //! Dictionary start iterator
     inline iterator begin() { return iterator(*this, 0); }
@@ -54,7 +92,8 @@ public:
     //! Dictionary length
     inline int len() { return _keys.size(); }
     //! Clearing all elements
-    inline void clear() { _keys.clear(); _values.clear(); }
+    inline void clear()
+        { detach(); _keys.clear(); _values.clear(); _hashes.clear(); _index.clear(); }
     //! Check key existence
     bool has_key( bp::str & index );
     
@@ -97,17 +136,59 @@ protected:
     // Get index of given key
     unsigned int get_index( bp::str & key );
 
+    //! Find position of key
+    /** \return index of element or -1 if there is no such key */
+    int find( bp::str & key );
+    //! Find hash index slot of key
+    /** \return slot referencing element with key or empty slot */
+    size_t find_slot( PyObject * key, long hash );
+    //! Add element at given position to hash index
+    void index_insert( int position );
+    //! Rebuild hash index after elements were moved
+    void rebuild_index();
+    
+    //! Prepare for changing elements (copy elements pinned by snapshot)
+    inline void detach() { if (pinned) retire(); }
+    //! Keep pinned elements until iteration end and continue with their copy
+    void retire();
+
 protected:
     // Dictionary keys
     std::vector<bp::str> _keys;
     // Dictionary values
     std::vector<bp::object> _values;
+    // Key hashes
+    std::vector<long> _hashes;
+    // Open addressing hash index of element positions (-1 for empty slot)
+    std::vector<int> _index;
+    
+    // Elements replaced while being iterated
+    struct Retired
+    {
+        std::vector<bp::str> keys;
+        std::vector<bp::object> values;
+    };
+    // Elements kept alive for snapshots
+    std::list<Retired> retired;
+    // Number of existing snapshots
+    int iterating;
+    // Current elements are pinned by snapshot
+    bool pinned;
 };
 
 // Namespace for game object type declarations
 namespace ingame
 {
 
+//! Check if python object may override update method of wrapped class
+/** Instance dictionary and classes of object are looked up without
+  * creating bound method, so the check is cheap enough for every update
+  * and notices update methods assigned to class or instance at any time.
+  * \param  self          python object
+  * \param  class_object  python class of wrapped C++ class
+  * \return true if update found for object isn't the one of wrapped class */
+bool overrides_update( PyObject * self, PyTypeObject * class_object );
+
 // Wrapper class template for GameObject child
 template<class T>
 struct Wrapper: T, bp::wrapper<T>
@@ -117,11 +198,14 @@ struct Wrapper: T, bp::wrapper<T>
 
     void update( float dt )
     {
-        if (bp::override update = this->get_override("update"))
-        {
-            update(dt);
-            return;
-        }
+        // Bound method is created only for objects overriding update
+        PyObject * self = bp::detail::wrapper_base_::get_owner(*this);
+        if (self && overrides_update(self, bp::converter::registered<T>::converters.get_class_object()))
+            if (bp::override update = this->get_override("update"))
+            {
+                update(dt);
+                return;
+            }
         return T::update(dt);
     }
 
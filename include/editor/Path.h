@@ -259,22 +259,16 @@ private:
         friend class PathFindRegion;
         
         // Vertex format
-        struct PathOutlineFormat
-        {
-            // Position
-            float x, y, z;
-            // Color
-            DWORD color;
-
-            // Constructor
-            PathOutlineFormat( float x, float y, DWORD color )
-                : x(x), y(y), z(0), color(color) {}
-
-                // Flexible vertex format description
-                static const DWORD FVF = D3DFVF_XYZ | D3DFVF_DIFFUSE;
-        };
+        typedef ColoredVertex PathOutlineFormat;
         // Cached region points
         std::vector<PathOutlineFormat> cached_node_points;
+        
+        // Outline is redrawn when region points or nodes change
+        virtual DWORD get_content_hash()
+            { DWORD hash = PointContainer::OutlineSequence::get_content_hash();
+              return cached_node_points.empty() ? hash :
+                     hash_bytes(&cached_node_points[0],
+                                cached_node_points.size() * sizeof(PathOutlineFormat), hash); }
     };
     
     // Friend
@@ -0,0 +1,21 @@
+#pragma once
+#include "Tanita2.h"
+#include <vector>
+
+//! Encode 32-bit image to PNG format
+/** \param  out     receives PNG file contents
+  * \param  pixels  image data in A8R8G8B8 format (top row first)
+  * \param  width   image width
+  * \param  height  image height
+  * \param  pitch   size of image row in pixels */
+void encode_png( std::vector<BYTE> & out, const DWORD * pixels,
+                 int width, int height, int pitch );
+
+//! Save 32-bit image to PNG file
+/** \param  filename  path to image file
+  * \param  pixels    image data in A8R8G8B8 format (top row first)
+  * \param  width     image width
+  * \param  height    image height
+  * \param  pitch     size of image row in pixels */
+void save_png( const std::string & filename, const DWORD * pixels,
+               int width, int height, int pitch );
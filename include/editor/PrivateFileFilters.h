@@ -33,43 +33,127 @@ public:
         ASSERT(NULL != contents && 0 != size);
         void * old_contents = *contents;
         
+        bool compress = hint & FileManagerInstance::HINT::HINT_COMPRESSED_TEXTURE;
+        *contents = convert(old_contents, *size, compress, size);
+        if (!(hint & FileManagerInstance::HINT::HINT_DONT_SAVE_DDS))
+            save(filename, *contents, *size);
+                
+        // Cleanup
+        delete [] old_contents;
+    }
+    
+    //! Split image to tiles for streaming
+    /** Image art\\dir.png is split to DDS textures art\\dir\\0.dds ...
+      * art\\dir\\N.dds, tile_size pixels square, in row-major order (right
+      * and bottom tiles may be smaller). Tiles are not cooked again while
+      * they are newer than image.
+      * \param  path       path to image
+      * \param  tile_size  tile width and height in pixels
+      * \param  compress   compress tiles
+      * \param  columns, rows  receive tile grid size */
+    static void split( PATH & path, int tile_size, bool compress, int & columns, int & rows )
+    {
+        std::string source = path.get_path_string();
+        D3DXIMAGE_INFO info;
+        ASSERT_DIRECTX(D3DXGetImageInfoFromFile(source.c_str(), &info));
+        columns = (info.Width + tile_size - 1) / tile_size;
+        rows = (info.Height + tile_size - 1) / tile_size;
+        
+        // Last tile is saved last, so all tiles are cooked if it is up to date
+        PATH last(path.get_directory(), columns * rows - 1, PATH::DDS);
+        if (is_newer(last.get_path_string(), source))
+            return;
+        
+        Direct3D d3d;
+        LPDIRECT3DTEXTURE9 image;
+        ASSERT_DIRECTX(D3DXCreateTextureFromFileEx(d3d->device, source.c_str(),
+                           D3DX_DEFAULT_NONPOW2, D3DX_DEFAULT_NONPOW2, 1, 0, D3DFMT_A8R8G8B8,
+                           D3DPOOL_SYSTEMMEM, D3DX_FILTER_NONE, D3DX_FILTER_NONE, 0,
+                           NULL, NULL, &image));
+        LPDIRECT3DSURFACE9 surface;
+        ASSERT_DIRECTX(image->GetSurfaceLevel(0, &surface));
+        CreateDirectory(source.substr(0, source.size() - 4).c_str(), NULL);
+        
+        for (int row = 0; row < rows; ++row)
+            for (int column = 0; column < columns; ++column)
+            {
+                // Tile is cut to uncompressed DDS and cooked as any other image
+                RECT r = {column * tile_size, row * tile_size,
+                          min((column + 1) * tile_size, (int)info.Width),
+                          min((row + 1) * tile_size, (int)info.Height)};
+                LPD3DXBUFFER tile;
+                ASSERT_DIRECTX(D3DXSaveSurfaceToFileInMemory(&tile, D3DXIFF_DDS, surface,
+                                                             NULL, &r));
+                int size;
+                char * contents = convert(tile->GetBufferPointer(), tile->GetBufferSize(),
+                                          compress, &size);
+                tile->Release();
+                PATH p(path.get_directory(), row * columns + column, PATH::DDS);
+                save(p.get_path_string(), contents, size);
+                delete [] contents;
+            }
+        
+        surface->Release();
+        image->Release();
+    }
+    
+protected:
+    //! Convert image file in memory to DDS texture
+    /** Half and quarter resolution variants are stored as mip levels,
+      * original image size is saved in reserved field of description.
+      * \param  image       image file contents
+      * \param  image_size  size of image file
+      * \param  compress    compress texture
+      * \param  size        receives size of DDS file
+      * \return DDS file contents (allocated with new[]) */
+    static char * convert( const void * image, int image_size, bool compress, int * size )
+    {
         Direct3D d3d;
         // Creating texture from contents
         LPDIRECT3DTEXTURE9 tmp_texture;
         D3DXIMAGE_INFO info;
         
-        bool compress = hint & FileManagerInstance::HINT::HINT_COMPRESSED_TEXTURE;
         const D3DFORMAT compression = (D3DFORMAT)Direct3DInstance::TextureManagerInstance::DXT_METHOD;
         ASSERT_DIRECTX(D3DXCreateTextureFromFileInMemoryEx(d3d->device,
-                           *contents, *size, D3DX_DEFAULT, D3DX_DEFAULT, 1, 0, 
+                           image, image_size, D3DX_DEFAULT, D3DX_DEFAULT, 
+                           Direct3DInstance::TextureManagerInstance::LOD_COUNT, 0, 
                            compress ? compression : D3DFMT_A8R8G8B8, 
                            D3DPOOL_SYSTEMMEM, D3DX_FILTER_NONE,
-                           D3DX_FILTER_NONE, 0, &info, NULL, &tmp_texture));
+                           D3DX_FILTER_BOX, 0, &info, NULL, &tmp_texture));
         // Saving DDS texture to memory
         LPD3DXBUFFER buf;
         ASSERT_DIRECTX(D3DXSaveTextureToFileInMemory(&buf, D3DXIFF_DDS, tmp_texture, NULL));
         *size = buf->GetBufferSize();
-        *contents = new char[*size];
-        CopyMemory(*contents, buf->GetBufferPointer(), *size);
+        char * contents = new char[*size];
+        CopyMemory(contents, buf->GetBufferPointer(), *size);
         // Saving original image info in reserved fields
-        ((DDSURFACEDESC2 *)((char *)*contents + 4))->dwReserved = ((info.Height << 16) | info.Width);
-
-        if (!(hint & FileManagerInstance::HINT::HINT_DONT_SAVE_DDS))
-        {        
-            // Saving cached texture to file
-            FILE * f = fopen(filename.c_str(), "wb");
-            ASSERT(NULL != f && "Saving cached texture failed");
-            fwrite(*contents, *size, 1, f);
-            fclose(f);
-        }                
-                
-        // Cleanup
-        delete [] old_contents;
+        ((DDSURFACEDESC2 *)(contents + 4))->dwReserved = ((info.Height << 16) | info.Width);
+        
         buf->Release();
         tmp_texture->Release();
+        return contents;
+    }
+    
+    //! Save cached texture to file
+    static void save( const std::string & filename, const void * contents, int size )
+    {
+        FILE * f = fopen(filename.c_str(), "wb");
+        ASSERT(NULL != f && "Saving cached texture failed");
+        fwrite(contents, size, 1, f);
+        fclose(f);
+    }
+    
+    //! Check if file exists and was modified not earlier than other file
+    static bool is_newer( const std::string & filename, const std::string & other )
+    {
+        WIN32_FILE_ATTRIBUTE_DATA a, b;
+        if (!GetFileAttributesEx(filename.c_str(), GetFileExInfoStandard, &a))
+            return false;
+        if (!GetFileAttributesEx(other.c_str(), GetFileExInfoStandard, &b))
+            return true;
+        return CompareFileTime(&a.ftLastWriteTime, &b.ftLastWriteTime) >= 0;
     }
     
-protected:
     std::string filename;
 };
 
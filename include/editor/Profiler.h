@@ -0,0 +1,91 @@
+#pragma once
+#include "Tanita2.h"
+#include <vector>
+
+//! Scoped zone profiler
+/** Finished zones are written to per-thread ring buffers, so recording
+  * takes no locks. Timestamps come from performance counter and are
+  * exported with nanosecond resolution. Profiler does not use singletons
+  * and may be used from worker threads. */
+class Profiler
+{
+public:
+    //! Recorded zone
+    struct Event
+    {
+        //! Zone name (string literal)
+        const char * name;
+        //! Zone start and end (performance counter ticks)
+        LONGLONG start, end;
+    };
+
+    //! Scoped zone, records time from construction to destruction
+    class Zone
+    {
+    public:
+        //! Start zone
+        /** \param  name  zone name, should be string literal */
+        inline Zone( const char * name )
+            : name(is_enabled() ? name : NULL)
+            { if (this->name) start = now(); }
+        //! Finish zone
+        inline ~Zone()
+            { if (name) record(name, start, now()); }
+
+    protected:
+        //! Zone name (NULL if profiler was disabled on start)
+        const char * name;
+        //! Zone start
+        LONGLONG start;
+    };
+
+    //! Ring buffer of one thread
+    struct ThreadBuffer
+    {
+        //! Constructor
+        ThreadBuffer();
+
+        //! Owner thread identifier
+        DWORD thread_id;
+        //! Events ring
+        std::vector<Event> events;
+        //! Number of events written (wraps around)
+        volatile LONG count;
+        //! Ring was filled at least once
+        volatile LONG full;
+    };
+
+    //! Number of events kept for each thread (power of two)
+    static const DWORD ring_size = 16384;
+
+    //! Enable or disable recording
+    static void enable( bool value );
+    //! Check if recording is enabled
+    static inline bool is_enabled() { return 0 != enabled; }
+
+    //! Current timestamp (performance counter ticks)
+    static inline LONGLONG now()
+        { LARGE_INTEGER t; QueryPerformanceCounter(&t); return t.QuadPart; }
+
+    //! Record finished zone for calling thread
+    /** \param  name   zone name, should be string literal
+      * \param  start  zone start timestamp
+      * \param  end    zone end timestamp */
+    static void record( const char * name, LONGLONG start, LONGLONG end );
+
+    //! Write recorded zones to file in Chrome trace event format
+    /** \param  filename  path to JSON file */
+    static void save_trace( const std::string & filename );
+    //! Forget all recorded zones
+    static void clear();
+
+protected:
+    //! Get ring buffer of calling thread (created on first use)
+    static ThreadBuffer & get_buffer();
+
+    //! Recording enabled flag
+    static volatile LONG enabled;
+};
+
+//! Profile enclosing scope
+#define PROFILE_ZONE(name) Profiler::Zone profile_zone_(name)
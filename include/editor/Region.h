@@ -63,6 +63,10 @@ protected:
     protected:
         // Rendering
         virtual void render();
+        // Outline is redrawn when points or color change
+        virtual DWORD get_content_hash()
+            { return cached_points.empty() ? color :
+                     hash_bytes(&cached_points[0], cached_points.size() * sizeof(D3DXVECTOR3), color); }
 
         // Color
         D3DCOLOR color;
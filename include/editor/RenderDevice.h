@@ -0,0 +1,870 @@
+#pragma once
+#include "Tanita2.h"
+#include "WorkerPool.h"
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+//! Sprite vertex format
+struct TexturedVertex
+{
+    //! Position
+    float x, y, z;
+    //! Texture coordinates
+    float u, v;
+
+    //! Constructor
+    inline TexturedVertex() {}
+    //! Constructor
+    inline TexturedVertex( float x, float y, float u, float v )
+        : x(x), y(y), z(0), u(u), v(v) {}
+    //! Flexible vertex format description
+    static const DWORD FVF = D3DFVF_XYZ | D3DFVF_TEX1 | D3DFVF_TEXCOORDSIZE2(0);
+};
+
+//! Untextured colored vertex format
+struct ColoredVertex
+{
+    //! Position
+    float x, y, z;
+    //! Color
+    DWORD color;
+
+    //! Constructor
+    inline ColoredVertex() {}
+    //! Constructor
+    inline ColoredVertex( float x, float y, DWORD color )
+        : x(x), y(y), z(0), color(color) {}
+    //! Flexible vertex format description
+    static const DWORD FVF = D3DFVF_XYZ | D3DFVF_DIFFUSE;
+};
+
+//! Text glyph vertex format
+/** Position is given in render target pixels. */
+struct TextVertex
+{
+    //! Position
+    float x, y, z, rhw;
+    //! Color
+    DWORD color;
+    //! Texture coordinates
+    float u, v;
+
+    //! Constructor
+    inline TextVertex() {}
+    //! Constructor
+    inline TextVertex( float x, float y, DWORD color, float u, float v )
+        : x(x), y(y), z(0), rhw(1), color(color), u(u), v(v) {}
+    //! Flexible vertex format description
+    static const DWORD FVF = D3DFVF_XYZRHW | D3DFVF_DIFFUSE | D3DFVF_TEX1;
+};
+
+class GlyphAtlas;
+
+//! Rendering backend interface
+/** All engine drawing goes through this interface. Direct3D 9 device is
+  * used normally, null and software devices allow running engine without
+  * graphical hardware (config value "render_device" is "null" or "software"). */
+class RenderDevice
+{
+public:
+    //! Texture owned by render device
+    class Texture
+    {
+    public:
+        //! Destructor
+        virtual ~Texture() {}
+
+        //! Lock top texture level for writing
+        /** \param  pitch    receives size of texture row in bytes
+          * \param  discard  true if whole contents will be overwritten
+          * \return pointer to texture data */
+        virtual BYTE * lock( int & pitch, bool discard ) = 0;
+        //! Unlock texture
+        virtual void unlock() = 0;
+
+        //! Texture width and height
+        int width, height;
+        //! Texture format
+        D3DFORMAT format;
+
+    protected:
+        //! Constructor
+        inline Texture( int width, int height, D3DFORMAT format )
+            : width(width), height(height), format(format) {}
+    };
+
+    //! Vertex buffer with TexturedVertex data
+    class VertexBuffer
+    {
+    public:
+        //! Destructor
+        virtual ~VertexBuffer() {}
+
+        //! Vertex buffer locking mode
+        enum LockMode
+        {
+            LOCK_NORMAL,       //!< Locked data may be in use by device
+            LOCK_DISCARD,      //!< Previous buffer contents are discarded
+            LOCK_NOOVERWRITE,  //!< Vertices used by device are not overwritten
+        };
+
+        //! Lock vertices for writing
+        /** \param  start  index of first vertex to lock
+          * \param  count  number of vertices to lock
+          * \param  mode   locking mode */
+        virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode ) = 0;
+        //! Unlock vertex buffer
+        virtual void unlock() = 0;
+
+        //! Buffer size in vertices
+        UINT size;
+
+    protected:
+        //! Constructor
+        inline VertexBuffer( UINT size ) : size(size) {}
+    };
+
+    //! Off-screen render target
+    class RenderTarget
+    {
+    public:
+        //! Destructor
+        virtual ~RenderTarget() {}
+
+        //! Save render target contents to PNG file
+        /** \param  filename  path to image file */
+        virtual void save( const std::string & filename ) = 0;
+
+        //! Render target width and height
+        int width, height;
+
+    protected:
+        //! Constructor
+        inline RenderTarget( int width, int height ) : width(width), height(height) {}
+    };
+
+    //! Texture usage
+    enum TextureUsage
+    {
+        TEXTURE_STATIC,         //!< Texture is filled once
+        TEXTURE_DYNAMIC,        //!< Texture is locked frequently
+        TEXTURE_RENDER_TARGET,  //!< Texture is used as render target
+    };
+
+    //! Rendering statistics
+    struct Stats
+    {
+        //! Number of presented frames
+        DWORD frames;
+        //! Number of draw calls
+        DWORD draw_calls;
+        //! Number of drawn primitives
+        DWORD primitives;
+        //! Number of texture binding changes
+        DWORD texture_changes;
+        //! Number of created textures
+        DWORD texture_uploads;
+
+        //! Constructor
+        inline Stats() { ZeroMemory(this, sizeof(*this)); }
+    };
+
+    //! Destructor
+    virtual ~RenderDevice() {}
+
+    //! Setup render state (no z-test, alpha test and blending, point sampling)
+    virtual void setup_state() = 0;
+    //! Get device state
+    /** \return D3D_OK, D3DERR_DEVICELOST or D3DERR_DEVICENOTRESET */
+    virtual HRESULT test_cooperative_level() = 0;
+    //! Reset lost device
+    /** Textures should be unloaded before reset */
+    virtual void reset() = 0;
+    //! Get amount of texture memory in kilobytes
+    virtual UINT get_available_texture_mem() = 0;
+
+    //! Begin rendering
+    virtual void begin_scene() = 0;
+    //! End rendering
+    virtual void end_scene() = 0;
+    //! Clear current render target
+    /** \param  color  color to clear */
+    virtual void clear( D3DCOLOR color ) = 0;
+    //! Present back buffer
+    /** \return false if device was lost */
+    virtual bool present() = 0;
+    //! Restrict clearing, drawing and presenting to rectangle of back buffer
+    /** Back buffer outside of rectangle must keep previous frame, so devices
+      * which can't guarantee it ignore rectangle and return false.
+      * \param  rect  rectangle in back buffer pixels, NULL to disable
+      * \return true if rectangle is used */
+    virtual bool set_clip_rect( const RECT * rect ) { return false; }
+
+    //! Create texture from DDS file in memory
+    /** \param  dds          DDS file contents
+      * \param  size         DDS file size
+      * \param  width        texture width (after skipping levels)
+      * \param  height       texture height (after skipping levels)
+      * \param  format       texture format
+      * \param  skip_levels  number of top mip levels to skip
+      * \param  texture      receives created texture */
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture ) = 0;
+    //! Create empty texture
+    /** \param  width    texture width
+      * \param  height   texture height
+      * \param  format   texture format
+      * \param  usage    texture usage
+      * \param  texture  receives created texture */
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture ) = 0;
+    //! Bind texture to rendering pipeline
+    /** \param  texture        texture to bind (NULL to disable texturing)
+      * \param  sampler_index  sampler to bind texture to */
+    virtual void set_texture( Texture * texture, int sampler_index = 0 ) = 0;
+
+    //! Create vertex buffer
+    /** \param  size     buffer size in vertices
+      * \param  dynamic  true if buffer is refilled every frame */
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic ) = 0;
+    //! Draw triangle strip from vertex buffer with current texture
+    /** \param  buffer           vertex buffer
+      * \param  start_vertex     index of first vertex
+      * \param  primitive_count  number of triangles */
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex,
+                             UINT primitive_count ) = 0;
+    //! Draw triangle list from vertex buffer with current texture
+    /** \param  buffer           vertex buffer
+      * \param  start_vertex     index of first vertex
+      * \param  primitive_count  number of triangles */
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex,
+                                 UINT primitive_count ) = 0;
+    //! Draw untextured triangle strip
+    /** \param  vertices         strip vertices
+      * \param  primitive_count  number of triangles */
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count ) = 0;
+    //! Draw untextured points
+    /** \param  vertices  point list
+      * \param  count     number of points
+      * \param  size      point size in pixels */
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size ) = 0;
+    //! Draw line strip with current world transformation
+    /** \param  points  line strip points
+      * \param  count   number of points
+      * \param  color   line color */
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color ) = 0;
+    //! Draw one pixel wide untextured line list with current world transformation
+    /** \param  vertices    pairs of line end points
+      * \param  line_count  number of lines */
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count ) = 0;
+    //! Draw text in screen coordinates
+    /** Text is laid out to glyph quads which are drawn in one batch
+      * on top of scene at end_scene().
+      * \param  text   text string
+      * \param  x, y   top-left corner of text
+      * \param  color  text color */
+    virtual void draw_text( const std::string & text, int x, int y, D3DCOLOR color );
+
+    //! Set world transformation matrix
+    virtual void set_world_transform( const D3DXMATRIX & world ) = 0;
+    //! Set view and projection matrices
+    virtual void set_view_projection( const D3DXMATRIX & view,
+                                      const D3DXMATRIX & projection ) = 0;
+
+    //! Create off-screen render target
+    /** \param  width   render target width
+      * \param  height  render target height */
+    virtual RenderTarget * create_render_target( int width, int height ) = 0;
+    //! Set render target for following drawing
+    /** \param  target  render target (NULL for back buffer) */
+    virtual void set_render_target( RenderTarget * target ) = 0;
+
+    //! Copy back buffer to system memory
+    /** Should be called after end of scene and before present.
+      * \param  width, height  image size (back buffer is scaled to it)
+      * \param  pixels         receives image in A8R8G8B8 format (top row first) */
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels ) = 0;
+
+    //! Get glyph atlas of text font (created on first use)
+    static const GlyphAtlas & get_glyph_atlas();
+
+    //! Rendering statistics
+    Stats stats;
+
+protected:
+    //! Draw glyph quads laid out since last flush
+    /** \param  atlas     glyph atlas referenced by quads
+      * \param  vertices  triangle list in render target coordinates */
+    virtual void draw_text_quads( const GlyphAtlas & atlas,
+                                  std::vector<TextVertex> & vertices ) = 0;
+    //! Draw and forget laid out text (called at end of scene)
+    void flush_text();
+
+    //! Glyph quads of text drawn in current scene
+    std::vector<TextVertex> text_vertices;
+};
+
+//! Direct3D 9 rendering device
+class D3D9RenderDevice: public RenderDevice
+{
+public:
+    //! Constructor
+    /** \param  device          Direct3D device
+      * \param  present_params  device present parameters (used for reset) */
+    D3D9RenderDevice( LPDIRECT3DDEVICE9 device, D3DPRESENT_PARAMETERS & present_params );
+    //! Destructor
+    virtual ~D3D9RenderDevice();
+
+    virtual void setup_state();
+    virtual HRESULT test_cooperative_level();
+    virtual void reset();
+    virtual UINT get_available_texture_mem();
+
+    virtual void begin_scene();
+    virtual void end_scene();
+    virtual void clear( D3DCOLOR color );
+    virtual bool present();
+    virtual bool set_clip_rect( const RECT * rect );
+
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture );
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture );
+    virtual void set_texture( Texture * texture, int sampler_index = 0 );
+
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic );
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count );
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size );
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color );
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count );
+
+    virtual void set_world_transform( const D3DXMATRIX & world );
+    virtual void set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection );
+
+    virtual RenderTarget * create_render_target( int width, int height );
+    virtual void set_render_target( RenderTarget * target );
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels );
+
+protected:
+    virtual void draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices );
+
+    //! Forget cached device state
+    void invalidate_state();
+    //! Release back buffer copying surfaces
+    void release_readback();
+    //! Draw primitives from vertex buffer
+    void draw_primitive( D3DPRIMITIVETYPE type, VertexBuffer * buffer,
+                         UINT start_vertex, UINT primitive_count );
+
+    //! Direct3D device
+    LPDIRECT3DDEVICE9 device;
+    //! Device present parameters
+    D3DPRESENT_PARAMETERS & present_params;
+    //! Device capabilities
+    D3DCAPS9 caps;
+    //! Glyph atlas texture
+    LPDIRECT3DTEXTURE9 glyph_texture;
+    //! Line renderer
+    LPD3DXLINE line_drawer;
+
+    //! Current world and projection matrices (for line rendering)
+    D3DXMATRIX world, projection;
+    //! Currently bound texture
+    LPDIRECT3DTEXTURE9 current_texture;
+    //! Bound texture is known (false after state was changed by D3DX)
+    bool texture_known;
+    //! Current stream source
+    LPDIRECT3DVERTEXBUFFER9 current_stream;
+    //! Current vertex format
+    DWORD current_fvf;
+    //! Back buffer surface saved while rendering to off-screen target
+    LPDIRECT3DSURFACE9 back_buffer;
+    //! Persistent downscale target and system memory copy for back buffer reading
+    LPDIRECT3DSURFACE9 readback_target, readback_staging;
+    //! Size of back buffer reading surfaces
+    int readback_width, readback_height;
+    //! Rectangle drawing is restricted to
+    RECT clip_rect;
+    //! Drawing is restricted to clip_rect
+    bool clipped;
+};
+
+//! Render device which doesn't draw anything
+/** Only counts calls in statistics. Used for running engine
+  * without graphical hardware. */
+class NullRenderDevice: public RenderDevice
+{
+public:
+    //! Constructor
+    /** \param  texture_mem  reported texture memory amount in kilobytes */
+    inline NullRenderDevice( UINT texture_mem ) : texture_mem(texture_mem), current_texture(NULL) {}
+
+    virtual void setup_state() {}
+    virtual HRESULT test_cooperative_level() { return D3D_OK; }
+    virtual void reset() {}
+    virtual UINT get_available_texture_mem() { return texture_mem; }
+
+    virtual void begin_scene() {}
+    virtual void end_scene() { flush_text(); }
+    virtual void clear( D3DCOLOR color ) {}
+    virtual bool present() { stats.frames++; return true; }
+
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture );
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture );
+    virtual void set_texture( Texture * texture, int sampler_index = 0 );
+
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic );
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count );
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size );
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color );
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count );
+
+    virtual void set_world_transform( const D3DXMATRIX & world ) {}
+    virtual void set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection ) {}
+
+    virtual RenderTarget * create_render_target( int width, int height );
+    virtual void set_render_target( RenderTarget * target ) {}
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels );
+
+protected:
+    virtual void draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices );
+
+    //! Reported texture memory amount
+    UINT texture_mem;
+    //! Currently bound texture
+    Texture * current_texture;
+};
+
+//! Render device drawing to system memory
+/** Reproduces render state of Direct3D device (point sampling, clamp
+  * addressing, alpha test with reference 1, SRCALPHA/INVSRCALPHA blending),
+  * so screenshots can be made without graphical hardware. Drawing commands
+  * are recorded until end of scene, then render target is split into
+  * horizontal tiles rasterized in parallel by worker pool. */
+class SoftwareRenderDevice: public RenderDevice
+{
+public:
+    //! Image in A8R8G8B8 format
+    struct Surface
+    {
+        //! Image width and height
+        int width, height;
+        //! Pixels (top row first)
+        std::vector<DWORD> pixels;
+
+        //! Constructor
+        inline Surface( int width, int height )
+            : width(width), height(height), pixels(width * height) {}
+    };
+    //! Reference to image shared between texture and recorded commands
+    typedef boost::shared_ptr<const Surface> SurfaceRef;
+
+    //! Vertex in render target coordinates
+    struct Vertex
+    {
+        //! Position
+        float x, y;
+        //! Texture coordinates
+        float u, v;
+        //! Color (modulates texture of text glyphs)
+        D3DCOLOR color;
+    };
+
+    //! Constructor
+    /** \param  width, height  back buffer size
+      * \param  window         window to show presented frames in (may be NULL)
+      * \param  texture_mem    reported texture memory amount in kilobytes */
+    SoftwareRenderDevice( int width, int height, HWND window, UINT texture_mem );
+    //! Destructor
+    virtual ~SoftwareRenderDevice();
+
+    virtual void setup_state() {}
+    virtual HRESULT test_cooperative_level() { return D3D_OK; }
+    virtual void reset() {}
+    virtual UINT get_available_texture_mem() { return texture_mem; }
+
+    virtual void begin_scene() {}
+    virtual void end_scene();
+    virtual void clear( D3DCOLOR color );
+    virtual bool present();
+
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture );
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture );
+    virtual void set_texture( Texture * texture, int sampler_index = 0 );
+
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic );
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count );
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size );
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color );
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count );
+
+    virtual void set_world_transform( const D3DXMATRIX & world );
+    virtual void set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection );
+
+    virtual RenderTarget * create_render_target( int width, int height );
+    virtual void set_render_target( RenderTarget * target );
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels );
+
+    //! Rasterize recorded commands to part of current render target
+    /** Called from worker threads.
+      * \param  top, bottom  rows range [top, bottom) to draw */
+    void rasterize( int top, int bottom ) const;
+
+protected:
+    virtual void draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices );
+
+    //! Recorded drawing command
+    struct Command
+    {
+        //! Command type
+        enum Type
+        {
+            CLEAR,       //!< Fill render target with color
+            TRIANGLES,   //!< Triangle list (textured if texture is set, modulated by color of first vertex)
+            POINTS,      //!< Square points
+            LINE_STRIP,  //!< One pixel wide line strip
+            LINES,       //!< One pixel wide line list
+        } type;
+        //! Vertices
+        std::vector<Vertex> vertices;
+        //! Texture (may be empty)
+        SurfaceRef texture;
+        //! Clear color
+        D3DCOLOR color;
+        //! Point size in pixels
+        float point_size;
+    };
+
+    //! Rasterize recorded commands to whole render target
+    void flush();
+    //! Record textured triangles from vertex buffer
+    /** \param  strip  true for triangle strip, false for triangle list */
+    void add_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count, bool strip );
+    //! Start recording new command
+    Command & add_command( Command::Type type, D3DCOLOR color );
+    //! Transform vertex to render target coordinates
+    Vertex transform_vertex( float x, float y, float z, float u, float v, D3DCOLOR color ) const;
+
+    //! Reported texture memory amount
+    UINT texture_mem;
+    //! Window to show presented frames in
+    HWND window;
+    //! Back buffer
+    boost::shared_ptr<Surface> back_buffer;
+    //! Current render target
+    Surface * target;
+    //! Recorded commands
+    std::vector<Command> commands;
+    //! Currently bound texture
+    Texture * current_texture;
+    //! World, view and projection matrices
+    D3DXMATRIX world, view_projection;
+    //! Combined transformation
+    D3DXMATRIX transform;
+    //! Glyph atlas image (created on first text drawing)
+    SurfaceRef glyph_surface;
+    //! Pool rasterizing tiles (held by device, so it may be used from render thread)
+    WorkerPool worker_pool;
+};
+
+//! Render device which writes command stream to file
+/** Forwards all calls to another device and serializes them to compact
+  * binary capture: resource creation and updates, texture binds, world
+  * transforms, draws, lines and text, one frame per present call.
+  * Captures are replayed against any device with replay(). Enabled by
+  * config value "render_capture" (capture file path). */
+class CaptureRenderDevice: public RenderDevice
+{
+public:
+    //! Capture record type
+    enum Opcode
+    {
+        OP_SETUP_STATE = 1,      //!< setup_state()
+        OP_BEGIN_SCENE,          //!< begin_scene()
+        OP_END_SCENE,            //!< end_scene()
+        OP_CLEAR,                //!< color
+        OP_PRESENT,              //!< end of frame
+        OP_CREATE_TEXTURE_DDS,   //!< id, width, height, format, skip levels, size, DDS data
+        OP_CREATE_TEXTURE,       //!< id, width, height, format, usage
+        OP_TEXTURE_DATA,         //!< id, pitch, size, locked data
+        OP_DESTROY_TEXTURE,      //!< id
+        OP_SET_TEXTURE,          //!< id (0 for no texture), sampler
+        OP_CREATE_BUFFER,        //!< id, size, dynamic flag
+        OP_BUFFER_DATA,          //!< id, start, count, lock mode, vertices
+        OP_DESTROY_BUFFER,       //!< id
+        OP_DRAW_STRIP,           //!< buffer id, start vertex, primitive count
+        OP_DRAW_TRIANGLES,       //!< buffer id, start vertex, primitive count
+        OP_DRAW_COLORED_STRIP,   //!< primitive count, vertices
+        OP_DRAW_POINTS,          //!< count, size, vertices
+        OP_DRAW_LINES,           //!< count, color, points
+        OP_DRAW_TEXT,            //!< x, y, color, length, characters
+        OP_WORLD_TRANSFORM,      //!< 2x3 affine part of world matrix
+        OP_VIEW_PROJECTION,      //!< view and projection matrices
+        OP_CREATE_TARGET,        //!< id, width, height
+        OP_SET_TARGET,           //!< id (0 for back buffer)
+        OP_DESTROY_TARGET,       //!< id
+        OP_DRAW_LINE_LIST,       //!< line count, vertices
+    };
+
+    //! Capture file signature ("T2RC") and format version (older versions are replayed too)
+    static const DWORD signature = 0x43523254, version = 2;
+
+    //! Constructor
+    /** \param  device         device to forward calls to (owned by capture device)
+      * \param  filename       capture file path
+      * \param  width, height  back buffer size */
+    CaptureRenderDevice( RenderDevice * device, const std::string & filename,
+                         int width, int height );
+    //! Destructor
+    virtual ~CaptureRenderDevice();
+
+    //! Replay capture file
+    /** \param  filename     capture file path
+      * \param  backend      device to execute commands on ("null" or "software")
+      * \param  frame_times  receives time of each frame in milliseconds */
+    static void replay( const std::string & filename, const std::string & backend,
+                        std::vector<double> & frame_times );
+
+    virtual void setup_state();
+    virtual HRESULT test_cooperative_level();
+    virtual void reset();
+    virtual UINT get_available_texture_mem();
+
+    virtual void begin_scene();
+    virtual void end_scene();
+    virtual void clear( D3DCOLOR color );
+    virtual bool present();
+
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture );
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture );
+    virtual void set_texture( Texture * texture, int sampler_index = 0 );
+
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic );
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count );
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size );
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color );
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count );
+    virtual void draw_text( const std::string & text, int x, int y, D3DCOLOR color );
+
+    virtual void set_world_transform( const D3DXMATRIX & world );
+    virtual void set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection );
+
+    virtual RenderTarget * create_render_target( int width, int height );
+    virtual void set_render_target( RenderTarget * target );
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels );
+
+    //! Write record header
+    void put_opcode( Opcode op );
+    //! Write raw data to capture
+    void put_data( const void * data, size_t size );
+    //! Write value to capture
+    template<class T> inline void put( const T & value ) { put_data(&value, sizeof(T)); }
+
+protected:
+    virtual void draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices ) {}
+
+    //! Device calls are forwarded to
+    RenderDevice * device;
+    //! Capture file
+    FILE * file;
+    //! Last assigned resource identifier
+    DWORD last_id;
+    //! Statistics of forwarded device at last present
+    Stats device_stats;
+};
+
+//! Render device which executes drawing on dedicated thread
+/** Drawing calls are recorded to frame command list with copies of
+  * vertices, transformations and texture handles. present() hands the
+  * list to render thread and returns, so next frame is updated while
+  * previous one is drawn; two lists are used alternately. Resources are
+  * created by calling thread (Direct3D device should be created with
+  * D3DCREATE_MULTITHREADED) and destroyed only after frames using them
+  * are drawn. Texture contents written with discarding lock are recorded
+  * too and uploaded by render thread in order with draws, so frame being
+  * drawn never samples texture being rewritten. Enabled by config value
+  * "render_thread". */
+class ThreadedRenderDevice: public RenderDevice
+{
+public:
+    //! Constructor
+    /** \param  device  device to execute calls on (owned by threaded device) */
+    ThreadedRenderDevice( RenderDevice * device );
+    //! Destructor
+    virtual ~ThreadedRenderDevice();
+
+    virtual void setup_state();
+    virtual HRESULT test_cooperative_level();
+    virtual void reset();
+    virtual UINT get_available_texture_mem();
+
+    virtual void begin_scene();
+    virtual void end_scene();
+    virtual void clear( D3DCOLOR color );
+    virtual bool present();
+
+    virtual HRESULT create_texture( const char * dds, int size, int width, int height,
+                                    D3DFORMAT format, int skip_levels, Texture ** texture );
+    virtual HRESULT create_texture( int width, int height, D3DFORMAT format,
+                                    TextureUsage usage, Texture ** texture );
+    virtual void set_texture( Texture * texture, int sampler_index = 0 );
+
+    virtual VertexBuffer * create_vertex_buffer( UINT size, bool dynamic );
+    virtual void draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count );
+    virtual void draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count );
+    virtual void draw_points( const ColoredVertex * vertices, UINT count, float size );
+    virtual void draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color );
+    virtual void draw_line_list( const ColoredVertex * vertices, UINT line_count );
+    virtual void draw_text( const std::string & text, int x, int y, D3DCOLOR color );
+
+    virtual void set_world_transform( const D3DXMATRIX & world );
+    virtual void set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection );
+
+    virtual RenderTarget * create_render_target( int width, int height );
+    virtual void set_render_target( RenderTarget * target );
+    virtual void read_back_buffer( int width, int height, std::vector<DWORD> & pixels );
+
+    //! Execute recorded calls and wait until render thread is idle
+    /** Wrapped device may be used directly by calling thread after it. */
+    void finish();
+    //! Destroy texture after frames using it are drawn
+    void release_texture( Texture * texture );
+    //! Lock texture of wrapped device for writing
+    /** With discard, returned memory belongs to recorded frame and is
+      * uploaded by render thread before following recorded draws (only
+      * one texture may be locked at a time). Otherwise texture is locked
+      * after all recorded calls are executed.
+      * \param  texture  texture of wrapped device
+      * \param  pitch    receives size of texture row in bytes
+      * \param  discard  true if whole contents will be overwritten
+      * \return pointer to texture data */
+    BYTE * lock_texture( Texture * texture, int & pitch, bool discard );
+    //! Destroy render target after frames using it are drawn
+    void release_render_target( RenderTarget * target );
+
+protected:
+    virtual void draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices ) {}
+
+    //! Recorded call
+    struct Command
+    {
+        //! Call type
+        enum Type
+        {
+            BEGIN_SCENE,         //!< begin_scene()
+            END_SCENE,           //!< end_scene()
+            CLEAR,               //!< color
+            PRESENT,             //!< present()
+            SET_TEXTURE,         //!< texture, sampler in value
+            DRAW_STRIP,          //!< textured vertices, primitive count
+            DRAW_TRIANGLES,      //!< textured vertices, primitive count
+            DRAW_COLORED_STRIP,  //!< colored vertices, primitive count
+            DRAW_POINTS,         //!< colored vertices, point count, size
+            DRAW_LINES,          //!< points, point count, color
+            DRAW_LINE_LIST,      //!< colored vertices, line count
+            DRAW_TEXT,           //!< characters, position, color
+            WORLD_TRANSFORM,     //!< matrix
+            VIEW_PROJECTION,     //!< two matrices
+            SET_TARGET,          //!< render target
+            UPLOAD_TEXTURE,      //!< texture, uploaded bytes, row size in x
+        } type;
+        //! Offset of data in frame array (depends on type)
+        UINT start;
+        //! Number of primitives (depends on type)
+        UINT count;
+        //! Text position
+        int x, y;
+        //! Color, sampler index or point size
+        union
+        {
+            D3DCOLOR color;
+            int sampler;
+            float size;
+        };
+        //! Texture or render target of wrapped device
+        void * resource;
+    };
+
+    //! Command list of one frame
+    struct Frame
+    {
+        //! Calls in order of recording
+        std::vector<Command> commands;
+        //! Vertices of textured draws
+        std::vector<TexturedVertex> vertices;
+        //! Vertices of untextured draws
+        std::vector<ColoredVertex> colored;
+        //! Line strip points
+        std::vector<D3DXVECTOR3> points;
+        //! Transformation matrices
+        std::vector<D3DXMATRIX> matrices;
+        //! Text characters
+        std::string text;
+        //! Contents of textures updated while frame was recorded
+        std::vector<BYTE> uploads;
+        //! Resources destroyed while frame was recorded
+        std::vector<Texture *> released_textures;
+        std::vector<RenderTarget *> released_targets;
+
+        //! Forget recorded calls and destroy released resources
+        void clear();
+    };
+
+    //! Render thread function
+    static DWORD WINAPI thread_proc( LPVOID param );
+    //! Execute frame on wrapped device (called from render thread)
+    void execute( Frame & frame );
+    //! Draw textured vertices through ring buffer (called from render thread)
+    void execute_draw( Command::Type type, const TexturedVertex * vertices, UINT primitive_count );
+    //! Copy recorded contents to texture (called from render thread)
+    void execute_upload( Texture * texture, const BYTE * data, int pitch, UINT size );
+    //! Start recording new call
+    Command & add_command( Command::Type type );
+    //! Hand recorded frame to render thread
+    /** Waits until previous frame is drawn. */
+    void submit();
+    //! Wait until render thread is idle and report its error
+    void wait();
+
+    //! Device calls are executed on
+    RenderDevice * device;
+    //! Ring buffer for vertices of recorded draws
+    VertexBuffer * ring;
+    //! Write position in ring buffer
+    UINT ring_offset;
+    //! Frame being recorded and frame being drawn
+    Frame frames[2];
+    //! Index of frame being recorded
+    int recording;
+    //! Render thread handle
+    HANDLE thread;
+    //! Signaled when frame is handed to render thread
+    HANDLE work_event;
+    //! Signaled when render thread is idle
+    HANDLE idle_event;
+    //! Thread should be stopped flag
+    volatile LONG quit;
+    //! Result of last executed present
+    volatile LONG presented;
+    //! Error of render thread (empty if no errors)
+    std::string error;
+    //! Drawing statistics of wrapped device at last frame handoff
+    Stats device_stats;
+};
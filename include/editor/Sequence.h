@@ -22,6 +22,12 @@ protected:
     
     // Obtaining texture
     virtual TextureRef get_texture() { return texture; }
+    // Describe sprite for batched rendering
+    virtual bool get_sprite( Sprite & sprite )
+        { sprite.texture = texture.get();
+          sprite.width = vbuffer->get_width();
+          sprite.height = vbuffer->get_height();
+          return true; }
 
     // Reference to texture
     TextureRef texture;
@@ -41,6 +47,15 @@ public:
 protected:
     //! Updating
     virtual bool on_adding_to_queue( float dt );
+    
+    //! Publish frames to be shown in nearest future to texture manager
+    /** Lookahead window covers TextureManagerInstance::prefetch_time
+      * milliseconds of playback in current direction. */
+    void prefetch_frames();
+    //! Request texture of given frame to be resident
+    /** \param  frame     frame index
+      * \param  distance  number of frames left before frame is shown */
+    virtual void prefetch_frame( int frame, int distance ) {}
 	
 	// Time left for current frame
 	float time_left;
@@ -66,8 +81,18 @@ protected:
     // Frames
     std::vector<FrameInfo> frames;
     
+    // Request texture of given frame to be resident
+    virtual void prefetch_frame( int frame, int distance );
+    
     // Obtaining texture
     virtual TextureRef get_texture() { return frames[current_frame_number].texture; }
+    // Describe sprite for batched rendering
+    virtual bool get_sprite( Sprite & sprite )
+        { FrameInfo & f = frames[current_frame_number];
+          sprite.texture = f.texture.get();
+          sprite.width = f.buffer->get_width();
+          sprite.height = f.buffer->get_height();
+          return true; }
 };
 
 //! Base class for sequences with sound
@@ -174,6 +199,15 @@ protected:
     
     // Fill texture with current frame image
     void fill_texture();
+    
+    // Decode next frame to staging memory in background
+    virtual void prefetch_frame( int frame, int distance );
+    
+    // Double-buffered staging memory for decoded frames
+    class FrameDecoder;
+    boost::shared_ptr<FrameDecoder> decoder;
+    // Size of decoded frame in bytes
+    int frame_size;
 };
 
 //! Large animated sequence with sound
@@ -220,6 +254,8 @@ public:
 protected:
     //! Rendering
     virtual void render();
+    // Gizmo is redrawn when color changes
+    virtual DWORD get_content_hash() { return color; }
 };
 
 //! Text rendering sequence
@@ -240,6 +276,9 @@ public:
 protected:
     //! Rendering
     virtual void render();
+    // Text is redrawn when string or color changes
+    virtual DWORD get_content_hash()
+        { return hash_bytes(text.data(), text.size(), color); }
 };
 
 } // End of ::ingame namespace
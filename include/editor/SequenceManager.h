@@ -58,8 +58,12 @@ public:
         //! Update transformation matrix
         void update_transformation_matrix();
         
+        //! Check if transformed bounding box intersects visible area
+        /** Sequences with empty bounding box are always visible */
+        bool is_visible() const;
+        
         //! Transformation matrix for rendering
-        D3DXMATRIX transformation;
+        Affine2 transformation;
         
         //! Frame rate
         int fps;
@@ -97,6 +101,34 @@ public:
         // Obtaining texture
         inline virtual TextureRef get_texture() { return TextureRef(); }
         
+        //! Sprite drawn by sequence
+        struct Sprite
+        {
+            //! Sprite texture
+            Direct3DInstance::TextureManagerInstance::TextureInstance * texture;
+            //! Sprite width and height
+            int width, height;
+        };
+        //! Describe sprite drawn by sequence
+        /** Sequences which draw one textured quad with own transformation
+          * return true, so they can be batched with neighbours in queue.
+          * \param  sprite  receives sprite description */
+        inline virtual bool get_sprite( Sprite & sprite ) { return false; }
+        
+        //! Hash of drawn state other than transformation, frame and flags
+        /** Used to find sequences changed since previous frame. Sequences
+          * drawing something besides their texture frame (text, color,
+          * outline points) mix it into hash. */
+        inline virtual DWORD get_content_hash() { return 0; }
+        //! Mix bytes into FNV-1a hash
+        /** \param  data  bytes to hash
+          * \param  size  number of bytes
+          * \param  hash  hash of preceding data */
+        static inline DWORD hash_bytes( const void * data, size_t size, DWORD hash = 2166136261 )
+            { for (size_t i = 0; i < size; ++i)
+                  hash = (hash ^ ((const BYTE *)data)[i]) * 16777619;
+              return hash; }
+        
         // Friend classes
         friend class Direct3DInstance::SequenceManagerInstance;
         friend class SequenceID;
@@ -113,6 +145,11 @@ public:
         SequenceID( ID id );
         //! Type conversion
         inline operator ID() { return id; }
+        //! Get sequence identifier
+        inline ID get_id() const { return id; }
+        //! Identifiers comparison
+        inline bool operator ==( const SequenceID & other ) const { return id == other.id; }
+        inline bool operator !=( const SequenceID & other ) const { return id != other.id; }
         
         //! Update sequence and add to render queue
         /** \param  dt  time step for sequence updating */
@@ -220,11 +257,14 @@ class Direct3DInstance::SequenceManagerInstance:
 {
 public:
     //! Animation sequence manager initialization
-    inline SequenceManagerInstance() {}
+    /** Queue reordering is enabled by "reorder_render_queue" config value,
+      * view culling is disabled by "view_culling" config value */
+    SequenceManagerInstance();
     //! Cleanup
     inline ~SequenceManagerInstance() {};
 
 	//! Rendering sequences
+	/** Consecutive sprites with same texture are drawn by one call */
 	void draw_queue();
     
     //! Flushing rendering queue
@@ -233,4 +273,204 @@ public:
     //! Clear rendering queue without flushing
     inline void clear_queue()
         { RenderManager<SequenceBase, SequenceID>::flush(); }
+    
+    //! Render queue reordering statistics
+    struct ReorderStats
+    {
+        //! Number of sprites passed through reordering
+        DWORD sprites;
+        //! Number of texture changes in submission order
+        DWORD batches_before;
+        //! Number of texture changes after reordering
+        DWORD batches_after;
+        
+        //! Constructor
+        inline ReorderStats() : sprites(0), batches_before(0), batches_after(0) {}
+    };
+    
+    //! Reorder non-overlapping sprites to group same textures
+    bool reorder_queue;
+    //! Reordering statistics
+    ReorderStats reorder_stats;
+    
+    //! View culling statistics
+    struct CullStats
+    {
+        //! Number of sequences submitted for rendering
+        DWORD submitted;
+        //! Number of sequences added to render queue
+        DWORD drawn;
+        
+        //! Constructor
+        inline CullStats() : submitted(0), drawn(0) {}
+    };
+    
+    //! Skip sequences outside of visible area
+    bool cull_queue;
+    //! View culling statistics
+    CullStats cull_stats;
+    
+    //! Add line strip to debug geometry drawn at end of queue
+    /** Lines of all sequences are transformed to world space and drawn by one call.
+      * \param  points     line strip points
+      * \param  count      number of points
+      * \param  transform  world transformation of points
+      * \param  color      line color */
+    void add_debug_lines( const D3DXVECTOR3 * points, UINT count,
+                          const Affine2 & transform, D3DCOLOR color );
+    //! Add points to debug geometry drawn at end of queue
+    /** \param  points     point list
+      * \param  count      number of points
+      * \param  transform  world transformation of points
+      * \param  size       point size in pixels */
+    void add_debug_points( const ColoredVertex * points, UINT count,
+                           const Affine2 & transform, float size );
+
+    //! Rectangle in world coordinates
+    struct Bounds
+    {
+        float left, top, right, bottom;
+    };
+    
+    //! Compare render queue with queue of previously drawn frame
+    /** Queue is remembered as drawn one. Changed sequences with empty
+      * bounding box make whole frame changed.
+      * \param  dirty  receives area where frame differs from previous one
+      * \return false if queue draws same picture as previous frame */
+    bool update_drawn_queue( Bounds & dirty );
+    //! Forget previously drawn frame, so that next one is redrawn entirely
+    inline void invalidate_drawn_queue() { drawn_valid = false; }
+    
+    //! Find sequences of previously drawn frame containing point
+    /** Sequences are found through grid built from transformed bounding
+      * boxes of render queue, deleted sequences are skipped.
+      * \param  p       point in world coordinates
+      * \param  result  receives sequences, topmost first */
+    void pick( const D3DXVECTOR2 & p, std::vector<SequenceID> & result );
+    //! Find sequences of previously drawn frame with bounds intersecting rectangle
+    /** \param  rect    rectangle in world coordinates
+      * \param  result  receives sequences, topmost first */
+    void query( const Bounds & rect, std::vector<SequenceID> & result );
+
+protected:
+    //! Drawn sequence in picking index
+    struct PickEntry
+    {
+        //! Sequence identifier
+        SequenceID sequence;
+        //! Inverse transformation of sequence
+        Affine2 inverse;
+        //! Bounding box size
+        D3DXVECTOR2 bounding_box;
+        //! Transformed bounding box bounds
+        Bounds bounds;
+    };
+    
+    //! Build picking index from render queue
+    void build_pick_index();
+    //! Get range of picking grid cells covered by rectangle
+    void get_pick_cells( const Bounds & rect, int & x0, int & y0, int & x1, int & y1 ) const;
+    
+    //! Sequences of previously drawn frame in drawing order
+    std::vector<PickEntry> pick_entries;
+    //! Start of each grid cell in pick_cells (one extra element at end)
+    std::vector<UINT> pick_cell_start;
+    //! Indices of entries overlapping each grid cell, in drawing order
+    std::vector<UINT> pick_cells;
+    //! Query marks of entries (to report each entry once)
+    std::vector<UINT> pick_marks;
+    //! Current query mark
+    UINT pick_mark;
+    //! Grid cell size in world coordinates
+    D3DXVECTOR2 pick_cell_size;
+    //! Indices of entries found by query
+    std::vector<UINT> pick_found;
+
+    //! State of queued sequence which affects its picture
+    struct DrawnSequence
+    {
+        //! Sequence identifier
+        ID id;
+        //! Transformation matrix
+        Affine2 transformation;
+        //! Bounding box size
+        D3DXVECTOR2 bounding_box;
+        //! Frame number and animation flags
+        int frame, flags;
+        //! Hash of other drawn state
+        DWORD content;
+        //! Revision of bound texture (0 - no texture)
+        DWORD texture;
+    };
+    
+    //! Add transformed bounding box of sequence to rectangle
+    /** \param  d      sequence state
+      * \param  dirty  rectangle to extend */
+    static void add_drawn_bounds( const DrawnSequence & d, Bounds & dirty );
+    
+    //! States of queued sequences in previously drawn frame
+    std::vector<DrawnSequence> drawn_queue;
+    //! States of queued sequences in current frame
+    std::vector<DrawnSequence> current_queue;
+    //! Previously drawn frame is known
+    bool drawn_valid;
+    
+    //! Queued sprite description for reordering
+    struct QueuedSprite
+    {
+        //! Sprite texture
+        Direct3DInstance::TextureManagerInstance::TextureInstance * texture;
+        //! Transformed sprite bounds
+        float left, top, right, bottom;
+    };
+    
+    //! Reorder render queue keeping overlapping sprites in submission order
+    void sort_queue();
+    //! Reorder sequence of sprites not separated by other sequences
+    /** \param  begin, end  range of queue indices */
+    void sort_sprites( int begin, int end );
+    
+
+    //! Add sprite to current batch
+    /** \param  s       sequence drawing sprite
+      * \param  sprite  sprite description */
+    void add_to_batch( SequenceBase & s, const SequenceBase::Sprite & sprite );
+    //! Draw sprites of current batch
+    void flush_batch();
+    //! Draw and forget accumulated debug geometry
+    void flush_debug_geometry();
+    
+    //! Transformed vertices of current batch (triangle list)
+    std::vector<TexturedVertex> batch_vertices;
+    //! Texture of current batch
+    Direct3DInstance::TextureManagerInstance::TextureInstance * batch_texture;
+    
+    //! Debug lines in world space (line list)
+    std::vector<ColoredVertex> debug_lines;
+    //! Debug points in world space
+    std::vector<ColoredVertex> debug_points;
+    //! Size of accumulated debug points
+    float debug_point_size;
+    
+    //! Sprites being reordered
+    std::vector<QueuedSprite> sort_sprites_info;
+    //! Number of overlapping sprites not emitted yet for each sprite (-1 - emitted)
+    std::vector<int> sort_blockers;
+    //! Sprites sorted by left edge (left edge, sprite) for overlap sweep
+    std::vector<std::pair<float, int> > sort_order;
+    //! Sprites crossed by sweep line
+    std::vector<int> sort_active;
+    //! Overlapping sprite pairs (earlier, later) sorted by earlier sprite
+    std::vector<std::pair<int, int> > sort_overlaps;
+    //! Distinct textures of sprites (sorted by address)
+    std::vector<Direct3DInstance::TextureManagerInstance::TextureInstance *> sort_textures;
+    //! Position of sprite texture in sort_textures for each sprite
+    std::vector<int> sort_texture_index;
+    //! Sprites which may be emitted next (min-heap by queue position,
+    //! may contain emitted sprites)
+    std::vector<int> sort_ready;
+    //! Sprites which may be emitted next for each texture (min-heaps)
+    std::vector<std::vector<int> > sort_texture_ready;
+    //! Reordered queue part
+    std::vector<SequenceID> sort_result;
 };
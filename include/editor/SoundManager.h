@@ -2,6 +2,7 @@
 #include "Tanita2.h"
 #include "Sound.h"
 #include "FileManager.h"
+#include "Affine2.h"
 
 // Streaming sound buffer length
 #define STREAM_BUFFER_LEN_IN_SECONDS 5
@@ -32,7 +33,7 @@ public:
         //! Sound position in space
         D3DXVECTOR2 position;
         //! Transformation matrix for rendering
-        D3DXMATRIX transformation;
+        Affine2 transformation;
         
         //! Sound buffer size
         DWORD buffer_size;
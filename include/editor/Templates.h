@@ -2,6 +2,11 @@
 #define _EDITOR_TEMPLATES_H_
 
 #include "Types.h"
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <new>
+#include <typeinfo>
+#include <vector>
 
 //! %Singleton pattern with manual creation option.
 /** %Singleton template with availability of creating
@@ -139,26 +144,78 @@ template<class T, class IDObject> class RenderManager
 {
 public:
     //! Constructor
-    inline RenderManager() : next_id(0), queue_end(0) { queue.resize(1000); }
+    inline RenderManager() : queue_end(0) { queue.resize(1000); }
+    //! Destructor
+    inline ~RenderManager() { clear_objects(); }
 
     //! Add object to rendering manager
-    /** TDerived is a class derived from T.
+    /** TDerived is a class derived from T. Object is copied to
+      * storage shared by all objects of TDerived class.
       * @param[in]  obj   reference to previously created object
       *                   to be managed
       * @return  IDObject  proxy for added object to be used as identifier.
       */
     template<class TDerived>
-        inline IDObject add( TDerived & obj )
-            { objects[next_id] = boost::shared_ptr<T>(new TDerived(obj));
-              return IDObject(next_id++); }
+        IDObject add( TDerived & obj )
+        {
+            Pool<TDerived> & p = pool<TDerived>();
+            T * object = p.create(obj);
+            
+            // Taking free slot
+            UINT index;
+            if (free_slots.empty())
+            {
+                Slot slot = {NULL, NULL, 1, 0};
+                index = (UINT)slots.size();
+                _ASSERT(index <= index_mask);
+                slots.push_back(slot);
+            }
+            else
+            {
+                index = free_slots.back();
+                free_slots.pop_back();
+            }
+            Slot & slot = slots[index];
+            slot.object = object;
+            slot.pool = &p;
+            slot.dense_index = (UINT)objects.size();
+            objects.push_back(object);
+            object_slots.push_back(index);
+            return IDObject(slot.generation << index_bits | index);
+        }
 
     //! Get T instance pointer by its id
     /** \param  id  managed object identifier */
-    inline T * const get( ID id ) { return (*this)[id].get(); }
+    inline T * const get( ID id )
+        { Slot * slot = find(id);
+          _ASSERT(NULL != slot);
+          return slot->object;
+        }
 
     //! Delete T instance
-    /** \param  id  managed object identifier to delete */
-    inline void del( ID id ) { objects.erase(id); }
+    /** Slot of deleted object is reused with next generation number.
+      * Slot is retired when its generation is exhausted, so identifiers
+      * of deleted objects are never given out again.
+      * \param  id  managed object identifier to delete */
+    void del( ID id )
+    {
+        Slot * slot = find(id);
+        if (NULL == slot) return;
+        
+        // Moving last object to place of deleted one
+        UINT last_index = object_slots.back();
+        objects[slot->dense_index] = objects.back();
+        object_slots[slot->dense_index] = last_index;
+        slots[last_index].dense_index = slot->dense_index;
+        objects.pop_back();
+        object_slots.pop_back();
+        
+        slot->pool->destroy(slot->object);
+        slot->object = NULL;
+        slot->generation = (slot->generation + 1) & generation_mask;
+        if (0 != slot->generation)
+            free_slots.push_back(id & index_mask);
+    }
 
     //! Flush (render) all objects
     /** Manager will flush collected batch information about
@@ -175,28 +232,129 @@ public:
     /** \param  id  managed object identifier proxy */
     void add_to_render_queue( const IDObject & id ) 
     { 
+        if (queue_end == (int)queue.size())
+            queue.resize(queue.size() * 2);
         queue[queue_end++] = id; 
     }
     
 protected:
-    // List of managed objects
-    std::map<ID, boost::shared_ptr<T> > objects;
-    typedef typename std::map<ID, typename boost::shared_ptr<T> >::iterator ObjectIter;
-    // Next id number to use
-    int next_id;
+    //! Storage for objects of one class
+    class PoolBase
+    {
+    public:
+        //! Destructor
+        virtual ~PoolBase() {}
+        //! Destroy object and return its memory to pool
+        virtual void destroy( T * object ) = 0;
+    };
     
-    // Get element by id
-    inline boost::shared_ptr<T> operator []( ID id )
-        { ObjectIter i = objects.find(id);
-          _ASSERT(objects.end() != i);
-          return i->second;
+    //! Storage for objects of TDerived class
+    /** Memory is allocated by chunks and reused after objects deletion. */
+    template<class TDerived> class Pool: public PoolBase
+    {
+    public:
+        //! Destructor
+        ~Pool()
+            { for (size_t i = 0; i < chunks.size(); ++i)
+                  ::operator delete(chunks[i]); }
+        
+        //! Create copy of object
+        T * create( const TDerived & obj )
+        {
+            if (free_list.empty())
+            {
+                // Allocating new chunk
+                char * chunk = (char *)::operator new(chunk_size * sizeof(TDerived));
+                chunks.push_back(chunk);
+                for (int i = chunk_size - 1; i >= 0; --i)
+                    free_list.push_back(chunk + i * sizeof(TDerived));
+            }
+            void * memory = free_list.back();
+            TDerived * object = new (memory) TDerived(obj);
+            free_list.pop_back();
+            return object;
+        }
+        //! Destroy object and return its memory to pool
+        virtual void destroy( T * object )
+        {
+            TDerived * derived = static_cast<TDerived *>(object);
+            derived->~TDerived();
+            free_list.push_back(derived);
         }
+        
+    protected:
+        //! Number of objects in chunk
+        static const int chunk_size = 64;
+        //! Allocated chunks
+        std::vector<char *> chunks;
+        //! Free object places
+        std::vector<void *> free_list;
+    };
+    
+    //! Get storage for objects of TDerived class
+    template<class TDerived> Pool<TDerived> & pool()
+    {
+        boost::shared_ptr<PoolBase> & p = pools[&typeid(TDerived)];
+        if (!p)
+            p.reset(new Pool<TDerived>());
+        return static_cast<Pool<TDerived> &>(*p);
+    }
+    
+    //! Object slot
+    struct Slot
+    {
+        //! Object (NULL if slot is free)
+        T * object;
+        //! Storage of object
+        PoolBase * pool;
+        //! Generation of slot (incremented on deletion, 0 - slot is retired)
+        ID generation;
+        //! Position of object in objects vector
+        UINT dense_index;
+    };
+    
+    //! Identifier bits used for slot index (others are for generation)
+    static const int index_bits = 20;
+    static const ID index_mask = (1 << index_bits) - 1;
+    static const ID generation_mask = (1 << (32 - index_bits)) - 1;
+    
+    //! Find slot of living object
+    /** \return slot or NULL if object was deleted */
+    inline Slot * find( ID id )
+        { UINT index = id & index_mask;
+          if (index >= slots.size()) return NULL;
+          Slot & slot = slots[index];
+          if (NULL == slot.object || slot.generation != (id >> index_bits)) return NULL;
+          return &slot;
+        }
+    
+    //! Delete all objects
+    void clear_objects()
+    {
+        while (!objects.empty())
+        {
+            UINT index = object_slots.back();
+            del(slots[index].generation << index_bits | index);
+        }
+    }
+    
+    // Slots addressed by identifiers
+    std::vector<Slot> slots;
+    // Free slot indices
+    std::vector<UINT> free_slots;
+    // Managed objects (dense, in no particular order)
+    std::vector<T *> objects;
+    typedef typename std::vector<T *>::iterator ObjectIter;
+    // Slot index for each managed object
+    std::vector<UINT> object_slots;
+    // Object storages by class
+    std::map<const std::type_info *, boost::shared_ptr<PoolBase> > pools;
     
     // Rendering queue
     std::vector<typename IDObject> queue;
     typedef typename std::vector<IDObject>::iterator QueueIter;
     // Queue size
-    /* Queue is std::vector with preallocated size. vector::clear()
+    /* Queue is std::vector which grows when needed. vector::clear()
      * resizes vector and slows performance. Instead queue_end used as
      * queue boundary. */
     int queue_end;
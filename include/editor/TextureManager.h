@@ -44,14 +44,23 @@ public:
         bool compressed;
         
         //! Get lowlevel texture handle
-        LPDIRECT3DTEXTURE9 get_texture() { return texture; }
+        RenderDevice::Texture * get_texture() { return texture; }
+
+        //! Number of resolution levels stored in texture file (1 - full size only)
+        int lod_count;
+        //! Currently loaded resolution level (0 - full size, 1 - half, 2 - quarter)
+        int lod;
+        //! Number of times texture was created in video memory
+        /** Changes on every resolution level swap or reload after eviction */
+        DWORD revision;
 
     protected:
         //! Construct from path to resource
         /** \param  path  path to texture */
         TextureInstance( PATH & path, bool compressed );
         //! Constructor
-        inline TextureInstance() : texture(NULL), compressed(false) {}
+        inline TextureInstance() : texture(NULL), compressed(false), lod_count(1), lod(0),
+                                    revision(0) {}
     
         //! Texture memory manager info
         struct GCInfo
@@ -62,9 +71,16 @@ public:
             DWORD age;
             //! Dynamic texture flag
             bool is_dynamic;
+            //! Resolution level requested by last bind (-1 - no request)
+            int wanted_lod;
+            //! Prefetch epoch of last lookahead request (0 - never requested)
+            DWORD prefetch_stamp;
+            //! Distance from play head in frames for last lookahead request
+            int prefetch_distance;
 
             //! Constructor
-            inline GCInfo() : size(0), age(0), is_dynamic(false) {}
+            inline GCInfo() : size(0), age(0), is_dynamic(false), wanted_lod(-1),
+                              prefetch_stamp(0), prefetch_distance(0) {}
         } gc_info;
         //! File with texture data
         FileRef file;
@@ -77,9 +93,14 @@ public:
         virtual bool load();
         //! Unload texture from video memory
         void unload();
+        //! Reload texture with another resolution level
+        /** \param  new_lod  resolution level to load */
+        void reload( int new_lod );
+        //! Size of currently loaded texture in kilobytes
+        inline DWORD loaded_size() const { return gc_info.size >> (2 * lod); }
         
-        //! Direct3D texture pointer
-        LPDIRECT3DTEXTURE9 texture;
+        //! Render device texture
+        RenderDevice::Texture * texture;
         
         // Friend class
         friend class TextureManagerInstance;
@@ -106,18 +127,12 @@ public:
     //! Texture for operating with surface
     class SurfaceTextureInstance: public TextureInstance
     {
-    public:
-        //! Destructor
-        virtual ~SurfaceTextureInstance() { unload(); }
-    
     protected:
         // Constructor
         SurfaceTextureInstance( int width, int height, D3DFORMAT format, 
                                 bool render_target = false );
         // Create texture
         virtual bool load();
-        // Release texture memory
-        void unload();
         
         // Width and height
         int width, height;
@@ -125,9 +140,6 @@ public:
         D3DFORMAT format;
         // Is a render target surface
         bool render_target;
-        
-        // Texture surface
-        LPDIRECT3DSURFACE9 surface;
 
         // Friend class
         friend class TextureManagerInstance;
@@ -152,13 +164,26 @@ public:
     };
     typedef boost::shared_ptr<TextureInstance> TextureRef;
     
+    //! Maximal number of resolution levels produced by texture cooker
+    /** Level 0 is the original image, every next level is downscaled
+      * by 2 on each side. */
+    static const int LOD_COUNT = 3;
+    //! Select resolution level for given zoom factor
+    static int select_lod( float zoom );
+
     //! Compression method used for compression textures
     static int DXT_METHOD;
     //! Height divider (for compression method)
     static int DXT_METHOD_height_shift;
 
+    //! Lookahead time for animation frames prefetching (in milliseconds)
+    static int prefetch_time;
+
     //! Texture manager initialization
-    void init( LPDIRECT3DDEVICE9 device );
+    void init( RenderDevice * device );
+    //! Constructor
+    inline TextureManagerInstance()
+        : pending_lods(0), prefetch_epoch(1), prefetch_requested(false) {}
     //! Texture memory cleanup
     inline ~TextureManagerInstance() {};
     
@@ -184,6 +209,14 @@ public:
     //! Releasing all texture memory for device restoring
     void unload_textures();
     
+    //! Request texture to be resident before it is bound
+    /** Textures are uploaded during update within per-frame upload budget,
+      * nearest to play head first. Textures in current lookahead window
+      * are evicted after all other unused textures.
+      * \param  texture   texture of upcoming animation frame
+      * \param  distance  number of frames left before texture is shown */
+    void prefetch( TextureRef & texture, int distance );
+    
 protected:
     //! Collect unused textures to free memory
     /** Called when texture creation fails with E_OUTOFMEMORY or
@@ -198,6 +231,31 @@ protected:
     std::vector<TextureRef> textures;
     typedef std::vector<TextureRef>::iterator TextureIter;
     
+    //! Apply pending resolution level changes
+    /** Reloads textures which were bound with resolution level other 
+      * than loaded one.
+      * \param  budget  number of uploads allowed for current frame */
+    void update_lods( int & budget );
+    //! Upload textures requested by animation lookahead
+    /** \param  budget  number of uploads allowed for current frame */
+    void update_prefetch( int & budget );
+    //! Check if texture is in lookahead window of some playing animation
+    inline bool is_prefetched( const TextureInstance::GCInfo & info ) const
+        { return 0 != info.prefetch_stamp && info.prefetch_stamp + 1 >= prefetch_epoch; }
+    //! Comparison for ordering textures by distance from play head
+    static bool nearer_to_play_head( const TextureRef & a, const TextureRef & b );
+    //! Number of textures waiting for resolution level change
+    int pending_lods;
+    //! Maximal number of texture reloads per frame
+    static int uploads_per_frame;
+    
+    //! Textures requested by lookahead and not loaded yet
+    std::vector<TextureRef> prefetch_queue;
+    //! Current prefetch epoch (advanced on update after lookahead requests)
+    DWORD prefetch_epoch;
+    //! Lookahead requests were made since last update
+    bool prefetch_requested;
+    
     //! Available texture memory
     static unsigned int available_mem;
     //! Utilized texture memory
@@ -3,6 +3,9 @@
 
 #include "Tanita2.h"
 #include "Graphics.h"
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <vector>
 
 //! Vertex buffer manager
 class Direct3DInstance::VertexManagerInstance
@@ -35,42 +38,36 @@ public:
         friend class VertexManagerInstance;
     };
 
-    //! Reference to vertex buffer
+    //! Reference to sprite quad in vertex buffer
+    /** Quads of same size are shared between references. */
     class VertexBufferInstance
     {
     public:
-        //! Destructor
-        inline ~VertexBufferInstance() { vertex_buffer->Release(); }
-        
         //! Render contents of vertex buffer
         void render();
+        
+        //! Get sprite width
+        inline int get_width() const { return width; }
+        //! Get sprite height
+        inline int get_height() const { return height; }
 
     protected:
-        //! Construct from vertex buffer data
-        /** \param  data  vertex buffer description data */
-        VertexBufferInstance( VertexBufferData & data );
-        //! Construct from already existing vertex buffer with new start_index
-        /** Vertex buffer may be shared between multiple reference. In this case
-          * each reference holds pointer to vertex buffer and unique offset
-          * to vertex data.
-          * \param  v            existing vertex buffer
-          * \param  start_index  offset to vertex data hold by this reference */
-        inline VertexBufferInstance( const VertexBufferInstance & v, int start_index )
-            : start_index(start_index), free_space(v.free_space),
-              vertex_buffer(v.vertex_buffer) { vertex_buffer->AddRef(); }
+        //! Construct reference to quad
+        /** \param  vertex_buffer  vertex buffer containing quad
+          * \param  start_index    index of first quad vertex
+          * \param  data           description of sprite */
+        inline VertexBufferInstance( const boost::shared_ptr<RenderDevice::VertexBuffer> & vertex_buffer,
+                                     UINT start_index, const VertexBufferData & data )
+            : start_index(start_index), width(data.width), height(data.height),
+              vertex_buffer(vertex_buffer) {}
     
         //! Start index in DrawPrimitive call
         UINT start_index; 
-        //! Number of vertexes we could allocate in this buffer
-        int free_space;
-        //! Size of vertex buffer (in vertexes)
-        static const int buffer_size = 2000;
-        
-        //! Pointer to Direct3D vertex buffer
-        LPDIRECT3DVERTEXBUFFER9 vertex_buffer;
+        //! Sprite width and height
+        int width, height;
         
-        //! Force stream source update
-        static bool force_update;
+        //! Render device vertex buffer (shared between references)
+        boost::shared_ptr<RenderDevice::VertexBuffer> vertex_buffer;
         
         // Friend
         friend class VertexManagerInstance;
@@ -79,26 +76,73 @@ public:
     typedef boost::shared_ptr<VertexBufferInstance> VertexBufferRef;
 
     //! Vertex manager initialization
-    VertexManagerInstance() {}
+    VertexManagerInstance();
     //! Vertex buffer cleanup
     ~VertexManagerInstance() {}
     
     //! Updating vertex buffers
-    inline void update( DWORD dt ) {}
+    /** Periodically returns space of unused quads to free list */
+    void update( DWORD dt );
 
     //! Allocate vertex buffer
     /** @param  data  information for vertex buffer allocation
     * @return reference to vertex buffer */
     VertexBufferRef create( VertexBufferData & data );
+    
+    //! Write vertices to dynamic vertex buffer
+    /** Vertices are appended to ring buffer without overwriting data
+      * which may be in use by device, buffer is discarded when full.
+      * \param  vertices  vertices to write
+      * \param  count     number of vertices (not more than dynamic_buffer_size)
+      * \return index of first written vertex in dynamic buffer */
+    UINT write_dynamic( const TexturedVertex * vertices, UINT count );
+    //! Get dynamic vertex buffer (valid after write_dynamic call)
+    inline RenderDevice::VertexBuffer * get_dynamic_buffer() { return dynamic_buffer.get(); }
+    //! Release device resources (before device reset)
+    inline void release_dynamic_buffer() { dynamic_buffer.reset(); }
+    
+    //! Size of dynamic vertex buffer (in vertices)
+    static const UINT dynamic_buffer_size = 6 * 1024;
 
 protected:
-    //! List of vertex buffers
-    std::vector<VertexBufferRef> vertex_buffers;
-    typedef std::vector<VertexBufferRef>::iterator BufferIter;
+    //! Location of quad in vertex buffers
+    struct QuadSlot
+    {
+        //! Index of vertex buffer
+        int buffer;
+        //! Index of first quad vertex
+        UINT start_index;
+    };
+    //! Cached quad
+    struct CachedQuad
+    {
+        //! Quad location
+        QuadSlot slot;
+        //! Reference returned to sequences
+        boost::weak_ptr<VertexBufferInstance> ref;
+    };
+    
+    //! Size of static vertex buffer (in vertexes)
+    static const int buffer_size = 2000;
+    //! Period of unused quads collection (in milliseconds)
+    static const DWORD collect_period = 1000;
+    
+    //! Static vertex buffers
+    std::vector<boost::shared_ptr<RenderDevice::VertexBuffer> > vertex_buffers;
+    //! Number of used vertices in last static buffer
+    int used_space;
+    //! Quads available for reuse
+    std::vector<QuadSlot> free_slots;
+    //! Quads by sprite size
+    std::map<std::pair<int, int>, CachedQuad> quads;
+    typedef std::map<std::pair<int, int>, CachedQuad>::iterator QuadIter;
+    //! Time since last collection
+    DWORD collect_time;
     
-    //! Create DirectX vertex buffer instance
-    /** \param  data  vertex buffer description data */
-    LPDIRECT3DVERTEXBUFFER9 create_vertex_buffer( VertexBufferData & data );
+    //! Dynamic vertex buffer
+    boost::shared_ptr<RenderDevice::VertexBuffer> dynamic_buffer;
+    //! Offset of free space in dynamic buffer
+    UINT dynamic_offset;
 };
 
 //! Vertex buffer description type definition
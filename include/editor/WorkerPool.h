@@ -0,0 +1,93 @@
+#pragma once
+#include "Tanita2.h"
+#include "Templates.h"
+#include <list>
+#include <string>
+#include <vector>
+
+//! Pool of worker threads for background jobs
+/** Jobs are executed in order of submission by any free worker thread.
+  * Job code must not access engine singletons: singleton reference
+  * counting is not thread-safe. */
+class WorkerPoolInstance
+{
+public:
+    //! Base class for background job
+    class Job
+    {
+    public:
+        //! Constructor
+        Job();
+        //! Destructor
+        /** \note Job should be finished (see WorkerPoolInstance::wait)
+          * before derived class members are destroyed. */
+        virtual ~Job();
+
+        //! Job body (called from worker thread)
+        virtual void run() = 0;
+
+        //! Check if job is finished (or was never submitted)
+        bool is_done() const;
+        //! Get error of finished job
+        /** \return exception message (empty if job succeeded) */
+        inline const std::string & get_error() const { return error; }
+
+    protected:
+        //! Signaled when job is not queued and not running
+        HANDLE done_event;
+        //! Job is waiting in queue (not taken by worker yet)
+        bool queued;
+        //! Exception message of last run (empty if job succeeded)
+        std::string error;
+
+        // Friend class
+        friend class WorkerPoolInstance;
+    };
+
+    //! Starts worker threads
+    /** Thread count is taken from "worker_threads" config value,
+      * by default one thread less than number of processors is used. */
+    WorkerPoolInstance();
+    //! Stops worker threads
+    ~WorkerPoolInstance();
+
+    //! Add job to queue
+    /** Job is executed immediately if pool has no threads.
+      * \param  job  job to execute, should be finished */
+    void submit( Job & job );
+    //! Remove job from queue if it was not taken by worker yet
+    /** \param  job  previously submitted job
+      * \return true if job was removed, false if it is running or finished */
+    bool cancel( Job & job );
+    //! Wait for job completion
+    /** Job which was not taken by worker yet is executed on calling thread.
+      * Exception thrown by job is reported once as Exception.
+      * \param  job  previously submitted job */
+    void wait( Job & job );
+
+    //! Get number of worker threads
+    inline int get_thread_count() const { return (int)threads.size(); }
+
+protected:
+    //! Worker thread function
+    static DWORD WINAPI thread_proc( LPVOID param );
+    //! Execute job and mark it as finished
+    static void execute( Job & job );
+    //! Remove job from queue without marking it as finished
+    bool unqueue( Job & job );
+
+    //! Worker thread handles
+    std::vector<HANDLE> threads;
+    //! Queued jobs
+    std::list<Job *> jobs;
+    typedef std::list<Job *>::iterator JobIter;
+    //! Queue lock
+    CRITICAL_SECTION lock;
+    //! Number of queued jobs semaphore
+    HANDLE jobs_semaphore;
+    //! Threads should be stopped flag
+    volatile LONG quit;
+};
+
+//! WorkerPool singleton definition
+typedef Singleton<WorkerPoolInstance> WorkerPool;
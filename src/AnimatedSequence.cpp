@@ -2,6 +2,8 @@
 #include "Sequence.h"
 #include "Graphics.h"
 #include "GameObject.h"
+#include "WorkerPool.h"
+#include "Log.h"
 
 using namespace ingame;
 
@@ -67,9 +69,35 @@ bool AnimatedSequenceBase::on_adding_to_queue( float dt )
             time_left += 1.0f / fps;
         }
     }
+    prefetch_frames();
     return SequenceBase::on_adding_to_queue(dt);
 }
 
+// Publishing lookahead window
+void AnimatedSequenceBase::prefetch_frames()
+{
+    if (!is_playing || frame_count < 2 || fps <= 0) return;
+    
+    int count = Direct3DInstance::TextureManagerInstance::prefetch_time * fps / 1000 + 1;
+    if (count > frame_count - 1)
+        count = frame_count - 1;
+    
+    int df = (flags & reversed) ? -1 : 1;
+    int frame = current_frame_number;
+    for (int distance = 1; distance <= count; ++distance)
+    {
+        frame += df;
+        if (frame < 0 || frame >= frame_count)
+        {
+            // Non-looped animation stops on last frame
+            if (!(flags & looped))
+                break;
+            frame = (frame + frame_count) % frame_count;
+        }
+        prefetch_frame(frame, distance);
+    }
+}
+
 // Creating sequence for given path and texture count
 AnimatedSequence::AnimatedSequence( PATH & path, std::vector<int> & frame_indices, bool compressed )
     : AnimatedSequenceBase(frame_indices)
@@ -97,19 +125,91 @@ AnimatedSequence::AnimatedSequence( PATH & path, std::vector<int> & frame_indice
     }
 }
 
+// Request texture of given frame to be resident
+void AnimatedSequence::prefetch_frame( int frame, int distance )
+{
+    TextureManager tm;
+    tm->prefetch(frames[frame].texture, distance);
+}
+
 // Sequence rendering
 void AnimatedSequence::render()
 {
     Direct3D d3d;
-    d3d->device->SetTransform(D3DTS_WORLD, &transformation);
+    d3d->render_device->set_world_transform(transformation.to_matrix());
     FrameInfo & f = frames[current_frame_number];
     TRY(f.texture->bind());
     TRY(f.buffer->render());
 }
 
+// Decode frame image to staging memory (frames are stored as plain DDS data)
+static void decode_frame( const FileRef & file, BYTE * dest, int size )
+{
+    memcpy(dest, file->get_contents() + 128, size);
+}
+
+// Background decoding of large animation frames
+class LargeAnimatedSequence::FrameDecoder
+{
+public:
+    // Staging buffer with decoding job
+    class Slot: public WorkerPoolInstance::Job
+    {
+    public:
+        // Constructor
+        inline Slot() : frame(-1) {}
+        
+        // Decoding (called from worker thread)
+        virtual void run() { decode_frame(file, &buffer[0], (int)buffer.size()); }
+        
+        // Index of frame in buffer (-1 if empty)
+        int frame;
+        // Source frame data
+        FileRef file;
+        // Decoded frame data
+        std::vector<BYTE> buffer;
+    };
+    
+    // Constructor
+    inline FrameDecoder( int frame_size )
+        { slots[0].buffer.resize(frame_size);
+          slots[1].buffer.resize(frame_size); }
+    // Destructor
+    inline ~FrameDecoder()
+        { WorkerPool pool;
+          for (int i = 0; i < 2; ++i)
+          {
+              pool->cancel(slots[i]);
+              // Decoded frame is not needed anymore, error is only logged
+              try { pool->wait(slots[i]); }
+              catch (std::exception & e) { Log log; log->error(e.what()); }
+          } }
+    
+    // Find slot with given frame (NULL if not found)
+    inline Slot * find( int frame )
+        { return slots[0].frame == frame ? &slots[0] :
+                 slots[1].frame == frame ? &slots[1] : NULL; }
+    
+    // Get slot not holding given frame ready for new job
+    Slot * acquire( int keep_frame )
+    {
+        Slot & slot = (slots[0].frame == keep_frame) ? slots[1] : slots[0];
+        WorkerPool pool;
+        pool->cancel(slot);
+        slot.frame = -1;
+        pool->wait(slot);
+        return &slot;
+    }
+    
+protected:
+    // Slots for current and next frames
+    Slot slots[2];
+};
+
 // Creating sequence for given path and texture count
 LargeAnimatedSequence::LargeAnimatedSequence( PATH & path, std::vector<int> & frame_indices, bool compressed )
-    : AnimatedSequenceBase(frame_indices), lowlevel_texture(NULL), loaded_frame(-1)
+    : AnimatedSequenceBase(frame_indices), lowlevel_texture(NULL), loaded_frame(-1),
+      frame_size(0)
 {
     FileManager fm;
     for (int j = 0; j < (int)frame_indices.size(); ++j)
@@ -135,6 +235,12 @@ LargeAnimatedSequence::LargeAnimatedSequence( PATH & path, std::vector<int> & fr
     VertexManager vm;
     VertexBufferData data(width, height);
     TRY(buffer = vm->create(data));
+    
+    // Four bytes per pixel or per column of DXT block row
+    int rows = texture->compressed ?
+                   height >> Direct3DInstance::TextureManagerInstance::DXT_METHOD_height_shift :
+                   height;
+    frame_size = 4 * width * rows;
 }
 
 //! Updating
@@ -150,35 +256,57 @@ bool LargeAnimatedSequence::on_adding_to_queue( float dt )
     return result;
 }
 
+// Decode next frame to staging memory in background
+void LargeAnimatedSequence::prefetch_frame( int frame, int distance )
+{
+    // Staging memory holds only current and next frames
+    if (1 != distance) return;
+    
+    if (!decoder)
+        decoder.reset(new FrameDecoder(frame_size));
+    if (decoder->find(frame))
+        return;
+    
+    FrameDecoder::Slot * slot = decoder->acquire(current_frame_number);
+    slot->frame = frame;
+    slot->file = frames[frame];
+    WorkerPool pool;
+    pool->submit(*slot);
+}
+
 // Filling texture with current frame
 void LargeAnimatedSequence::fill_texture()
 {
-    D3DLOCKED_RECT lr;
+    // Taking decoded frame from staging memory if it was predicted,
+    // otherwise copying frame data directly
+    BYTE * ptr = (BYTE *)frames[current_frame_number]->get_contents() + 128;
+    FrameDecoder::Slot * slot = decoder ? decoder->find(current_frame_number) : NULL;
+    if (slot)
+    {
+        // Failed slot is emptied, so its buffer is never uploaded
+        WorkerPool pool;
+        try { pool->wait(*slot); }
+        catch (...) { slot->frame = -1; throw; }
+        ptr = &slot->buffer[0];
+    }
+
     lowlevel_texture->load();
-        
-    LPDIRECT3DTEXTURE9 tex = lowlevel_texture->texture;
-    
-    Direct3D d3d;
-    static DWORD lock_flag =
-        (d3d->device_caps.Caps2 & D3DCAPS2_DYNAMICTEXTURES) ? D3DLOCK_DISCARD : 0;
-    
-    ASSERT_DIRECTX(tex->LockRect(0, &lr, NULL, lock_flag));
-    FileRef & f = frames[current_frame_number];
-    BYTE * ptr = (BYTE *)f->get_contents() + 128;
+    RenderDevice::Texture * tex = lowlevel_texture->texture;
     
-    int h = texture->compressed ?
-                height >> Direct3DInstance::TextureManagerInstance::DXT_METHOD_height_shift :
-                height;
+    int locked_pitch;
+    BYTE * bits = tex->lock(locked_pitch, true);
+    int pitch = 4 * width;
+    int h = frame_size / pitch;
     for (int y = 0; y < h; ++y)
-        memcpy((BYTE *)lr.pBits + y * lr.Pitch, ptr + y * lr.Pitch, lr.Pitch);
-    ASSERT_DIRECTX(tex->UnlockRect(0));
+        memcpy(bits + y * locked_pitch, ptr + y * pitch, min(pitch, locked_pitch));
+    tex->unlock();
 }
 
 // Sequence rendering
 void LargeAnimatedSequence::render()
 {
     Direct3D d3d;
-    d3d->device->SetTransform(D3DTS_WORLD, &transformation);
+    d3d->render_device->set_world_transform(transformation.to_matrix());
 
     if (lowlevel_texture->load()) // load() returns true if texture was really loaded during call
         fill_texture();
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "Application.h"
 #include "Log.h"
+#include "Profiler.h"
 #include "resource/resource.h"
 #pragma warning(disable: 4311)
 
@@ -20,8 +21,8 @@ int ApplicationInstance::mouse_button_state;
 bool ApplicationInstance::window_may_use_app;
 // Game is to be quit flag
 bool ApplicationInstance::quit_game = false;
-// Previous time value
-DWORD ApplicationInstance::previous_ticks = GetTickCount();
+// Frame timer
+FrameClock ApplicationInstance::frame_clock;
 
 // Window function
 LRESULT CALLBACK WindowProc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam );
@@ -38,6 +39,23 @@ ApplicationInstance::ApplicationInstance()
     python.create();
     // Configuration database initialization
     config.create();
+    // Worker threads initialization
+    worker_pool.create();
+    
+    // Profiler can be enabled from start to catch loading
+    {
+        Config config;
+        bool profile = false;
+        try { profile = config->get<bool>("profiler"); }
+        catch (...) {}
+        Profiler::enable(profile);
+        
+        // Fixed update step
+        int rate = 0;
+        try { rate = config->get<int>("fixed_update_rate"); }
+        catch (...) {}
+        frame_clock.set_fixed_step(rate > 0 ? 1.0 / rate : 0);
+    }
     // File manager initialization
     file_manager.create();
     
@@ -113,12 +131,13 @@ void ApplicationInstance::run()
 {
     // Notifying window that application was initialized
     window_may_use_app = true;
+    // Loading time is not counted as first frame
+    frame_clock.reset();
 
     while (process_messages() && !quit_game)
     {
         // Updating timers and calculating dt
-        DWORD ticks = GetTickCount();
-        DWORD dt = ticks - previous_ticks;
+        DWORD dt = DWORD(frame_clock.get_elapsed() * 1000);
         
         // Checking if Direct3D devices were lost
         if (check_lost_devices())
@@ -130,23 +149,40 @@ void ApplicationInstance::run()
         
         // Updating input system
         if (active)
+        {
+            PROFILE_ZONE("input");
             input->update(dt);
+        }
         // Updating other systems
-        direct3d->update(dt);
-        file_manager->update(dt);
+        {
+            PROFILE_ZONE("direct3d_update");
+            direct3d->update(dt);
+        }
+        {
+            PROFILE_ZONE("file_manager_update");
+            file_manager->update(dt);
+        }
 
         // Updating window by timer in editor mode
 #define TIMER_PERIOD 100
         static DWORD last_update_time;
         if (!(active || application_time - last_update_time > TIMER_PERIOD))
+        {
+            // Sleeping until next update or window message
+            MsgWaitForMultipleObjects(0, NULL, FALSE,
+                                      TIMER_PERIOD - (application_time - last_update_time),
+                                      QS_ALLINPUT);
             continue;
-        else last_update_time = application_time,
-        // Saving time
-        previous_ticks = ticks;
+        }
+        else last_update_time = application_time;
 
         // Update and drawing on each frame
-        on_frame(dt);
+        {
+            PROFILE_ZONE("frame");
+            on_frame(float(frame_clock.tick()));
+        }
         
+        PROFILE_ZONE("directsound_update");
         directsound->update(dt);
     }
     // Notifying window that application is to be destroyed
@@ -191,7 +227,7 @@ LRESULT CALLBACK WindowProc( HWND hWnd, UINT message,
         if (ApplicationInstance::window_may_use_app)// && !ApplicationInstance::disable_activation)
         {
            Application app;
-           app->on_repaint();
+           app->on_repaint(WM_PAINT == message);
         }
         return DefWindowProc(hWnd, message, wParam, lParam);
     case WM_ACTIVATE:
@@ -285,8 +321,16 @@ void ApplicationInstance::init()
     SetActiveWindow(window);
 }
 
+// Screen repainting handler
+void ApplicationInstance::on_repaint( bool invalidate )
+{
+    if (invalidate)
+        direct3d->invalidate();
+    on_frame(0, true);
+}
+
 // Update and redraw
-void ApplicationInstance::on_frame( DWORD dt, bool just_redraw )
+void ApplicationInstance::on_frame( float dt, bool just_redraw )
 {
 	if (ApplicationInstance::disable_activation)
 		return;
@@ -295,7 +339,8 @@ void ApplicationInstance::on_frame( DWORD dt, bool just_redraw )
     // Updating game state
 	try
 	{
-	    bp::call<void>(py_on_frame.ptr(), dt / 1000.0f, just_redraw, cursor_position, mouse_button_state);
+	    PROFILE_ZONE("python_on_frame");
+	    bp::call<void>(py_on_frame.ptr(), dt, just_redraw, cursor_position, mouse_button_state);
 		direct3d->zoom = bp::extract<float>(py["Lib"].attr("Globals").attr("zoom"));
 	}
 	catch(bp::error_already_set &)
@@ -306,8 +351,13 @@ void ApplicationInstance::on_frame( DWORD dt, bool just_redraw )
 	}
 
     // Rendering
-    direct3d->clear(D3DCOLOR_XRGB(255, 255, 0));
-    direct3d->present();
+    {
+        PROFILE_ZONE("clear");
+        direct3d->clear(D3DCOLOR_XRGB(255, 255, 0));
+    }
+    PROFILE_ZONE("present");
+    // Inactive editor window draws only changes
+    direct3d->present(just_redraw || !active);
 }
 
 // Resource releasing and deinitialization.
@@ -0,0 +1,336 @@
+#include "stdafx.h"
+#include "Affine2.h"
+#include "Benchmark.h"
+#include "FrameClock.h"
+#include "Helpers.h"
+#include "Log.h"
+#include "SequenceManager.h"
+#include "SoundManager.h"
+#include <sstream>
+
+// Number of objects in container benchmarks
+static const int BENCH_OBJECTS = 10000;
+// Number of passes over objects for lookup benchmarks
+static const int BENCH_PASSES = 10;
+
+// Identifier proxy without object lookup
+class BenchID
+{
+public:
+    // Constructor
+    inline BenchID( ID id = 0 ) : id(id) {}
+    // Type conversion
+    inline operator ID() { return id; }
+
+protected:
+    // Identifier
+    ID id;
+};
+
+// Sequence which draws nothing
+class BenchSequence: public SequenceBase
+{
+public:
+    // Touch sequence state
+    inline int touch() { return ++current_frame_number; }
+
+protected:
+    // Sequence rendering
+    virtual void render() {}
+};
+
+// Sound without buffer
+class BenchSound: public SoundBase
+{
+public:
+    // Touch sound state
+    inline int touch() { return ++volume; }
+};
+
+// Rendering manager with access to all objects
+template<class T> class BenchManager: public RenderManager<T, BenchID>
+{
+public:
+    // Touch every managed object
+    size_t iterate()
+    {
+        size_t sum = 0;
+        for (typename RenderManager<T, BenchID>::ObjectIter i = this->objects.begin();
+             this->objects.end() != i; ++i)
+            sum += (*i)->touch();
+        return sum;
+    }
+};
+
+// Add, get, iterate and delete objects of rendering manager
+template<class T> static void bench_render_manager( Benchmark & bench, const std::string & name )
+{
+    FrameClock clock;
+    BenchManager<T> manager;
+    std::vector<ID> ids(BENCH_OBJECTS);
+    T object;
+
+    double start = clock.now();
+    for (int i = 0; i < BENCH_OBJECTS; ++i)
+        ids[i] = manager.add(object);
+    bench.add(name + ".add", BENCH_OBJECTS, clock.now() - start);
+
+    start = clock.now();
+    size_t sum = 0;
+    for (int pass = 0; pass < BENCH_PASSES; ++pass)
+        for (int i = 0; i < BENCH_OBJECTS; ++i)
+            sum += manager.get(ids[i])->touch();
+    bench.add(name + ".get", BENCH_OBJECTS * BENCH_PASSES, clock.now() - start);
+
+    start = clock.now();
+    for (int pass = 0; pass < BENCH_PASSES; ++pass)
+        sum += manager.iterate();
+    bench.add(name + ".iterate", BENCH_OBJECTS * BENCH_PASSES, clock.now() - start);
+    bench.keep(sum);
+
+    // Deleting in scattered order (7919 is coprime with object count)
+    start = clock.now();
+    for (int i = 0; i < BENCH_OBJECTS; ++i)
+        manager.del(ids[i * 7919 % BENCH_OBJECTS]);
+    bench.add(name + ".del", BENCH_OBJECTS, clock.now() - start);
+}
+
+// Sequence and sound managers
+static void bench_managers( Benchmark & bench )
+{
+    bench_render_manager<BenchSequence>(bench, "sequences");
+    bench_render_manager<BenchSound>(bench, "sounds");
+}
+
+// Number of nodes in transformation hierarchy benchmark
+static const int BENCH_NODES = 10000;
+// Number of hierarchy updates
+static const int BENCH_UPDATES = 100;
+
+// Object transformation in hierarchy
+struct BenchNode
+{
+    // Parent node index (-1 for root)
+    int parent;
+    // Position, rotation (in radians) and scale
+    float x, y, angle, sx, sy;
+};
+
+// Compose transformations of hierarchy with Affine2 (as GameObject does)
+static void update_affine2( const std::vector<BenchNode> & nodes, std::vector<Affine2> & world,
+                            std::vector<Affine2> & inverse )
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const BenchNode & n = nodes[i];
+        Affine2 local = Affine2::scaling(n.sx, n.sy) * Affine2::rotation(n.angle) *
+                        Affine2::translation(n.x, n.y);
+        world[i] = n.parent < 0 ? local : local * world[n.parent];
+        inverse[i] = world[i].inverse();
+    }
+}
+
+// Compose transformations of hierarchy with D3DX matrices (as GameObject used to)
+static void update_d3dx( const std::vector<BenchNode> & nodes, std::vector<D3DXMATRIX> & world,
+                         std::vector<D3DXMATRIX> & inverse )
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const BenchNode & n = nodes[i];
+        D3DXMATRIX rotation_matrix, scaling_matrix, translation_matrix,
+                   intermediate_matrix, local;
+        D3DXMatrixRotationZ(&rotation_matrix, n.angle);
+        D3DXMatrixScaling(&scaling_matrix, n.sx, n.sy, 1.0f);
+        D3DXMatrixTranslation(&translation_matrix, n.x, n.y, 0.0f);
+        D3DXMatrixMultiply(&intermediate_matrix, &rotation_matrix, &translation_matrix);
+        D3DXMatrixMultiply(&local, &scaling_matrix, &intermediate_matrix);
+        if (n.parent < 0)
+            world[i] = local;
+        else
+            D3DXMatrixMultiply(&world[i], &local, &world[n.parent]);
+        D3DXMatrixInverse(&inverse[i], NULL, &world[i]);
+    }
+}
+
+// Transformation hierarchy with Affine2 and with D3DX matrices
+static void bench_transforms( Benchmark & bench )
+{
+    // Tree with 4 children per node, parents stored before children
+    std::vector<BenchNode> nodes(BENCH_NODES);
+    for (int i = 0; i < BENCH_NODES; ++i)
+    {
+        BenchNode & n = nodes[i];
+        n.parent = (i - 1) / 4;
+        n.x = float(i % 97) - 48.0f;
+        n.y = float(i % 89) - 44.0f;
+        n.angle = float(i % 360) * 3.1415926f / 180.0f;
+        n.sx = 0.9f + float(i % 5) * 0.05f;
+        n.sy = 0.9f + float(i % 7) * 0.03f;
+    }
+    nodes[0].parent = -1;
+
+    FrameClock clock;
+    std::vector<Affine2> affine_world(BENCH_NODES), affine_inverse(BENCH_NODES);
+    double start = clock.now();
+    for (int pass = 0; pass < BENCH_UPDATES; ++pass)
+        update_affine2(nodes, affine_world, affine_inverse);
+    bench.add("transforms.affine2", BENCH_NODES * BENCH_UPDATES, clock.now() - start);
+
+    std::vector<D3DXMATRIX> d3dx_world(BENCH_NODES), d3dx_inverse(BENCH_NODES);
+    start = clock.now();
+    for (int pass = 0; pass < BENCH_UPDATES; ++pass)
+        update_d3dx(nodes, d3dx_world, d3dx_inverse);
+    bench.add("transforms.d3dx", BENCH_NODES * BENCH_UPDATES, clock.now() - start);
+
+    // Both paths should give the same transformation of node origin
+    float error = 0;
+    for (int i = 0; i < BENCH_NODES; ++i)
+    {
+        D3DXVECTOR2 a = affine_world[i].transform(1.0f, 1.0f), b, p(1.0f, 1.0f);
+        D3DXVec2TransformCoord(&b, &p, &d3dx_world[i]);
+        error = max(error, max(fabsf(a.x - b.x), fabsf(a.y - b.y)));
+        bench.keep(size_t(int(a.x + affine_inverse[i].tx + d3dx_inverse[i]._41)));
+    }
+    bench.note(boost::str(boost::format("transforms.max_error=%g") % error));
+}
+
+// Number of keys in dictionary benchmark
+static const int BENCH_KEYS = 1000;
+
+// Accumulated timings of dictionary operations
+struct DictTimings
+{
+    // Total time of operations in seconds
+    double setitem, getitem, has_key, erase;
+    
+    // Constructor
+    inline DictTimings() : setitem(0), getitem(0), has_key(0), erase(0) {}
+    
+    // Add timings to report
+    void report( Benchmark & bench, const std::string & name )
+    {
+        bench.add(name + ".setitem", BENCH_KEYS * BENCH_PASSES, setitem);
+        bench.add(name + ".getitem", BENCH_KEYS * BENCH_PASSES, getitem);
+        bench.add(name + ".has_key", 2 * BENCH_KEYS * BENCH_PASSES, has_key);
+        bench.add(name + ".erase", BENCH_KEYS * BENCH_PASSES, erase);
+    }
+};
+
+// tanita2_dict and python dictionary operations
+static void bench_dict( Benchmark & bench )
+{
+    // Objects are created without script engine
+    if (!Py_IsInitialized())
+        Py_Initialize();
+    
+    std::vector<bp::str> keys, missing;
+    for (int i = 0; i < BENCH_KEYS; ++i)
+    {
+        keys.push_back(bp::str(boost::str(boost::format("object_%d") % i)));
+        missing.push_back(bp::str(boost::str(boost::format("missing_%d") % i)));
+    }
+    bp::object value(1);
+    
+    FrameClock clock;
+    DictTimings engine, python;
+    size_t sum = 0;
+    for (int pass = 0; pass < BENCH_PASSES; ++pass)
+    {
+        tanita2_dict dict;
+        double start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            dict.setitem(keys[i], value);
+        engine.setitem += clock.now() - start;
+        
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            sum += (size_t)dict.getitem(keys[i]).ptr();
+        engine.getitem += clock.now() - start;
+        
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            sum += dict.has_key(keys[i]) + dict.has_key(missing[i]);
+        engine.has_key += clock.now() - start;
+        
+        // Erasing in scattered order (7919 is coprime with key count)
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            dict.delitem(keys[i * 7919 % BENCH_KEYS]);
+        engine.erase += clock.now() - start;
+        
+        // Same operations on python dictionary
+        bp::dict pydict;
+        PyObject * d = pydict.ptr(), * v = value.ptr();
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            PyDict_SetItem(d, keys[i].ptr(), v);
+        python.setitem += clock.now() - start;
+        
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            sum += (size_t)PyDict_GetItem(d, keys[i].ptr());
+        python.getitem += clock.now() - start;
+        
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            sum += (NULL != PyDict_GetItem(d, keys[i].ptr())) +
+                   (NULL != PyDict_GetItem(d, missing[i].ptr()));
+        python.has_key += clock.now() - start;
+        
+        start = clock.now();
+        for (int i = 0; i < BENCH_KEYS; ++i)
+            PyDict_DelItem(d, keys[i * 7919 % BENCH_KEYS].ptr());
+        python.erase += clock.now() - start;
+    }
+    bench.keep(sum);
+    engine.report(bench, "dict.tanita2");
+    python.report(bench, "dict.python");
+}
+
+// Registered benchmarks
+const Benchmark::Entry Benchmark::entries[] =
+{
+    {"managers", bench_managers},
+    {"transforms", bench_transforms},
+    {"dict", bench_dict},
+};
+
+// Record timing of benchmarked operation
+void Benchmark::add( const std::string & name, int count, double seconds )
+{
+    lines.push_back(boost::str(boost::format("%s count=%d total_ms=%.3f ns_per_op=%.1f")
+        % name % count % (seconds * 1000.0) % (seconds * 1e9 / count)));
+}
+
+// Run benchmarks and report timings to log
+void Benchmark::run( const std::string & args )
+{
+    std::istringstream parser(args);
+    std::string option, selected = "all", report;
+    parser >> option >> selected >> report;
+
+    Benchmark bench;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); ++i)
+        if ("all" == selected || selected == entries[i].name)
+        {
+            entries[i].function(bench);
+            found = true;
+        }
+    if (!found)
+        throw Exception("Unknown benchmark " + selected);
+    bench.lines.push_back(boost::str(boost::format("checksum=%u") % bench.checksum));
+
+    Log log;
+    for (size_t i = 0; i < bench.lines.size(); ++i)
+        log->print("Benchmark " + bench.lines[i]);
+    if (!report.empty())
+    {
+        FILE * f = fopen(report.c_str(), "wt");
+        if (NULL == f)
+            throw Exception("Unable to create report file " + report);
+        for (size_t i = 0; i < bench.lines.size(); ++i)
+            fprintf(f, "%s\n", bench.lines[i].c_str());
+        fclose(f);
+    }
+}
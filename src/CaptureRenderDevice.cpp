@@ -0,0 +1,693 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+#include "Affine2.h"
+#include <map>
+#include <memory>
+
+// Get number of rows in locked texture data
+static int locked_rows( const RenderDevice::Texture & texture )
+{
+    // Block-compressed formats have one row of blocks per 4 pixel rows
+    if (D3DFMT_DXT1 == texture.format || D3DFMT_DXT2 == texture.format ||
+        D3DFMT_DXT3 == texture.format || D3DFMT_DXT4 == texture.format ||
+        D3DFMT_DXT5 == texture.format)
+        return (texture.height + 3) / 4;
+    return texture.height;
+}
+
+// Texture which records its updates
+class CaptureTexture: public RenderDevice::Texture
+{
+public:
+    // Constructor
+    inline CaptureTexture( CaptureRenderDevice * capture, RenderDevice::Texture * texture, DWORD id )
+        : RenderDevice::Texture(texture->width, texture->height, texture->format),
+          capture(capture), texture(texture), id(id), data(NULL), pitch(0) {}
+    // Destructor
+    virtual ~CaptureTexture()
+    {
+        capture->put_opcode(CaptureRenderDevice::OP_DESTROY_TEXTURE);
+        capture->put(id);
+        delete texture;
+    }
+
+    // Lock texture
+    virtual BYTE * lock( int & pitch, bool discard )
+    {
+        data = texture->lock(pitch, discard);
+        this->pitch = pitch;
+        return data;
+    }
+    // Unlock texture and record its contents
+    virtual void unlock()
+    {
+        DWORD size = DWORD(pitch * locked_rows(*this));
+        capture->put_opcode(CaptureRenderDevice::OP_TEXTURE_DATA);
+        capture->put(id);
+        capture->put(pitch);
+        capture->put(size);
+        capture->put_data(data, size);
+        texture->unlock();
+    }
+
+    // Capturing device
+    CaptureRenderDevice * capture;
+    // Forwarded device texture
+    RenderDevice::Texture * texture;
+    // Resource identifier
+    DWORD id;
+    // Locked data
+    BYTE * data;
+    int pitch;
+};
+
+// Vertex buffer which records its updates
+class CaptureVertexBuffer: public RenderDevice::VertexBuffer
+{
+public:
+    // Constructor
+    inline CaptureVertexBuffer( CaptureRenderDevice * capture, RenderDevice::VertexBuffer * buffer,
+                                DWORD id )
+        : RenderDevice::VertexBuffer(buffer->size), capture(capture), buffer(buffer), id(id) {}
+    // Destructor
+    virtual ~CaptureVertexBuffer()
+    {
+        capture->put_opcode(CaptureRenderDevice::OP_DESTROY_BUFFER);
+        capture->put(id);
+        delete buffer;
+    }
+
+    // Lock vertices (caller writes to staging copy, device buffer may be write-only)
+    virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode )
+    {
+        data = buffer->lock(start, count, mode);
+        lock_start = start;
+        lock_mode = mode;
+        staging.resize(count);
+        return &staging[0];
+    }
+    // Unlock vertex buffer and record written vertices
+    virtual void unlock()
+    {
+        UINT count = (UINT)staging.size();
+        memcpy(data, &staging[0], count * sizeof(TexturedVertex));
+        capture->put_opcode(CaptureRenderDevice::OP_BUFFER_DATA);
+        capture->put(id);
+        capture->put(lock_start);
+        capture->put(count);
+        capture->put(DWORD(lock_mode));
+        capture->put_data(&staging[0], count * sizeof(TexturedVertex));
+        buffer->unlock();
+    }
+
+    // Capturing device
+    CaptureRenderDevice * capture;
+    // Forwarded device buffer
+    RenderDevice::VertexBuffer * buffer;
+    // Resource identifier
+    DWORD id;
+    // Locked range
+    TexturedVertex * data;
+    UINT lock_start;
+    LockMode lock_mode;
+    // Vertices written by caller
+    std::vector<TexturedVertex> staging;
+};
+
+// Render target with resource identifier
+class CaptureRenderTarget: public RenderDevice::RenderTarget
+{
+public:
+    // Constructor
+    inline CaptureRenderTarget( CaptureRenderDevice * capture, RenderDevice::RenderTarget * target,
+                                DWORD id )
+        : RenderDevice::RenderTarget(target->width, target->height),
+          capture(capture), target(target), id(id) {}
+    // Destructor
+    virtual ~CaptureRenderTarget()
+    {
+        capture->put_opcode(CaptureRenderDevice::OP_DESTROY_TARGET);
+        capture->put(id);
+        delete target;
+    }
+
+    // Save contents to PNG file
+    virtual void save( const std::string & filename ) { target->save(filename); }
+
+    // Capturing device
+    CaptureRenderDevice * capture;
+    // Forwarded device render target
+    RenderDevice::RenderTarget * target;
+    // Resource identifier
+    DWORD id;
+};
+
+// Constructor
+CaptureRenderDevice::CaptureRenderDevice( RenderDevice * device, const std::string & filename,
+                                          int width, int height )
+    : device(device), last_id(0)
+{
+    file = fopen(filename.c_str(), "wb");
+    if (NULL == file)
+        throw Exception("Unable to create render capture file " + filename);
+    put(signature);
+    put(version);
+    put(width);
+    put(height);
+}
+
+// Destructor
+CaptureRenderDevice::~CaptureRenderDevice()
+{
+    fclose(file);
+    file = NULL;
+    delete device;
+}
+
+// Write record header
+void CaptureRenderDevice::put_opcode( Opcode op )
+{
+    put(BYTE(op));
+}
+
+// Write raw data to capture
+void CaptureRenderDevice::put_data( const void * data, size_t size )
+{
+    if (file && size)
+        fwrite(data, size, 1, file);
+}
+
+// Setup render state
+void CaptureRenderDevice::setup_state()
+{
+    put_opcode(OP_SETUP_STATE);
+    device->setup_state();
+}
+
+// Get device state
+HRESULT CaptureRenderDevice::test_cooperative_level()
+{
+    return device->test_cooperative_level();
+}
+
+// Reset lost device
+void CaptureRenderDevice::reset()
+{
+    device->reset();
+}
+
+// Get amount of texture memory
+UINT CaptureRenderDevice::get_available_texture_mem()
+{
+    return device->get_available_texture_mem();
+}
+
+// Begin rendering
+void CaptureRenderDevice::begin_scene()
+{
+    put_opcode(OP_BEGIN_SCENE);
+    device->begin_scene();
+}
+
+// End rendering
+void CaptureRenderDevice::end_scene()
+{
+    put_opcode(OP_END_SCENE);
+    device->end_scene();
+}
+
+// Clear current render target
+void CaptureRenderDevice::clear( D3DCOLOR color )
+{
+    put_opcode(OP_CLEAR);
+    put(color);
+    device->clear(color);
+}
+
+// Present back buffer
+bool CaptureRenderDevice::present()
+{
+    put_opcode(OP_PRESENT);
+    bool result = device->present();
+
+    // Accumulating statistics of forwarded device (ours may be reset by scripts)
+    const Stats & s = device->stats;
+    stats.frames += s.frames - device_stats.frames;
+    stats.draw_calls += s.draw_calls - device_stats.draw_calls;
+    stats.primitives += s.primitives - device_stats.primitives;
+    stats.texture_changes += s.texture_changes - device_stats.texture_changes;
+    stats.texture_uploads += s.texture_uploads - device_stats.texture_uploads;
+    device_stats = s;
+    return result;
+}
+
+// Create texture from DDS file in memory
+HRESULT CaptureRenderDevice::create_texture( const char * dds, int size, int width, int height,
+                                             D3DFORMAT format, int skip_levels, Texture ** texture )
+{
+    Texture * t;
+    HRESULT hr = device->create_texture(dds, size, width, height, format, skip_levels, &t);
+    if (FAILED(hr))
+        return hr;
+
+    *texture = new CaptureTexture(this, t, ++last_id);
+    put_opcode(OP_CREATE_TEXTURE_DDS);
+    put(last_id);
+    put(width);
+    put(height);
+    put(DWORD(format));
+    put(skip_levels);
+    put(size);
+    put_data(dds, size);
+    return hr;
+}
+
+// Create empty texture
+HRESULT CaptureRenderDevice::create_texture( int width, int height, D3DFORMAT format,
+                                             TextureUsage usage, Texture ** texture )
+{
+    Texture * t;
+    HRESULT hr = device->create_texture(width, height, format, usage, &t);
+    if (FAILED(hr))
+        return hr;
+
+    *texture = new CaptureTexture(this, t, ++last_id);
+    put_opcode(OP_CREATE_TEXTURE);
+    put(last_id);
+    put(width);
+    put(height);
+    put(DWORD(format));
+    put(DWORD(usage));
+    return hr;
+}
+
+// Bind texture
+void CaptureRenderDevice::set_texture( Texture * texture, int sampler_index )
+{
+    CaptureTexture * t = static_cast<CaptureTexture *>(texture);
+    put_opcode(OP_SET_TEXTURE);
+    put(t ? t->id : DWORD(0));
+    put(sampler_index);
+    device->set_texture(t ? t->texture : NULL, sampler_index);
+}
+
+// Create vertex buffer
+RenderDevice::VertexBuffer * CaptureRenderDevice::create_vertex_buffer( UINT size, bool dynamic )
+{
+    VertexBuffer * buffer = new CaptureVertexBuffer(this, device->create_vertex_buffer(size, dynamic),
+                                                    ++last_id);
+    put_opcode(OP_CREATE_BUFFER);
+    put(last_id);
+    put(size);
+    put(BYTE(dynamic));
+    return buffer;
+}
+
+// Draw triangle strip from vertex buffer
+void CaptureRenderDevice::draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    CaptureVertexBuffer * b = static_cast<CaptureVertexBuffer *>(buffer);
+    put_opcode(OP_DRAW_STRIP);
+    put(b->id);
+    put(start_vertex);
+    put(primitive_count);
+    device->draw_strip(b->buffer, start_vertex, primitive_count);
+}
+
+// Draw triangle list from vertex buffer
+void CaptureRenderDevice::draw_triangles( VertexBuffer * buffer, UINT start_vertex,
+                                          UINT primitive_count )
+{
+    CaptureVertexBuffer * b = static_cast<CaptureVertexBuffer *>(buffer);
+    put_opcode(OP_DRAW_TRIANGLES);
+    put(b->id);
+    put(start_vertex);
+    put(primitive_count);
+    device->draw_triangles(b->buffer, start_vertex, primitive_count);
+}
+
+// Draw untextured triangle strip
+void CaptureRenderDevice::draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count )
+{
+    put_opcode(OP_DRAW_COLORED_STRIP);
+    put(primitive_count);
+    put_data(vertices, (primitive_count + 2) * sizeof(ColoredVertex));
+    device->draw_colored_strip(vertices, primitive_count);
+}
+
+// Draw untextured points
+void CaptureRenderDevice::draw_points( const ColoredVertex * vertices, UINT count, float size )
+{
+    put_opcode(OP_DRAW_POINTS);
+    put(count);
+    put(size);
+    put_data(vertices, count * sizeof(ColoredVertex));
+    device->draw_points(vertices, count, size);
+}
+
+// Draw line strip
+void CaptureRenderDevice::draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color )
+{
+    put_opcode(OP_DRAW_LINES);
+    put(count);
+    put(color);
+    put_data(points, count * sizeof(D3DXVECTOR3));
+    device->draw_lines(points, count, color);
+}
+
+// Draw line list
+void CaptureRenderDevice::draw_line_list( const ColoredVertex * vertices, UINT line_count )
+{
+    put_opcode(OP_DRAW_LINE_LIST);
+    put(line_count);
+    put_data(vertices, line_count * 2 * sizeof(ColoredVertex));
+    device->draw_line_list(vertices, line_count);
+}
+
+// Draw text
+void CaptureRenderDevice::draw_text( const std::string & text, int x, int y, D3DCOLOR color )
+{
+    put_opcode(OP_DRAW_TEXT);
+    put(x);
+    put(y);
+    put(color);
+    put(DWORD(text.size()));
+    put_data(text.data(), text.size());
+    device->draw_text(text, x, y, color);
+}
+
+// Set world transformation (only 2D affine part is stored)
+void CaptureRenderDevice::set_world_transform( const D3DXMATRIX & world )
+{
+    put_opcode(OP_WORLD_TRANSFORM);
+    put(Affine2(world._11, world._12, world._21, world._22, world._41, world._42));
+    device->set_world_transform(world);
+}
+
+// Set view and projection matrices
+void CaptureRenderDevice::set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection )
+{
+    put_opcode(OP_VIEW_PROJECTION);
+    put(view);
+    put(projection);
+    device->set_view_projection(view, projection);
+}
+
+// Create off-screen render target
+RenderDevice::RenderTarget * CaptureRenderDevice::create_render_target( int width, int height )
+{
+    RenderTarget * target = new CaptureRenderTarget(this, device->create_render_target(width, height),
+                                                    ++last_id);
+    put_opcode(OP_CREATE_TARGET);
+    put(last_id);
+    put(width);
+    put(height);
+    return target;
+}
+
+// Set render target
+void CaptureRenderDevice::set_render_target( RenderTarget * target )
+{
+    CaptureRenderTarget * t = static_cast<CaptureRenderTarget *>(target);
+    put_opcode(OP_SET_TARGET);
+    put(t ? t->id : DWORD(0));
+    device->set_render_target(t ? t->target : NULL);
+}
+
+// Copy back buffer to system memory (not recorded)
+void CaptureRenderDevice::read_back_buffer( int width, int height, std::vector<DWORD> & pixels )
+{
+    device->read_back_buffer(width, height, pixels);
+}
+
+// Reader of capture loaded to memory
+class CaptureReader
+{
+public:
+    // Constructor
+    inline CaptureReader( const std::vector<BYTE> & data )
+        : p(data.empty() ? NULL : &data[0]), end(p + data.size()) {}
+
+    // Check if whole capture was read
+    inline bool eof() const { return p == end; }
+    // Read raw data
+    inline const BYTE * get_data( size_t size )
+    {
+        if (size_t(end - p) < size)
+            throw Exception("Render capture is truncated");
+        const BYTE * data = p;
+        p += size;
+        return data;
+    }
+    // Read value
+    template<class T> inline T get()
+        { T value; memcpy(&value, get_data(sizeof(T)), sizeof(T)); return value; }
+
+protected:
+    // Current position and end of data
+    const BYTE * p, * end;
+};
+
+// Find replayed resource by identifier
+template<class T> static T * find_resource( std::map<DWORD, T *> & resources, DWORD id )
+{
+    if (0 == id)
+        return NULL;
+    typename std::map<DWORD, T *>::iterator i = resources.find(id);
+    if (resources.end() == i)
+        throw Exception("Render capture references unknown resource");
+    return i->second;
+}
+
+// Destroy replayed resource
+template<class T> static void destroy_resource( std::map<DWORD, T *> & resources, DWORD id )
+{
+    delete find_resource(resources, id);
+    resources.erase(id);
+}
+
+// Replay capture file
+void CaptureRenderDevice::replay( const std::string & filename, const std::string & backend,
+                                  std::vector<double> & frame_times )
+{
+    // Loading whole capture so file reading is not measured
+    std::vector<BYTE> data;
+    FILE * f = fopen(filename.c_str(), "rb");
+    if (NULL == f)
+        throw Exception("Unable to open render capture file " + filename);
+    fseek(f, 0, SEEK_END);
+    data.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    if (!data.empty() && 1 != fread(&data[0], data.size(), 1, f))
+        data.clear();
+    fclose(f);
+
+    CaptureReader r(data);
+    DWORD file_signature = r.get<DWORD>(), file_version = r.get<DWORD>();
+    if (signature != file_signature || file_version < 1 || version < file_version)
+        throw Exception("Unsupported render capture format in " + filename);
+    int width = r.get<int>(), height = r.get<int>();
+
+    // Creating device without window and with unlimited texture memory
+    std::auto_ptr<RenderDevice> device_holder;
+    if ("software" == backend)
+        device_holder.reset(new SoftwareRenderDevice(width, height, NULL, 1024 * 1024));
+    else if ("null" == backend)
+        device_holder.reset(new NullRenderDevice(1024 * 1024));
+    else
+        throw Exception("Unknown replay render device " + backend);
+    RenderDevice * device = device_holder.get();
+
+    std::map<DWORD, Texture *> textures;
+    std::map<DWORD, VertexBuffer *> buffers;
+    std::map<DWORD, RenderTarget *> targets;
+
+    LARGE_INTEGER frequency, t;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&t);
+    LONGLONG frame_start = t.QuadPart;
+
+    while (!r.eof())
+    {
+        BYTE op = r.get<BYTE>();
+        switch (op)
+        {
+        case OP_SETUP_STATE:
+            device->setup_state();
+            break;
+        case OP_BEGIN_SCENE:
+            device->begin_scene();
+            break;
+        case OP_END_SCENE:
+            device->end_scene();
+            break;
+        case OP_CLEAR:
+            device->clear(r.get<D3DCOLOR>());
+            break;
+        case OP_PRESENT:
+            device->present();
+            QueryPerformanceCounter(&t);
+            frame_times.push_back(double(t.QuadPart - frame_start) * 1000.0 /
+                                  double(frequency.QuadPart));
+            frame_start = t.QuadPart;
+            break;
+
+        case OP_CREATE_TEXTURE_DDS:
+        {
+            DWORD id = r.get<DWORD>();
+            int width = r.get<int>(), height = r.get<int>();
+            D3DFORMAT format = D3DFORMAT(r.get<DWORD>());
+            int skip_levels = r.get<int>(), size = r.get<int>();
+            const char * dds = (const char *)r.get_data(size);
+            Texture * texture;
+            ASSERT_DIRECTX(device->create_texture(dds, size, width, height, format,
+                                                  skip_levels, &texture));
+            textures[id] = texture;
+            break;
+        }
+        case OP_CREATE_TEXTURE:
+        {
+            DWORD id = r.get<DWORD>();
+            int width = r.get<int>(), height = r.get<int>();
+            D3DFORMAT format = D3DFORMAT(r.get<DWORD>());
+            TextureUsage usage = TextureUsage(r.get<DWORD>());
+            Texture * texture;
+            ASSERT_DIRECTX(device->create_texture(width, height, format, usage, &texture));
+            textures[id] = texture;
+            break;
+        }
+        case OP_TEXTURE_DATA:
+        {
+            Texture * texture = find_resource(textures, r.get<DWORD>());
+            int src_pitch = r.get<int>();
+            DWORD size = r.get<DWORD>();
+            const BYTE * src = r.get_data(size);
+
+            // Copying rows, device pitch may differ from captured one
+            int pitch;
+            BYTE * dest = texture->lock(pitch, false);
+            int rows = min(src_pitch ? int(size) / src_pitch : 0, locked_rows(*texture));
+            for (int y = 0; y < rows; ++y)
+                memcpy(dest + y * pitch, src + y * src_pitch, min(pitch, src_pitch));
+            texture->unlock();
+            break;
+        }
+        case OP_DESTROY_TEXTURE:
+            destroy_resource(textures, r.get<DWORD>());
+            break;
+        case OP_SET_TEXTURE:
+        {
+            Texture * texture = find_resource(textures, r.get<DWORD>());
+            device->set_texture(texture, r.get<int>());
+            break;
+        }
+
+        case OP_CREATE_BUFFER:
+        {
+            DWORD id = r.get<DWORD>();
+            UINT size = r.get<UINT>();
+            buffers[id] = device->create_vertex_buffer(size, 0 != r.get<BYTE>());
+            break;
+        }
+        case OP_BUFFER_DATA:
+        {
+            VertexBuffer * buffer = find_resource(buffers, r.get<DWORD>());
+            UINT start = r.get<UINT>(), count = r.get<UINT>();
+            VertexBuffer::LockMode mode = VertexBuffer::LockMode(r.get<DWORD>());
+            const BYTE * vertices = r.get_data(count * sizeof(TexturedVertex));
+            memcpy(buffer->lock(start, count, mode), vertices, count * sizeof(TexturedVertex));
+            buffer->unlock();
+            break;
+        }
+        case OP_DESTROY_BUFFER:
+            destroy_resource(buffers, r.get<DWORD>());
+            break;
+
+        case OP_DRAW_STRIP:
+        case OP_DRAW_TRIANGLES:
+        {
+            VertexBuffer * buffer = find_resource(buffers, r.get<DWORD>());
+            UINT start = r.get<UINT>(), count = r.get<UINT>();
+            if (OP_DRAW_STRIP == op)
+                device->draw_strip(buffer, start, count);
+            else
+                device->draw_triangles(buffer, start, count);
+            break;
+        }
+        case OP_DRAW_COLORED_STRIP:
+        {
+            UINT count = r.get<UINT>();
+            device->draw_colored_strip((const ColoredVertex *)
+                r.get_data((count + 2) * sizeof(ColoredVertex)), count);
+            break;
+        }
+        case OP_DRAW_POINTS:
+        {
+            UINT count = r.get<UINT>();
+            float size = r.get<float>();
+            device->draw_points((const ColoredVertex *)
+                r.get_data(count * sizeof(ColoredVertex)), count, size);
+            break;
+        }
+        case OP_DRAW_LINES:
+        {
+            UINT count = r.get<UINT>();
+            D3DCOLOR color = r.get<D3DCOLOR>();
+            device->draw_lines((const D3DXVECTOR3 *)
+                r.get_data(count * sizeof(D3DXVECTOR3)), count, color);
+            break;
+        }
+        case OP_DRAW_LINE_LIST:
+        {
+            UINT line_count = r.get<UINT>();
+            device->draw_line_list((const ColoredVertex *)
+                r.get_data(line_count * 2 * sizeof(ColoredVertex)), line_count);
+            break;
+        }
+        case OP_DRAW_TEXT:
+        {
+            int x = r.get<int>(), y = r.get<int>();
+            D3DCOLOR color = r.get<D3DCOLOR>();
+            DWORD length = r.get<DWORD>();
+            const char * text = (const char *)r.get_data(length);
+            device->draw_text(std::string(text, length), x, y, color);
+            break;
+        }
+
+        case OP_WORLD_TRANSFORM:
+            device->set_world_transform(r.get<Affine2>().to_matrix());
+            break;
+        case OP_VIEW_PROJECTION:
+        {
+            D3DXMATRIX view = r.get<D3DXMATRIX>(), projection = r.get<D3DXMATRIX>();
+            device->set_view_projection(view, projection);
+            break;
+        }
+
+        case OP_CREATE_TARGET:
+        {
+            DWORD id = r.get<DWORD>();
+            int width = r.get<int>(), height = r.get<int>();
+            targets[id] = device->create_render_target(width, height);
+            break;
+        }
+        case OP_SET_TARGET:
+            device->set_render_target(find_resource(targets, r.get<DWORD>()));
+            break;
+        case OP_DESTROY_TARGET:
+            destroy_resource(targets, r.get<DWORD>());
+            break;
+
+        default:
+            throw Exception("Unknown record in render capture " + filename);
+        }
+    }
+
+    // Releasing resources which were alive at end of capture
+    for (std::map<DWORD, Texture *>::iterator i = textures.begin(); textures.end() != i; ++i)
+        delete i->second;
+    for (std::map<DWORD, VertexBuffer *>::iterator i = buffers.begin(); buffers.end() != i; ++i)
+        delete i->second;
+    for (std::map<DWORD, RenderTarget *>::iterator i = targets.begin(); targets.end() != i; ++i)
+        delete i->second;
+}
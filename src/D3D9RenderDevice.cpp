@@ -0,0 +1,566 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+#include "Log.h"
+#include "GlyphAtlas.h"
+
+// Direct3D texture
+class D3D9Texture: public RenderDevice::Texture
+{
+public:
+    // Constructor
+    inline D3D9Texture( LPDIRECT3DTEXTURE9 texture, bool dynamic )
+        : RenderDevice::Texture(0, 0, D3DFMT_UNKNOWN), texture(texture), dynamic(dynamic)
+        { D3DSURFACE_DESC desc;
+          texture->GetLevelDesc(0, &desc);
+          width = desc.Width;
+          height = desc.Height;
+          format = desc.Format; }
+    // Destructor
+    virtual ~D3D9Texture() { texture->Release(); }
+
+    // Lock top texture level
+    virtual BYTE * lock( int & pitch, bool discard )
+    {
+        D3DLOCKED_RECT lr;
+        ASSERT_DIRECTX(texture->LockRect(0, &lr, NULL, (discard && dynamic) ? D3DLOCK_DISCARD : 0));
+        pitch = lr.Pitch;
+        return (BYTE *)lr.pBits;
+    }
+    // Unlock texture
+    virtual void unlock() { ASSERT_DIRECTX(texture->UnlockRect(0)); }
+
+    // Direct3D texture
+    LPDIRECT3DTEXTURE9 texture;
+    // Texture was created with dynamic usage
+    bool dynamic;
+};
+
+// Direct3D vertex buffer
+class D3D9VertexBuffer: public RenderDevice::VertexBuffer
+{
+public:
+    // Constructor
+    inline D3D9VertexBuffer( LPDIRECT3DVERTEXBUFFER9 buffer, UINT size, bool dynamic )
+        : RenderDevice::VertexBuffer(size), buffer(buffer), dynamic(dynamic) {}
+    // Destructor
+    virtual ~D3D9VertexBuffer() { buffer->Release(); }
+
+    // Lock vertices
+    virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode )
+    {
+        DWORD flags = 0;
+        if (dynamic && LOCK_DISCARD == mode)
+            flags = D3DLOCK_DISCARD;
+        else if (dynamic && LOCK_NOOVERWRITE == mode)
+            flags = D3DLOCK_NOOVERWRITE;
+        void * ptr;
+        ASSERT_DIRECTX(buffer->Lock(start * sizeof(TexturedVertex),
+                                    count * sizeof(TexturedVertex), &ptr, flags));
+        return (TexturedVertex *)ptr;
+    }
+    // Unlock vertex buffer
+    virtual void unlock() { ASSERT_DIRECTX(buffer->Unlock()); }
+
+    // Direct3D vertex buffer
+    LPDIRECT3DVERTEXBUFFER9 buffer;
+    // Buffer was created with dynamic usage
+    bool dynamic;
+};
+
+// Direct3D render target
+class D3D9RenderTarget: public RenderDevice::RenderTarget
+{
+public:
+    // Constructor
+    inline D3D9RenderTarget( LPDIRECT3DSURFACE9 surface, int width, int height )
+        : RenderDevice::RenderTarget(width, height), surface(surface) {}
+    // Destructor
+    virtual ~D3D9RenderTarget() { surface->Release(); }
+
+    // Save contents to PNG file
+    virtual void save( const std::string & filename )
+    {
+        ASSERT_DIRECTX(D3DXSaveSurfaceToFile(filename.c_str(), D3DXIFF_PNG, surface, NULL, NULL));
+    }
+
+    // Render target surface
+    LPDIRECT3DSURFACE9 surface;
+};
+
+// Constructor
+D3D9RenderDevice::D3D9RenderDevice( LPDIRECT3DDEVICE9 device, D3DPRESENT_PARAMETERS & present_params )
+    : device(device), present_params(present_params), line_drawer(NULL), glyph_texture(NULL),
+      back_buffer(NULL), readback_target(NULL), readback_staging(NULL),
+      readback_width(0), readback_height(0), clipped(false)
+{
+    ASSERT_DIRECTX(device->GetDeviceCaps(&caps));
+
+    // Creating line renderer
+    ASSERT_DIRECTX(D3DXCreateLine(device, &line_drawer));
+
+    D3DXMatrixIdentity(&world);
+    D3DXMatrixIdentity(&projection);
+    invalidate_state();
+}
+
+// Destructor
+D3D9RenderDevice::~D3D9RenderDevice()
+{
+    if (line_drawer) line_drawer->Release();
+    if (glyph_texture) glyph_texture->Release();
+    if (back_buffer) back_buffer->Release();
+    release_readback();
+}
+
+// Forget cached device state
+void D3D9RenderDevice::invalidate_state()
+{
+    current_texture = NULL;
+    texture_known = false;
+    current_stream = NULL;
+    current_fvf = 0;
+}
+
+// Setup Direct3D rendering state
+void D3D9RenderDevice::setup_state()
+{
+    // Turning off z-testing (we will render objects in correct order)
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ZENABLE, FALSE));
+
+    // Enabling culling (counter-clockwise polygons will be culled)
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE));
+
+    // Alpha testing for transparent backgrounds
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHATESTENABLE, TRUE));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHAREF, 1));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHAFUNC, D3DCMP_GREATEREQUAL));
+
+    // Enabling blending texture and material color
+    ASSERT_DIRECTX(device->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_MODULATE));
+
+    // Setting texture filters
+    ASSERT_DIRECTX(device->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_POINT));
+    ASSERT_DIRECTX(device->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_POINT));
+
+    // Texture addressing mode
+    device->SetSamplerState(0, D3DSAMP_ADDRESSU, D3DTADDRESS_CLAMP);
+    device->SetSamplerState(0, D3DSAMP_ADDRESSV, D3DTADDRESS_CLAMP);
+
+    // Enabling alpha-blending
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA));
+
+    // Setting up lighting but not enabling it (we'll turn it off when
+    // we really need it)
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_LIGHTING, FALSE));
+
+    // Default light
+    D3DLIGHT9 light;
+    ZeroMemory(&light, sizeof(light));
+    light.Type = D3DLIGHT_DIRECTIONAL;
+    light.Diffuse.r = 1.0f;
+    light.Diffuse.g = 1.0f;
+    light.Diffuse.b = 1.0f;
+    light.Diffuse.a = 1.0f;
+
+    light.Specular = light.Diffuse;
+    light.Ambient = light.Diffuse;
+
+    light.Direction.x = 0.0f;
+    light.Direction.y = 0.0f;
+    light.Direction.z = 1.0f;
+    light.Range = 1000;
+
+    ASSERT_DIRECTX(device->SetLight(0, &light));
+    ASSERT_DIRECTX(device->LightEnable(0, TRUE));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_DIFFUSEMATERIALSOURCE,
+                                          D3DMCS_MATERIAL));
+
+    // Default material
+    D3DMATERIAL9 mtrl;
+    ZeroMemory(&mtrl, sizeof(mtrl));
+    D3DCOLORVALUE color = {1, 1, 1, 1};
+    mtrl.Diffuse = mtrl.Ambient = mtrl.Specular = color;
+    ASSERT_DIRECTX(device->SetMaterial(&mtrl));
+
+    // Disabling vertex shader
+    ASSERT_DIRECTX(device->SetVertexShader(NULL));
+    invalidate_state();
+}
+
+// Get device state
+HRESULT D3D9RenderDevice::test_cooperative_level()
+{
+    return device->TestCooperativeLevel();
+}
+
+// Reset lost device
+void D3D9RenderDevice::reset()
+{
+    line_drawer->OnLostDevice();
+    release_readback();
+
+    ASSERT_DIRECTX(device->Reset(&present_params));
+    clipped = false;
+
+    line_drawer->OnResetDevice();
+    invalidate_state();
+}
+
+// Get amount of texture memory
+UINT D3D9RenderDevice::get_available_texture_mem()
+{
+    return device->GetAvailableTextureMem() / 1024;
+}
+
+// Begin rendering
+void D3D9RenderDevice::begin_scene()
+{
+    ASSERT_DIRECTX(device->BeginScene());
+}
+
+// End rendering
+void D3D9RenderDevice::end_scene()
+{
+    flush_text();
+    ASSERT_DIRECTX(device->EndScene());
+}
+
+// Clear current render target
+void D3D9RenderDevice::clear( D3DCOLOR color )
+{
+    const D3DRECT * rect = clipped ? (const D3DRECT *)&clip_rect : NULL;
+    ASSERT_DIRECTX(device->Clear(clipped ? 1 : 0, rect, D3DCLEAR_TARGET, color, 1.0f, 0));
+}
+
+// Present back buffer
+bool D3D9RenderDevice::present()
+{
+    stats.frames++;
+    // Back buffer is of window client size, so rectangle is the same in both
+    const RECT * rect = clipped ? &clip_rect : NULL;
+    HRESULT result = device->Present(rect, rect, NULL, NULL);
+    if (D3DERR_DEVICELOST == result)
+        return false;
+    ASSERT_DIRECTX(result);
+    return true;
+}
+
+// Restrict clearing, drawing and presenting to rectangle of back buffer
+bool D3D9RenderDevice::set_clip_rect( const RECT * rect )
+{
+    // Only copying swap keeps back buffer contents after presenting
+    if (D3DSWAPEFFECT_COPY != present_params.SwapEffect)
+        return false;
+    
+    if (rect)
+    {
+        clip_rect = *rect;
+        ASSERT_DIRECTX(device->SetScissorRect(&clip_rect));
+    }
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_SCISSORTESTENABLE, rect ? TRUE : FALSE));
+    clipped = NULL != rect;
+    return true;
+}
+
+// Create texture from DDS file in memory
+HRESULT D3D9RenderDevice::create_texture( const char * dds, int size, int width, int height,
+                                          D3DFORMAT format, int skip_levels, Texture ** texture )
+{
+    LPDIRECT3DTEXTURE9 t;
+    HRESULT hr = D3DXCreateTextureFromFileInMemoryEx(device, dds, size, width, height, 1, 0,
+                     format, D3DPOOL_DEFAULT, D3DX_FILTER_NONE,
+                     D3DX_SKIP_DDS_MIP_LEVELS(skip_levels, D3DX_FILTER_NONE), 0,
+                     NULL, NULL, &t);
+    if (FAILED(hr)) return hr;
+
+    stats.texture_uploads++;
+    *texture = new D3D9Texture(t, false);
+    return hr;
+}
+
+// Create empty texture
+HRESULT D3D9RenderDevice::create_texture( int width, int height, D3DFORMAT format,
+                                          TextureUsage usage, Texture ** texture )
+{
+    // Some Intel cards don't support dynamic textures, using managed instead
+    D3DPOOL pool = D3DPOOL_DEFAULT;
+    DWORD d3d_usage = 0;
+    if (TEXTURE_RENDER_TARGET == usage)
+        d3d_usage = D3DUSAGE_RENDERTARGET;
+    else if (TEXTURE_DYNAMIC == usage)
+    {
+        if (caps.Caps2 & D3DCAPS2_DYNAMICTEXTURES)
+            d3d_usage = D3DUSAGE_DYNAMIC;
+        else
+            pool = D3DPOOL_MANAGED;
+    }
+
+    LPDIRECT3DTEXTURE9 t;
+    HRESULT hr = device->CreateTexture(width, height, 1, d3d_usage, format, pool, &t, NULL);
+    if (FAILED(hr)) return hr;
+
+    stats.texture_uploads++;
+    *texture = new D3D9Texture(t, 0 != (d3d_usage & D3DUSAGE_DYNAMIC));
+    return hr;
+}
+
+// Bind texture
+void D3D9RenderDevice::set_texture( Texture * texture, int sampler_index )
+{
+    LPDIRECT3DTEXTURE9 t = texture ? static_cast<D3D9Texture *>(texture)->texture : NULL;
+    if (0 == sampler_index)
+    {
+        if (texture_known && t == current_texture) return;
+        current_texture = t;
+        texture_known = true;
+        stats.texture_changes++;
+    }
+    ASSERT_DIRECTX(device->SetTexture(sampler_index, t));
+}
+
+// Create vertex buffer
+RenderDevice::VertexBuffer * D3D9RenderDevice::create_vertex_buffer( UINT size, bool dynamic )
+{
+    LPDIRECT3DVERTEXBUFFER9 buffer;
+    ASSERT_DIRECTX(device->CreateVertexBuffer(size * sizeof(TexturedVertex),
+                       D3DUSAGE_WRITEONLY | (dynamic ? D3DUSAGE_DYNAMIC : 0), TexturedVertex::FVF,
+                       dynamic ? D3DPOOL_DEFAULT : D3DPOOL_MANAGED, &buffer, NULL));
+    Log log;
+    log->debug("Vertex buffer created");
+    return new D3D9VertexBuffer(buffer, size, dynamic);
+}
+
+// Draw primitives from vertex buffer
+void D3D9RenderDevice::draw_primitive( D3DPRIMITIVETYPE type, VertexBuffer * buffer,
+                                       UINT start_vertex, UINT primitive_count )
+{
+    // Setting vertex buffer as stream source
+    LPDIRECT3DVERTEXBUFFER9 vb = static_cast<D3D9VertexBuffer *>(buffer)->buffer;
+    if (current_fvf != TexturedVertex::FVF)
+    {
+        current_fvf = TexturedVertex::FVF;
+        ASSERT_DIRECTX(device->SetFVF(TexturedVertex::FVF));
+    }
+    if (current_stream != vb)
+    {
+        current_stream = vb;
+        ASSERT_DIRECTX(device->SetStreamSource(0, vb, 0, sizeof(TexturedVertex)));
+    }
+    ASSERT_DIRECTX(device->DrawPrimitive(type, start_vertex, primitive_count));
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw triangle strip from vertex buffer
+void D3D9RenderDevice::draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    draw_primitive(D3DPT_TRIANGLESTRIP, buffer, start_vertex, primitive_count);
+}
+
+// Draw triangle list from vertex buffer
+void D3D9RenderDevice::draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    draw_primitive(D3DPT_TRIANGLELIST, buffer, start_vertex, primitive_count);
+}
+
+// Draw untextured triangle strip
+void D3D9RenderDevice::draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count )
+{
+    set_texture(NULL);
+    if (current_fvf != ColoredVertex::FVF)
+    {
+        current_fvf = ColoredVertex::FVF;
+        ASSERT_DIRECTX(device->SetFVF(ColoredVertex::FVF));
+    }
+    ASSERT_DIRECTX(device->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, primitive_count,
+                                           vertices, sizeof(ColoredVertex)));
+    // DrawPrimitiveUP resets stream source
+    current_stream = NULL;
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw untextured points
+void D3D9RenderDevice::draw_points( const ColoredVertex * vertices, UINT count, float size )
+{
+    if (0 == count) return;
+
+    DWORD psize;
+    ASSERT_DIRECTX(device->GetRenderState(D3DRS_POINTSIZE, &psize));
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_POINTSIZE, *(DWORD *)&size));
+
+    set_texture(NULL);
+    if (current_fvf != ColoredVertex::FVF)
+    {
+        current_fvf = ColoredVertex::FVF;
+        ASSERT_DIRECTX(device->SetFVF(ColoredVertex::FVF));
+    }
+    ASSERT_DIRECTX(device->DrawPrimitiveUP(D3DPT_POINTLIST, count, vertices, sizeof(ColoredVertex)));
+    current_stream = NULL;
+
+    ASSERT_DIRECTX(device->SetRenderState(D3DRS_POINTSIZE, psize));
+    stats.draw_calls++;
+    stats.primitives += count;
+}
+
+// Draw line strip
+void D3D9RenderDevice::draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color )
+{
+    if (count < 2) return;
+
+    D3DXMATRIX tr = world * projection;
+    line_drawer->SetWidth(1);
+    line_drawer->DrawTransform(points, count, &tr, color);
+    // Line renderer changes device state
+    invalidate_state();
+    stats.draw_calls++;
+    stats.primitives += count - 1;
+}
+
+// Draw line list
+void D3D9RenderDevice::draw_line_list( const ColoredVertex * vertices, UINT line_count )
+{
+    if (0 == line_count) return;
+
+    set_texture(NULL);
+    if (current_fvf != ColoredVertex::FVF)
+    {
+        current_fvf = ColoredVertex::FVF;
+        ASSERT_DIRECTX(device->SetFVF(ColoredVertex::FVF));
+    }
+    ASSERT_DIRECTX(device->DrawPrimitiveUP(D3DPT_LINELIST, line_count,
+                                           vertices, sizeof(ColoredVertex)));
+    current_stream = NULL;
+    stats.draw_calls++;
+    stats.primitives += line_count;
+}
+
+// Draw glyph quads with one call
+void D3D9RenderDevice::draw_text_quads( const GlyphAtlas & atlas,
+                                        std::vector<TextVertex> & vertices )
+{
+    // Uploading glyph atlas on first use (managed texture survives device reset)
+    if (NULL == glyph_texture)
+    {
+        ASSERT_DIRECTX(device->CreateTexture(atlas.width, atlas.height, 1, 0, D3DFMT_A8R8G8B8,
+                                             D3DPOOL_MANAGED, &glyph_texture, NULL));
+        D3DLOCKED_RECT r;
+        ASSERT_DIRECTX(glyph_texture->LockRect(0, &r, NULL, 0));
+        for (int y = 0; y < atlas.height; ++y)
+            memcpy((BYTE *)r.pBits + y * r.Pitch, &atlas.pixels[y * atlas.width], atlas.width * 4);
+        ASSERT_DIRECTX(glyph_texture->UnlockRect(0));
+    }
+
+    // Mapping texels to pixels
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        vertices[i].x -= 0.5f;
+        vertices[i].y -= 0.5f;
+    }
+
+    if (!texture_known || current_texture != glyph_texture)
+    {
+        current_texture = glyph_texture;
+        texture_known = true;
+        stats.texture_changes++;
+        ASSERT_DIRECTX(device->SetTexture(0, glyph_texture));
+    }
+    if (current_fvf != TextVertex::FVF)
+    {
+        current_fvf = TextVertex::FVF;
+        ASSERT_DIRECTX(device->SetFVF(TextVertex::FVF));
+    }
+    UINT primitive_count = UINT(vertices.size() / 3);
+    ASSERT_DIRECTX(device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, primitive_count,
+                                           &vertices[0], sizeof(TextVertex)));
+    current_stream = NULL;
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Set world transformation matrix
+void D3D9RenderDevice::set_world_transform( const D3DXMATRIX & world )
+{
+    this->world = world;
+    device->SetTransform(D3DTS_WORLD, &world);
+}
+
+// Set view and projection matrices
+void D3D9RenderDevice::set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection )
+{
+    this->projection = projection;
+    ASSERT_DIRECTX(device->SetTransform(D3DTS_VIEW, &view));
+    ASSERT_DIRECTX(device->SetTransform(D3DTS_PROJECTION, &projection));
+}
+
+// Create off-screen render target
+RenderDevice::RenderTarget * D3D9RenderDevice::create_render_target( int width, int height )
+{
+    LPDIRECT3DSURFACE9 surface;
+    ASSERT_DIRECTX(device->CreateRenderTarget(width, height, D3DFMT_A8R8G8B8,
+                                              D3DMULTISAMPLE_NONE, 0, FALSE, &surface, NULL));
+    return new D3D9RenderTarget(surface, width, height);
+}
+
+// Set render target
+void D3D9RenderDevice::set_render_target( RenderTarget * target )
+{
+    if (target)
+    {
+        if (!back_buffer)
+            ASSERT_DIRECTX(device->GetRenderTarget(0, &back_buffer));
+        ASSERT_DIRECTX(device->SetRenderTarget(0, static_cast<D3D9RenderTarget *>(target)->surface));
+    }
+    else if (back_buffer)
+    {
+        ASSERT_DIRECTX(device->SetRenderTarget(0, back_buffer));
+        back_buffer->Release();
+        back_buffer = NULL;
+    }
+}
+
+// Release back buffer copying surfaces
+void D3D9RenderDevice::release_readback()
+{
+    if (readback_target) readback_target->Release();
+    if (readback_staging) readback_staging->Release();
+    readback_target = readback_staging = NULL;
+}
+
+// Copy back buffer to system memory
+void D3D9RenderDevice::read_back_buffer( int width, int height, std::vector<DWORD> & pixels )
+{
+    // Surfaces are kept between calls and recreated only when size changes
+    if (readback_target && (readback_width != width || readback_height != height))
+        release_readback();
+    if (!readback_target)
+    {
+        ASSERT_DIRECTX(device->CreateRenderTarget(width, height, D3DFMT_X8R8G8B8,
+                           D3DMULTISAMPLE_NONE, 0, FALSE, &readback_target, NULL));
+        ASSERT_DIRECTX(device->CreateOffscreenPlainSurface(width, height, D3DFMT_X8R8G8B8,
+                           D3DPOOL_SYSTEMMEM, &readback_staging, NULL));
+        readback_width = width;
+        readback_height = height;
+    }
+
+    // Scaling on device, then copying to system memory
+    LPDIRECT3DSURFACE9 surface;
+    ASSERT_DIRECTX(device->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &surface));
+    HRESULT hr = device->StretchRect(surface, NULL, readback_target, NULL, D3DTEXF_LINEAR);
+    surface->Release();
+    ASSERT_DIRECTX(hr);
+    ASSERT_DIRECTX(device->GetRenderTargetData(readback_target, readback_staging));
+
+    D3DLOCKED_RECT rect;
+    ASSERT_DIRECTX(readback_staging->LockRect(&rect, NULL, D3DLOCK_READONLY));
+    pixels.resize(width * height);
+    for (int y = 0; y < height; ++y)
+    {
+        const DWORD * row = (const DWORD *)((const BYTE *)rect.pBits + y * rect.Pitch);
+        for (int x = 0; x < width; ++x)
+            pixels[y * width + x] = row[x] | 0xFF000000;
+    }
+    readback_staging->UnlockRect();
+}
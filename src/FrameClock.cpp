@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "FrameClock.h"
+#include <algorithm>
+#include <math.h>
+
+// Longest accepted time step
+const double FrameClock::max_step = 0.25;
+
+// Constructor
+FrameClock::FrameClock()
+    : fixed_step(0), accumulator(0), history_pos(0)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceFrequency(&t);
+    frequency = t.QuadPart;
+    QueryPerformanceCounter(&t);
+    origin = previous = t.QuadPart;
+    history.reserve(history_size);
+}
+
+// Convert performance counter value to seconds
+double FrameClock::to_seconds( LONGLONG ticks ) const
+{
+    return double(ticks) / double(frequency);
+}
+
+// Get time since clock creation
+double FrameClock::now() const
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return to_seconds(t.QuadPart - origin);
+}
+
+// Get time since previous frame
+double FrameClock::get_elapsed() const
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return to_seconds(t.QuadPart - previous);
+}
+
+// Finish frame
+double FrameClock::tick()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    double frame_time = to_seconds(t.QuadPart - previous);
+    previous = t.QuadPart;
+
+    // Recording duration to ring of recent frames
+    if (history.size() < history_size)
+        history.push_back(frame_time);
+    else
+        history[history_pos] = frame_time;
+    history_pos = (history_pos + 1) % history_size;
+
+    double step = min(frame_time, max_step);
+    if (fixed_step <= 0)
+        return step;
+
+    // Returning whole steps, remainder is carried to next frame
+    accumulator += step;
+    double steps = floor(accumulator / fixed_step);
+    accumulator -= steps * fixed_step;
+    return steps * fixed_step;
+}
+
+// Start timing from now
+void FrameClock::reset()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    previous = t.QuadPart;
+}
+
+// Set fixed time step
+void FrameClock::set_fixed_step( double step )
+{
+    fixed_step = max(0.0, step);
+    accumulator = 0;
+}
+
+// Get frame duration percentile
+double FrameClock::get_percentile( double percent ) const
+{
+    if (history.empty()) return 0;
+
+    // Nearest rank on copy of ring
+    std::vector<double> sorted(history);
+    double rank = percent / 100 * (sorted.size() - 1);
+    size_t index = min(sorted.size() - 1, size_t(max(0.0, rank) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+// Get mean frame duration
+double FrameClock::get_mean() const
+{
+    if (history.empty()) return 0;
+    double sum = 0;
+    for (size_t i = 0; i < history.size(); ++i)
+        sum += history[i];
+    return sum / history.size();
+}
+
+// Forget recorded frame durations
+void FrameClock::clear_stats()
+{
+    history.clear();
+    history_pos = 0;
+}
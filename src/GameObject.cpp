@@ -1,11 +1,18 @@
 #include "stdafx.h"
 #include "GameObject.h"
+#include "Config.h"
+#include "PrivateFileFilters.h"
+#include <algorithm>
 
 using namespace ingame;
 
 // Constructor
 GameObject::GameObject()
-    : position(0, 0), rotation(0.0f), scale(1.0f, 1.0f)
+    : position(0, 0), rotation(0.0f), scale(1.0f, 1.0f),
+      transformation(Affine2::identity()), transform_dirty(true),
+      parent_transformation(Affine2::identity()),
+      cached_position(0, 0), cached_scale(1.0f, 1.0f), cached_rotation(0.0f),
+      transformation_inv(Affine2::identity()), inverse_dirty(false)
 {
     objects.parent = this;
 }
@@ -25,30 +32,29 @@ void GameObject::begin_update()
     ingameTRY(
     {
         Direct3D d3d;
+        const Affine2 & parent = d3d->get_transform();
         
-        // Rotation matrix
-        D3DXMATRIX rotation_matrix;
-        float angle = rotation * 3.1415926f / 180.0f;
-        D3DXMatrixRotationZ(&rotation_matrix, angle);
-        
-        // Scaling matrix
-        D3DXMATRIX scaling_matrix;
-        D3DXMatrixScaling(&scaling_matrix, scale.x, scale.y, 1.0f);
-        
-        // Translation matrix
-        D3DXMATRIX translation_matrix;
-        D3DXMatrixTranslation(&translation_matrix, position.x, position.y, 0.0f);
-        
-        // Multiplying matrices
-        D3DXMATRIX intermediate_matrix;
-        D3DXMATRIX result_matrix;
-        D3DXMatrixMultiply(&intermediate_matrix, &rotation_matrix, &translation_matrix);
-        D3DXMatrixMultiply(&result_matrix, &scaling_matrix, &intermediate_matrix);
+        // Recalculating only if object or one of its ancestors was changed
+        if (transform_dirty || position != cached_position || scale != cached_scale ||
+            rotation != cached_rotation ||
+            0 != memcmp(&parent, &parent_transformation, sizeof(Affine2)))
+        {
+            // Scaling, then rotation, then translation
+            float angle = rotation * 3.1415926f / 180.0f;
+            Affine2 local = Affine2::scaling(scale.x, scale.y) * Affine2::rotation(angle) *
+                            Affine2::translation(position.x, position.y);
+            
+            parent_transformation = parent;
+            transformation = local * parent;
+            cached_position = position;
+            cached_scale = scale;
+            cached_rotation = rotation;
+            transform_dirty = false;
+            inverse_dirty = true;
+        }
         
         // Pushing transformation to stack
-        d3d->push_transform(result_matrix);
-        transformation = d3d->get_transform();
-        D3DXMatrixInverse(&transformation_inv, NULL, &transformation);
+        d3d->push_world_transform(transformation);
     });
 }
 
@@ -57,9 +63,10 @@ void GameObject::update_children( float dt )
 {
     ingameTRY(
     {
-        tanita2_dict objects_copy(objects);
-        for (tanita2_dict::iterator i = objects_copy.begin(); objects_copy.end() != i; ++i)
-            ((GameObject &)(bp::extract<GameObject &>(i.value()))).update(dt);
+        // Children may change dictionary while being updated
+        tanita2_dict::snapshot children(objects);
+        for (int i = 0; i < children.size(); ++i)
+            ((GameObject &)(bp::extract<GameObject &>(children.value(i)))).update(dt);
     });
 }
 
@@ -76,9 +83,9 @@ void GameObject::end_update()
 // Update sounds
 void GameObject::update_sounds( float dt )
 {
-    tanita2_dict sounds_copy(sounds);
-    for (tanita2_dict::iterator i = sounds_copy.begin(); sounds_copy.end() != i; ++i)
-        ((SoundID &)(bp::extract<SoundID &>(i.value()))).render(dt);
+    tanita2_dict::snapshot pinned_sounds(sounds);
+    for (int i = 0; i < pinned_sounds.size(); ++i)
+        ((SoundID &)(bp::extract<SoundID &>(pinned_sounds.value(i)))).render(dt);
 }
 
 // Loading sound
@@ -91,41 +98,75 @@ void GameObject::add_sound( bp::str & name, bp::object & sound_path )
 // Get position in absolute coordinates
 D3DXVECTOR2 GameObject::get_absolute_position() const
 {
-    D3DXVECTOR4 p_multiplied;
-    D3DXVec2Transform(&p_multiplied, &D3DXVECTOR2(0, 0), &transformation);
-    return D3DXVECTOR2(p_multiplied.x, p_multiplied.y);
+    return transformation.transform(0, 0);
 }
 
 // Get absolute rotation angle
 float GameObject::get_absolute_rotation() const
 {
-    D3DXVECTOR4 A, B;
-    D3DXVec2Transform(&A, &D3DXVECTOR2(0, 0), &transformation);
-    D3DXVec2Transform(&B, &D3DXVECTOR2(1, 0), &transformation);
-    const float result = atan2f(B.y - A.y, B.x - A.x) * 180.0f / 3.1415926f;
+    // Direction of transformed x axis is the first row of linear part
+    const float result = atan2f(transformation.b, transformation.a) * 180.0f / 3.1415926f;
     return result < 0 ? result + 360.0f : result;
 }
 
 // Convert world coordinates to local
 D3DXVECTOR2 GameObject::to_local_coordinates( const D3DXVECTOR2 & v )
 {
-    // Multiplying v by inverse transformation matrix
-    Direct3D d3d;
-    D3DXVECTOR4 p_multiplied;
-    D3DXVec2Transform(&p_multiplied, &v, &transformation_inv);
-    return D3DXVECTOR2(p_multiplied.x, p_multiplied.y);
+    // Multiplying v by inverse transformation
+    return get_transformation_inv().transform(v);
+}
+
+// Get inverse transformation
+const Affine2 & GameObject::get_transformation_inv() const
+{
+    if (inverse_dirty)
+    {
+        transformation_inv = transformation.inverse();
+        inverse_dirty = false;
+    }
+    return transformation_inv;
 }
 
+// Set position
+void GameObject::set_position( const D3DXVECTOR2 & p )
+{
+    position = p;
+    transform_dirty = true;
+}
+
+// Set scaling factor
+void GameObject::set_scale( const D3DXVECTOR2 & s )
+{
+    scale = s;
+    transform_dirty = true;
+}
+
+// Set rotation angle
+void GameObject::set_rotation( float angle )
+{
+    rotation = angle;
+    transform_dirty = true;
+}
+
+// Distance around visible area where tiles are loaded in advance, in layer pixels
+static const float TILE_MARGIN = 256.0f;
+
+// Maximal number of tiles loaded per frame
+int LayerImage::tile_loads_per_frame = 2;
+
 // Cleanup
 LayerImage::~LayerImage()
 {
     SequenceManager sm;
     sm->del(sequence);
+    release_tiles();
 }
 
 // Load image
 void LayerImage::load_image( bp::object & texture_path, bool compressed )
 {
+    // Image replaces tiles
+    release_tiles();
     SequenceManager sm;
     ingameTRY(sequence = sm->add(StaticSequence(PATH(bp::extract<char *>(texture_path)), compressed)));
 }
@@ -133,15 +174,118 @@ void LayerImage::load_image( bp::object & texture_path, bool compressed )
 // Load image from direct path
 void LayerImage::direct_load_image( bp::object & texture_path, bool compressed )
 {
+    release_tiles();
     SequenceManager sm;
     ingameTRY(sequence = sm->add(StaticSequence(PATH_EXT(bp::extract<char *>(texture_path)), compressed)));
 }
 
+// Load image split to tiles
+void LayerImage::load_tiled_image( bp::object & texture_path, int columns, int rows, bool compressed )
+{
+    release_tiles();
+    // Tiles replace whole image
+    SequenceManager sm;
+    sm->del(sequence);
+    sequence = SequenceID();
+
+    tiles_path = PATH(bp::extract<char *>(texture_path));
+    if (0 == columns || 0 == rows)
+        ingameTRY(PngFilter::split(tiles_path, tile_size, compressed, columns, rows));
+    
+    Config config;
+    try { tile_loads_per_frame = config->get<int>("tile_loads_per_frame"); }
+    catch (...) {}
+    
+    tile_columns = columns;
+    tile_rows = rows;
+    tiles_compressed = compressed;
+    tiles.assign(columns * rows, SequenceID());
+}
+
+// Release all tiles and forget tile grid
+void LayerImage::release_tiles()
+{
+    SequenceManager sm;
+    for (size_t i = 0; i < tiles.size(); ++i)
+        sm->del(tiles[i]);
+    tiles.clear();
+    tile_columns = tile_rows = 0;
+}
+
+// Load tiles entering visible area and release tiles leaving it
+void LayerImage::stream_tiles()
+{
+    // Visible area in layer coordinates (parallax is a part of transformation)
+    Direct3D d3d;
+    const Affine2 inv = d3d->get_transform().inverse();
+    const D3DXVECTOR2 view = d3d->get_view_size();
+    float left = 0, top = 0, right = 0, bottom = 0;
+    for (int c = 0; c < 4; ++c)
+    {
+        D3DXVECTOR2 t = inv.transform((c & 1) ? view.x : 0.0f, (c & 2) ? view.y : 0.0f);
+        if (0 == c || t.x < left)   left = t.x;
+        if (0 == c || t.x > right)  right = t.x;
+        if (0 == c || t.y < top)    top = t.y;
+        if (0 == c || t.y > bottom) bottom = t.y;
+    }
+    
+    // Tiles overlapping area with margin are loaded, tiles one tile
+    // further are kept to avoid reloading on small scrolls
+    const int x0 = int(floorf((left - TILE_MARGIN) / tile_size)),
+              y0 = int(floorf((top - TILE_MARGIN) / tile_size)),
+              x1 = int(floorf((right + TILE_MARGIN) / tile_size)),
+              y1 = int(floorf((bottom + TILE_MARGIN) / tile_size));
+
+    SequenceManager sm;
+    const float center_x = (left + right) * 0.5f / tile_size - 0.5f,
+                center_y = (top + bottom) * 0.5f / tile_size - 0.5f;
+    std::vector<std::pair<float, int> > missing;
+    for (int row = 0; row < tile_rows; ++row)
+        for (int column = 0; column < tile_columns; ++column)
+        {
+            SequenceID & tile = tiles[row * tile_columns + column];
+            const bool needed = column >= x0 && column <= x1 && row >= y0 && row <= y1,
+                       kept = column >= x0 - 1 && column <= x1 + 1 &&
+                              row >= y0 - 1 && row <= y1 + 1;
+            if (needed && 0 == ID(tile))
+            {
+                const float dx = column - center_x, dy = row - center_y;
+                missing.push_back(std::make_pair(dx * dx + dy * dy, row * tile_columns + column));
+            }
+            else if (!kept && 0 != ID(tile))
+            {
+                sm->del(tile);
+                tile = SequenceID();
+            }
+        }
+    
+    // Loading limited number of tiles nearest to view center, others next frames
+    const size_t count = min(missing.size(), (size_t)max(tile_loads_per_frame, 1));
+    std::partial_sort(missing.begin(), missing.begin() + count, missing.end());
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int index = missing[i].second;
+        SequenceID & tile = tiles[index];
+        PATH p(tiles_path.get_directory(), index, PATH::PNG);
+        ingameTRY(tile = sm->add(StaticSequence(p, tiles_compressed)));
+        tile.set_position(D3DXVECTOR2(float(index % tile_columns * tile_size),
+                                      float(index / tile_columns * tile_size)));
+    }
+}
+
 // Rendering image
 void LayerImage::update( float dt )
 {
     begin_update();
-    sequence.render(dt);
+    if (0 != ID(sequence))
+        sequence.render(dt);
+    if (!tiles.empty())
+    {
+        stream_tiles();
+        for (size_t i = 0; i < tiles.size(); ++i)
+            if (0 != ID(tiles[i]))
+                tiles[i].render(dt);
+    }
     update_children(dt);
     end_update();
 }
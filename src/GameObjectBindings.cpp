@@ -39,9 +39,11 @@ void GameObject::create_bindings()
 
         .def_readwrite("objects",  &GameObject::objects)
         .def_readwrite("sounds",   &GameObject::sounds)
-        .def_readwrite("position", &GameObject::position)
-        .def_readwrite("scale",    &GameObject::scale)
-        .def_readwrite("rotation", &GameObject::rotation)
+        .add_property("position", make_getter(&GameObject::position, return_internal_reference<>()),
+                                  &GameObject::set_position)
+        .add_property("scale",    make_getter(&GameObject::scale, return_internal_reference<>()),
+                                  &GameObject::set_scale)
+        .add_property("rotation", &GameObject::get_rotation, &GameObject::set_rotation)
         
         .add_property("absolute_position", &GameObject::get_absolute_position)
         .add_property("absolute_rotation", &GameObject::get_absolute_rotation)
@@ -70,6 +72,9 @@ void GameObject::create_bindings()
         .def("update",              &LayerImage::update,  &LayerImageWrap::default_update)
         .def("load_image",          &LayerImage::load_image, (arg("path"), arg("compressed") = true))
         .def("direct_load_image",   &LayerImage::direct_load_image, (arg("path"), arg("compressed") = true))
+        .def("load_tiled_image",    &LayerImage::load_tiled_image,
+                                    (arg("path"), arg("columns") = 0, arg("rows") = 0,
+                                     arg("compressed") = true))
         .def_readwrite("sequence",  &LayerImage::sequence)
         ;
         
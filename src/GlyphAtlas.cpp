@@ -0,0 +1,111 @@
+#include "stdafx.h"
+#include "GlyphAtlas.h"
+
+// Rasterize font glyphs
+GlyphAtlas::GlyphAtlas( const char * face, int font_height )
+    : width(256), height(0), line_height(0)
+{
+    ZeroMemory(glyphs, sizeof(glyphs));
+
+    // Same font parameters as were used by Direct3D font renderer
+    HDC dc = CreateCompatibleDC(NULL);
+    HFONT font = CreateFont(font_height, 0, 0, 0, 0, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
+                            0, 0, 0, 0, face);
+    HGDIOBJ old_font = SelectObject(dc, font);
+    TEXTMETRIC tm;
+    GetTextMetrics(dc, &tm);
+    line_height = tm.tmHeight;
+
+    // Packing glyph cells to rows of page
+    int x = 0, y = 0;
+    for (int c = 32; c < 256; ++c)
+    {
+        char ch = char(c);
+        SIZE size;
+        if (!GetTextExtentPoint32(dc, &ch, 1, &size) || 0 == size.cx)
+            continue;
+        if (x + size.cx > width)
+        {
+            x = 0;
+            y += line_height;
+        }
+        glyphs[c].x = short(x);
+        glyphs[c].y = short(y);
+        glyphs[c].width = short(size.cx);
+        x += size.cx;
+    }
+    height = 1;
+    while (height < y + line_height)
+        height <<= 1;
+
+    // Drawing white glyphs on black top-down DIB
+    BITMAPINFO info;
+    ZeroMemory(&info, sizeof(info));
+    info.bmiHeader.biSize = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth = width;
+    info.bmiHeader.biHeight = -height;
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void * bits = NULL;
+    HBITMAP bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+    HGDIOBJ old_bitmap = SelectObject(dc, bitmap);
+    ZeroMemory(bits, width * height * 4);
+    SetTextColor(dc, RGB(255, 255, 255));
+    SetBkMode(dc, TRANSPARENT);
+    for (int c = 32; c < 256; ++c)
+        if (glyphs[c].width)
+        {
+            char ch = char(c);
+            TextOut(dc, glyphs[c].x, glyphs[c].y, &ch, 1);
+        }
+    GdiFlush();
+
+    // Converting intensity to coverage
+    pixels.resize(width * height);
+    const DWORD * src = (const DWORD *)bits;
+    for (int i = 0; i < width * height; ++i)
+        pixels[i] = ((src[i] >> 8) & 0xFF) << 24 | 0xFFFFFF;
+
+    SelectObject(dc, old_bitmap);
+    SelectObject(dc, old_font);
+    DeleteObject(bitmap);
+    DeleteObject(font);
+    DeleteDC(dc);
+}
+
+// Lay out string to quads
+void GlyphAtlas::layout( const std::string & text, int x, int y, D3DCOLOR color,
+                         std::vector<TextVertex> & vertices ) const
+{
+    const float su = 1.0f / width, sv = 1.0f / height;
+    float pen_x = float(x), pen_y = float(y);
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        unsigned char c = text[i];
+        if ('\n' == c)
+        {
+            pen_x = float(x);
+            pen_y += line_height;
+            continue;
+        }
+        const Glyph & g = glyphs[c];
+        if (0 == g.width) continue;
+
+        // Quad corners in order of sprite strip, emitted as two triangles
+        float x1 = pen_x + g.width, y1 = pen_y + line_height;
+        float u0 = g.x * su, v0 = g.y * sv,
+              u1 = (g.x + g.width) * su, v1 = (g.y + line_height) * sv;
+        TextVertex corners[4] =
+        {
+            TextVertex(pen_x, pen_y, color, u0, v0),
+            TextVertex(x1,    pen_y, color, u1, v0),
+            TextVertex(pen_x, y1,    color, u0, v1),
+            TextVertex(x1,    y1,    color, u1, v1),
+        };
+        static const int indices[6] = {0, 1, 2, 2, 1, 3};
+        for (int k = 0; k < 6; ++k)
+            vertices.push_back(corners[indices[k]]);
+        pen_x = x1;
+    }
+}
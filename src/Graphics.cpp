@@ -6,6 +6,9 @@
 #include "Graphics.h"
 #include "Config.h"
 #include "Log.h"
+#include "WorkerPool.h"
+#include "PngWriter.h"
+#include "Profiler.h"
 #include <d3dx9.h>
 
 // Save screenshot flag
@@ -14,7 +17,89 @@ bool Direct3DInstance::need_save_screenshot = false;
 // Constructor
 Direct3DInstance::Direct3DInstance()
     : is_device_lost(false), rtt_enabled(false),
-      hardware_yuv_enabled(false)
+      hardware_yuv_enabled(false), render_thread_enabled(false), dirty_redraw_enabled(false),
+      clear_color(0), drawn_zoom(0)
+{
+    Log log;
+    Config conf;
+    
+    // Selecting rendering backend
+    std::string backend = "d3d9";
+    try { backend = conf->get<char *>("render_device"); }
+    catch (...) {}
+    try { render_thread_enabled = conf->get<bool>("render_thread"); }
+    catch (...) {}
+    try { dirty_redraw_enabled = conf->get<bool>("dirty_redraw"); }
+    catch (...) {}
+    
+    // Preparing device	parameters
+    D3DPRESENT_PARAMETERS & pp = present_params;
+    ZeroMemory(&pp, sizeof(pp));
+    pp.BackBufferWidth = conf->get<int>("width");
+    pp.BackBufferHeight = conf->get<int>("height");
+    
+    if ("null" == backend || "software" == backend)
+    {
+        // Rendering without graphical device
+        d3d = NULL;
+        device = NULL;
+        ZeroMemory(&device_caps, sizeof(device_caps));
+        
+        UINT texture_mem = 256 * 1024;
+        try { int vmem_limit = conf->get<int>("video_memory_limit");
+              if (0 < vmem_limit) texture_mem = vmem_limit; }
+        catch (...) {}
+        
+        if ("software" == backend)
+        {
+            render_device = new SoftwareRenderDevice(pp.BackBufferWidth, pp.BackBufferHeight,
+                                                     ApplicationInstance::window, texture_mem);
+            log->print("Using software render device.");
+        }
+        else
+        {
+            render_device = new NullRenderDevice(texture_mem);
+            log->print("Using null render device.");
+        }
+    }
+    else
+        create_device();
+    
+    // Drawing previous frame while next one is updated
+    if (render_thread_enabled)
+    {
+        render_device = new ThreadedRenderDevice(render_device);
+        log->print("Rendering on dedicated thread.");
+    }
+    
+    // Recording command stream for offline replay
+    std::string capture;
+    try { capture = conf->get<char *>("render_capture"); }
+    catch (...) {}
+    if (!capture.empty())
+    {
+        render_device = new CaptureRenderDevice(render_device, capture,
+                                                pp.BackBufferWidth, pp.BackBufferHeight);
+        log->print("Capturing render commands to " + capture);
+    }
+    
+    // Creating managers
+    texture_manager.create();
+    texture_manager->init(render_device);
+    vertex_manager.create();
+    sequence_manager.create();
+
+    // Creating transformation stack
+    transform_stack.reserve(32);
+    transform_stack.push_back(Affine2::identity());
+    
+    // Direct3D miscellaneous initializations
+    zoom = 1.0f;
+    setup_renderstate();
+}
+
+// Create Direct3D device
+void Direct3DInstance::create_device()
 {
     Log log;
     Config conf;
@@ -23,26 +108,26 @@ Direct3DInstance::Direct3DInstance()
     if (NULL == (d3d = Direct3DCreate9(D3D_SDK_VERSION)))
         throw Exception("Direct3D object creation failed");
 
-    // Preparing device	parameters
     D3DPRESENT_PARAMETERS & pp = present_params;
-    ZeroMemory(&pp, sizeof(pp));
     pp.Windowed = conf->get<bool>("windowed");
     if (!pp.Windowed)
         pp.FullScreen_RefreshRateInHz = conf->get<int>("refresh_rate");
-    pp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+    // Copying keeps back buffer between frames for redrawing changed area only
+    pp.SwapEffect = dirty_redraw_enabled && pp.Windowed ? D3DSWAPEFFECT_COPY : D3DSWAPEFFECT_DISCARD;
     pp.BackBufferCount = 1;
     pp.BackBufferFormat = pp.Windowed ? D3DFMT_UNKNOWN : D3DFMT_X8R8G8B8;
-    pp.BackBufferWidth = conf->get<int>("width");
-    pp.BackBufferHeight = conf->get<int>("height");
     pp.EnableAutoDepthStencil = false;
     pp.AutoDepthStencilFormat = D3DFMT_UNKNOWN;
     pp.hDeviceWindow = ApplicationInstance::window;
     pp.MultiSampleType = D3DMULTISAMPLE_NONE;
     pp.PresentationInterval = conf->get<bool>("vertical_sync") ? D3DPRESENT_INTERVAL_ONE : 
                                                                  D3DPRESENT_INTERVAL_IMMEDIATE;
+    // Resources are created by main thread while render thread draws
+    DWORD flags = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+    if (render_thread_enabled)
+        flags |= D3DCREATE_MULTITHREADED;
     ASSERT_DIRECTX(d3d->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL,
-                       pp.hDeviceWindow, D3DCREATE_SOFTWARE_VERTEXPROCESSING,
-                       &pp, &device));
+                       pp.hDeviceWindow, flags, &pp, &device));
     // Getting device capabilities
     ASSERT_DIRECTX(device->GetDeviceCaps(&device_caps));
     
@@ -105,24 +190,7 @@ Direct3DInstance::Direct3DInstance()
     if (!(device_caps.Caps2 & D3DCAPS2_DYNAMICTEXTURES))
         log->warning("Graphical device doesn't support dynamic textures");
     
-    // Creating managers
-    texture_manager.create();
-    texture_manager->init(device);
-    vertex_manager.create();
-    sequence_manager.create();
-
-    // Creating text renderer
-    ASSERT_DIRECTX(D3DXCreateFont(device, 15, 0, 0, 0, 0, 0, 
-                                  0, 0, 0, "Courier", &text_drawer));
-    // Creating line renderer
-    ASSERT_DIRECTX(D3DXCreateLine(device, &line_drawer));
-    
-    // Creating matrix stack
-    ASSERT_DIRECTX(D3DXCreateMatrixStack(0, &matrix_stack));
-    
-    // Direct3D miscellaneous initializations
-    zoom = 1.0f;
-    setup_renderstate();
+    render_device = new D3D9RenderDevice(device, present_params);
 }
 
 // Destructor
@@ -130,18 +198,19 @@ Direct3DInstance::~Direct3DInstance()
 {
 #define SAFE_RELEASE(res) { if (res) res->Release(); }
 
-    SAFE_RELEASE(text_drawer);
-    SAFE_RELEASE(line_drawer);
+    // Finishing screenshots being written
+    collect_screenshot_jobs(true);
+
     // Releasing Direct3D resources
     sequence_manager.~sequence_manager();
     vertex_manager.~vertex_manager();
     texture_manager.~texture_manager();
+    delete render_device;
     
     // Releasing Direct3D instances
     for (std::vector<LPDIRECT3DSURFACE9>::iterator i = default_render_target.begin();
          default_render_target.end() != i; ++i)
         SAFE_RELEASE((*i));
-    SAFE_RELEASE(matrix_stack);
     SAFE_RELEASE(device);
     SAFE_RELEASE(d3d);
 #undef SAFE_RELEASE
@@ -152,13 +221,19 @@ void Direct3DInstance::update( DWORD dt )
 {
     texture_manager->update(dt);
     vertex_manager->update(dt);
+    collect_screenshot_jobs(false);
 }
 
 // Clear screen
 void Direct3DInstance::clear( D3DCOLOR color )
 {
-    ASSERT(device);
-    ASSERT_DIRECTX(device->Clear(NULL, NULL, D3DCLEAR_TARGET, color, 1.0f, 0));
+    clear_color = color;
+}
+
+// Redraw whole frame on next present
+void Direct3DInstance::invalidate()
+{
+    sequence_manager->invalidate_drawn_queue();
 }
 
 // Saving screenshot
@@ -173,46 +248,123 @@ void Direct3DInstance::save_screenshot( char * filename, int width, int height )
     screenshot_height = height;
 }
 
-// Present all geometry and flip buffers 
-void Direct3DInstance::present()
+// Job encoding screenshot to PNG file
+class Direct3DInstance::ScreenshotJob: public WorkerPoolInstance::Job
 {
-    setup_matrices();
+public:
+    // Constructor
+    inline ScreenshotJob( const std::string & filename, int width, int height )
+        : filename(filename), width(width), height(height) {}
+    
+    // Encode and write image (called from worker thread)
+    virtual void run()
+    {
+        PROFILE_ZONE("screenshot_encode");
+        save_png(filename, &pixels[0], width, height, width);
+    }
+    
+    // Image file path and size
+    std::string filename;
+    int width, height;
+    // Copy of back buffer
+    std::vector<DWORD> pixels;
+};
 
-    if (need_save_screenshot)
+// Report errors of finished screenshot jobs
+void Direct3DInstance::collect_screenshot_jobs( bool wait )
+{
+    if (screenshot_jobs.empty()) return;
+    
+    WorkerPool pool;
+    std::list< boost::shared_ptr<ScreenshotJob> >::iterator i = screenshot_jobs.begin();
+    while (screenshot_jobs.end() != i)
     {
-        Direct3D d3d;
-        LPDIRECT3DSURFACE9 small_surface, old_surface;
-        ASSERT_DIRECTX(d3d->device->CreateRenderTarget(screenshot_width, screenshot_height, 
-                                                       D3DFMT_A8R8G8B8, D3DMULTISAMPLE_NONE, 0, 
-                                                       FALSE, &small_surface, NULL));
-        ASSERT_DIRECTX(d3d->device->GetRenderTarget(0, &old_surface));
-        ASSERT_DIRECTX(d3d->device->SetRenderTarget(0, small_surface));
+        if (wait)
+        {
+            try { pool->wait(**i); }
+            catch (std::exception & e) { Log log; log->error(e.what()); }
+        }
+        if (!(*i)->is_done())
+        {
+            ++i;
+            continue;
+        }
+        if (!(*i)->get_error().empty())
+        {
+            Log log;
+            log->error((*i)->get_error());
+        }
+        i = screenshot_jobs.erase(i);
+    }
+}
 
-        ASSERT_DIRECTX(device->BeginScene());
-        TRY(sequence_manager->draw_queue());
-        ASSERT_DIRECTX(device->EndScene());
+// Wait until all requested screenshots are written
+void Direct3DInstance::wait_screenshots()
+{
+    collect_screenshot_jobs(true);
+}
 
-        ASSERT_DIRECTX(d3d->device->SetRenderTarget(0, old_surface));
-        ASSERT_DIRECTX(D3DXSaveSurfaceToFile(screenshot_name.c_str(), D3DXIFF_PNG, small_surface, NULL, NULL));
-        
-        small_surface->Release();
-        old_surface->Release();
+// Present all geometry and flip buffers 
+void Direct3DInstance::present( bool changed_only )
+{
+    setup_matrices();
+
+    // Finding area changed since previous frame
+    bool clipped = false;
+    if (dirty_redraw_enabled)
+    {
+        if (zoom != drawn_zoom || need_save_screenshot)
+            sequence_manager->invalidate_drawn_queue();
+        drawn_zoom = zoom;
         
-        need_save_screenshot = false;
+        SequenceManagerInstance::Bounds dirty;
+        bool changed = sequence_manager->update_drawn_queue(dirty);
+        if (changed_only)
+        {
+            // Converting to back buffer pixels with border for filtering
+            const D3DXVECTOR2 view = get_view_size();
+            const float width = float(present_params.BackBufferWidth),
+                        height = float(present_params.BackBufferHeight),
+                        sx = width / view.x, sy = height / view.y;
+            RECT rect;
+            rect.left   = LONG(max(0.0f,   floorf(dirty.left * sx) - 1));
+            rect.top    = LONG(max(0.0f,   floorf(dirty.top * sy) - 1));
+            rect.right  = LONG(min(width,  ceilf(dirty.right * sx) + 1));
+            rect.bottom = LONG(min(height, ceilf(dirty.bottom * sy) + 1));
+            
+            // Nothing visible has changed
+            if (!changed || rect.left >= rect.right || rect.top >= rect.bottom)
+            {
+                sequence_manager->clear_queue();
+                return;
+            }
+            clipped = render_device->set_clip_rect(&rect);
+        }
     }
-    
-    ASSERT_DIRECTX(device->BeginScene());
+
+    render_device->clear(clear_color);
+    render_device->begin_scene();
     TRY(sequence_manager->flush());
-    ASSERT_DIRECTX(device->EndScene());
+    render_device->end_scene();
     
-    // Presenting scene
-    HRESULT result = device->Present(NULL, NULL, NULL, NULL);
-    if (D3DERR_DEVICELOST != result)
+    // Copying rendered frame, PNG encoding is done by worker threads
+    if (need_save_screenshot)
     {
-        ASSERT_DIRECTX(result);
+        boost::shared_ptr<ScreenshotJob> job(
+            new ScreenshotJob(screenshot_name, screenshot_width, screenshot_height));
+        TRY(render_device->read_back_buffer(screenshot_width, screenshot_height, job->pixels));
+        WorkerPool pool;
+        pool->submit(*job);
+        screenshot_jobs.push_back(job);
+        
+        need_save_screenshot = false;
     }
-    else
+    
+    // Presenting scene
+    if (!render_device->present())
         is_device_lost = true;
+    if (clipped)
+        render_device->set_clip_rect(NULL);
 }
 
 // Direct3D matrix setup
@@ -220,109 +372,47 @@ void Direct3DInstance::setup_matrices()
 {
     D3DXMatrixTranslation(&matrix_view, 0, 0, 5);
     
-    const float w = 1024 / zoom, h = 768 / zoom;
+    const D3DXVECTOR2 view = get_view_size();
 
-    D3DXMatrixOrthoOffCenterLH(&matrix_projection, 0, w, h, 0, 
+    D3DXMatrixOrthoOffCenterLH(&matrix_projection, 0, view.x, view.y, 0, 
                                float(ZNear), float(ZFar));
-    ASSERT_DIRECTX(device->SetTransform(D3DTS_VIEW, &matrix_view));
-    ASSERT_DIRECTX(device->SetTransform(D3DTS_PROJECTION, &matrix_projection));
+    render_device->set_view_projection(matrix_view, matrix_projection);
 }
 
-// Setup Direct3D rendering state
+// Setup rendering state
 void Direct3DInstance::setup_renderstate()
 {
-    // Turning off z-testing (we will render objects in correct order)
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ZENABLE, FALSE));
-    
-    // Enabling culling (counter-clockwise polygons will be culled)
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE));
-    
-    // Alpha testing for transparent backgrounds
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHATESTENABLE, TRUE)); 
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHAREF, 1));
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHAFUNC, D3DCMP_GREATEREQUAL));
-    
-    // Enabling blending texture and material color
-    ASSERT_DIRECTX(device->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_MODULATE));
-    
-    // Setting texture filters
-    ASSERT_DIRECTX(device->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_POINT));
-    ASSERT_DIRECTX(device->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_POINT));
-    
-    // Texture addressing mode
-    device->SetSamplerState(0, D3DSAMP_ADDRESSU, D3DTADDRESS_CLAMP);
-    device->SetSamplerState(0, D3DSAMP_ADDRESSV, D3DTADDRESS_CLAMP);
-    
-    // Enabling alpha-blending
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE));
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA));
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA)); 
-
-    // Setting up lighting but not enabling it (we'll turn it off when
-    // we really need it)
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_LIGHTING, FALSE));
-    
-    // Default light
-    D3DLIGHT9 light;
-    ZeroMemory(&light, sizeof(light));
-    light.Type = D3DLIGHT_DIRECTIONAL;
-    light.Diffuse.r = 1.0f;
-    light.Diffuse.g = 1.0f;
-    light.Diffuse.b = 1.0f;
-    light.Diffuse.a = 1.0f;
-
-    light.Specular = light.Diffuse;
-    light.Ambient = light.Diffuse;
-
-    light.Direction.x = 0.0f;
-    light.Direction.y = 0.0f;
-    light.Direction.z = 1.0f;
-    light.Range = ZFar;
-    
-    ASSERT_DIRECTX(device->SetLight(0, &light));
-    ASSERT_DIRECTX(device->LightEnable(0, TRUE));
-    ASSERT_DIRECTX(device->SetRenderState(D3DRS_DIFFUSEMATERIALSOURCE, 
-                                          D3DMCS_MATERIAL));
-
-    // Default material
-    D3DMATERIAL9 mtrl;
-    ZeroMemory(&mtrl, sizeof(mtrl));
-    D3DCOLORVALUE color = {1, 1, 1, 1};
-    mtrl.Diffuse = mtrl.Ambient = mtrl.Specular = color;
-    ASSERT_DIRECTX(device->SetMaterial(&mtrl));
-    
-    // Disabling vertex shader
-    ASSERT_DIRECTX(device->SetVertexShader(NULL));
+    render_device->setup_state();
     
     // Setting transformation matrices
     setup_matrices();
 }
 
-// Get current transformation matrix
-D3DXMATRIX Direct3DInstance::get_transform()
+// Push transformation to stack
+void Direct3DInstance::push_transform( const Affine2 & new_transform )
 {
-    return *matrix_stack->GetTop();
+    Affine2 top = new_transform * transform_stack.back();
+    transform_stack.push_back(top);
 }
 
-// Push transformation to stack
-void Direct3DInstance::push_transform( const D3DXMATRIX & new_transform )
+// Push combined transformation to stack
+void Direct3DInstance::push_world_transform( const Affine2 & world )
 {
-    matrix_stack->Push();
-    matrix_stack->MultMatrixLocal(&new_transform);
+    transform_stack.push_back(world);
 }
 
 // Pop transformation from stack
 void Direct3DInstance::pop_transform()
 {
-    matrix_stack->Pop();
+    ASSERT(transform_stack.size() > 1);
+    transform_stack.pop_back();
 }
 
 // Clear rendering queue
 void Direct3DInstance::clear_render_queue()
 {
     sequence_manager->clear_queue();
-    matrix_stack->Release();
-    ASSERT_DIRECTX(D3DXCreateMatrixStack(0, &matrix_stack));
+    transform_stack.resize(1);
 }
 
 // Check if device is lost and can be restored
@@ -332,7 +422,7 @@ bool Direct3DInstance::is_lost()
         return false;
     
     // Checking if device can be reset
-    HRESULT hr = device->TestCooperativeLevel();
+    HRESULT hr = render_device->test_cooperative_level();
     switch (hr)
     {
     // Device is lost and cannot be restored
@@ -351,11 +441,9 @@ bool Direct3DInstance::is_lost()
         }
         
         texture_manager->unload_textures();
-        text_drawer->OnLostDevice();
-        line_drawer->OnLostDevice();
-        VertexManagerInstance::VertexBufferInstance::force_update = true;
+        vertex_manager->release_dynamic_buffer();
         // Resetting device
-        ASSERT_DIRECTX(device->Reset(&present_params));
+        render_device->reset();
         
         // Restoring resources
 
@@ -367,10 +455,9 @@ bool Direct3DInstance::is_lost()
             default_render_target.push_back(rt);
         }
         
-        text_drawer->OnResetDevice();
-        line_drawer->OnResetDevice();
-        
         setup_renderstate();
+        // Back buffer contents were lost
+        sequence_manager->invalidate_drawn_queue();
         is_device_lost = false;
         return true;
     }
@@ -1,33 +1,158 @@
 #include "stdafx.h"
 #include "Helpers.h"
 
+// Check if python object may override update method of wrapped class
+bool ingame::overrides_update( PyObject * self, PyTypeObject * class_object )
+{
+    static PyObject * name = PyString_InternFromString("update");
+    
+    // Instance attribute hides class one
+    PyObject ** dict = _PyObject_GetDictPtr(self);
+    if (NULL != dict && NULL != *dict && NULL != PyDict_GetItem(*dict, name))
+        return true;
+    
+    // Method found in classes of object is compared with registered one
+    // (as get_override does for bound method)
+    PyObject * method = _PyType_Lookup(self->ob_type, name);
+    if (NULL == method)
+        return false;
+    return NULL == class_object->tp_dict ||
+           method != PyDict_GetItem(class_object->tp_dict, name);
+}
+
+// Intern key string, so that keys written as literals are compared by pointer
+static bp::str intern_key( bp::str & key )
+{
+    PyObject * p = key.ptr();
+    if (!PyString_CheckExact(p))
+        return key;
+    Py_INCREF(p);
+    PyString_InternInPlace(&p);
+    return bp::str(bp::detail::new_reference(p));
+}
+
+// Get key hash (cached by string object)
+static long hash_key( bp::str & key )
+{
+    long hash = PyObject_Hash(key.ptr());
+    if (-1 == hash)
+        bp::throw_error_already_set();
+    return hash;
+}
+
+// Compare keys without python comparison for plain strings
+static inline bool keys_equal( PyObject * a, PyObject * b )
+{
+    if (a == b)
+        return true;
+    if (PyString_CheckExact(a) && PyString_CheckExact(b))
+        return PyString_GET_SIZE(a) == PyString_GET_SIZE(b) &&
+               0 == memcmp(PyString_AS_STRING(a), PyString_AS_STRING(b), PyString_GET_SIZE(a));
+    return 1 == PyObject_RichCompareBool(a, b, Py_EQ);
+}
+
+// Find hash index slot of key
+size_t tanita2_dict::find_slot( PyObject * key, long hash )
+{
+    // Index is a power of two in size and at most half full
+    const size_t mask = _index.size() - 1;
+    for (size_t slot = size_t(hash) & mask; ; slot = (slot + 1) & mask)
+    {
+        const int i = _index[slot];
+        if (-1 == i || (_hashes[i] == hash && keys_equal(_keys[i].ptr(), key)))
+            return slot;
+    }
+}
+
+// Find position of key
+int tanita2_dict::find( bp::str & key )
+{
+    if (_index.empty())
+        return -1;
+    return _index[find_slot(key.ptr(), hash_key(key))];
+}
+
+// Add element at given position to hash index
+void tanita2_dict::index_insert( int position )
+{
+    if (2 * _keys.size() > _index.size())
+    {
+        rebuild_index();
+        return;
+    }
+    size_t slot = find_slot(_keys[position].ptr(), _hashes[position]);
+    if (-1 == _index[slot])
+        _index[slot] = position;
+}
+
+// Rebuild hash index after elements were moved
+void tanita2_dict::rebuild_index()
+{
+    size_t size = 8;
+    while (size < 2 * _keys.size())
+        size <<= 1;
+    _index.assign(size, -1);
+    
+    // Lookups find first of duplicated keys, as with linear search
+    for (int i = 0; i < (int)_keys.size(); ++i)
+    {
+        size_t slot = find_slot(_keys[i].ptr(), _hashes[i]);
+        if (-1 == _index[slot])
+            _index[slot] = i;
+    }
+}
+
+// Assignment
+tanita2_dict & tanita2_dict::operator =( const tanita2_dict & d )
+{
+    if (this == &d) return *this;
+    detach();
+    _keys = d._keys;
+    _values = d._values;
+    _hashes = d._hashes;
+    _index = d._index;
+    return *this;
+}
+
+// Keep pinned elements until iteration end and continue with their copy
+void tanita2_dict::retire()
+{
+    // Swapping keeps snapshot pointers to elements valid
+    retired.push_back(Retired());
+    Retired & r = retired.back();
+    r.keys.swap(_keys);
+    r.values.swap(_values);
+    _keys = r.keys;
+    _values = r.values;
+    pinned = false;
+}
+
 // Element indexing operator
 bp::object & tanita2_dict::operator []( bp::str & index )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (index == _keys[i]) return _values[i];
-    throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(index)));
+    int i = find(index);
+    if (-1 == i)
+        throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(index)));
+    return _values[i];
 }
 
 // Erase element from dictionary
 void tanita2_dict::erase( bp::str & index )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (index == _keys[i])
-        {
-            _keys.erase(_keys.begin() + i);
-            _values.erase(_values.begin() + i);
-            return;
-        }
-    throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(index)));
+    int i = find(index);
+    if (-1 == i)
+        throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(index)));
+    detach();
+    _keys.erase(_keys.begin() + i);
+    _values.erase(_values.begin() + i);
+    _hashes.erase(_hashes.begin() + i);
+    rebuild_index();
 }
 
 // Key check
 bool tanita2_dict::has_key( bp::str & index )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (index == _keys[i]) return true;
-    return false;
+    return -1 != find(index);
 }
 
 // Getting item from dictionary
@@ -46,14 +171,18 @@ bp::object & tanita2_dict::getitem( bp::str & index )
 // Setting item in dictionary
 void tanita2_dict::setitem( bp::str & index, bp::object & value )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (index == _keys[i])
-        {
-            _values[i] = value;
-            return;
-        }
-    _keys.push_back(index);
+    int i = find(index);
+    detach();
+    if (-1 != i)
+    {
+        _values[i] = value;
+        return;
+    }
+    long hash = hash_key(index);
+    _keys.push_back(intern_key(index));
     _values.push_back(value);
+    _hashes.push_back(hash);
+    index_insert(_keys.size() - 1);
 }
 
 // Deleting item in dictionary
@@ -99,46 +228,41 @@ bp::object tanita2_dict::iteritems()
 // Swap two items
 void tanita2_dict::swap( bp::str & a1, bp::str & a2 )
 {
-    if (a1 == a2) return;
+    if (keys_equal(a1.ptr(), a2.ptr())) return;
     
-    bp::object * one = NULL, * two = NULL;
-    int i_one, i_two;
-    for (unsigned int i = 0; i < _keys.size() && (!one || !two); ++i)
+    size_t one = 0, two = 0;
+    if (!_index.empty())
     {
-        if (a1 == _keys[i])
-        {
-            one = &_values[i];
-            i_one = i;
-            continue;
-        }
-        if (a2 == _keys[i])
-        {
-            two = &_values[i];
-            i_two = i;
-        }
+        one = find_slot(a1.ptr(), hash_key(a1));
+        two = find_slot(a2.ptr(), hash_key(a2));
     }
-    if (!one || !two)
+    if (_index.empty() || -1 == _index[one] || -1 == _index[two])
     {
         PyErr_SetString(PyExc_KeyError, "Invalid key(s)");
         bp::throw_error_already_set();
         throw;
     }
-    // Swapping values
-    bp::object tmp = *one; *one = *two; *two = tmp;
-    // Swapping keys
+    
+    // Swapping elements, index slots follow their keys
+    detach();
+    int i_one = _index[one], i_two = _index[two];
+    bp::object tmp = _values[i_one]; _values[i_one] = _values[i_two]; _values[i_two] = tmp;
     bp::str tmp1 = _keys[i_one]; _keys[i_one] = _keys[i_two]; _keys[i_two] = tmp1;
+    std::swap(_hashes[i_one], _hashes[i_two]);
+    std::swap(_index[one], _index[two]);
 }
 
 // Change key
 void tanita2_dict::change_key( bp::str & old_key, bp::str & new_key )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (old_key == _keys[i])
-        {
-            _keys[i] = new_key;
-            return;
-        }
+    int i = find(old_key);
+    if (-1 == i)
 		throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(old_key)));
+    long hash = hash_key(new_key);
+    detach();
+    _keys[i] = intern_key(new_key);
+    _hashes[i] = hash;
+    rebuild_index();
 }
 
 // Get value by index
@@ -160,18 +284,22 @@ bp::str & tanita2_dict::get_key_by_index( unsigned int index )
 // Get index of given key
 unsigned int tanita2_dict::get_index( bp::str & key )
 {
-    for (unsigned int i = 0; i < _keys.size(); ++i)
-        if (key == _keys[i])
-            return i;
-	throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(key)));
+    int i = find(key);
+    if (-1 == i)
+	    throw Exception(boost::str(boost::format("Invalid key: %s") % bp::extract<char *>(key)));
+    return i;
 }
 
 
 // Inserting item
 void tanita2_dict::push_front( bp::str & key, bp::object & value )
 {
-    _keys.insert(_keys.begin(), key);
+    long hash = hash_key(key);
+    detach();
+    _keys.insert(_keys.begin(), intern_key(key));
     _values.insert(_values.begin(), value);
+    _hashes.insert(_hashes.begin(), hash);
+    rebuild_index();
 }
 
 // Create bindings
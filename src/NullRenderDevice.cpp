@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+
+// Texture without device memory
+class NullTexture: public RenderDevice::Texture
+{
+public:
+    // Constructor
+    inline NullTexture( int width, int height, D3DFORMAT format )
+        : RenderDevice::Texture(width, height, format) {}
+
+    // Lock texture (memory is allocated on first lock)
+    virtual BYTE * lock( int & pitch, bool discard )
+    {
+        pitch = width * 4;
+        if (data.empty())
+            data.resize(pitch * height);
+        return &data[0];
+    }
+    // Unlock texture
+    virtual void unlock() {}
+
+    // Texture data
+    std::vector<BYTE> data;
+};
+
+// Vertex buffer in system memory
+class NullVertexBuffer: public RenderDevice::VertexBuffer
+{
+public:
+    // Constructor
+    inline NullVertexBuffer( UINT size )
+        : RenderDevice::VertexBuffer(size), vertices(size) {}
+
+    // Lock vertices
+    virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode )
+        { return &vertices[start]; }
+    // Unlock vertex buffer
+    virtual void unlock() {}
+
+    // Vertex data
+    std::vector<TexturedVertex> vertices;
+};
+
+// Render target which is never saved
+class NullRenderTarget: public RenderDevice::RenderTarget
+{
+public:
+    // Constructor
+    inline NullRenderTarget( int width, int height )
+        : RenderDevice::RenderTarget(width, height) {}
+
+    // Save contents to PNG file
+    virtual void save( const std::string & filename ) {}
+};
+
+// Create texture from DDS file in memory
+HRESULT NullRenderDevice::create_texture( const char * dds, int size, int width, int height,
+                                          D3DFORMAT format, int skip_levels, Texture ** texture )
+{
+    stats.texture_uploads++;
+    *texture = new NullTexture(width, height, format);
+    return D3D_OK;
+}
+
+// Create empty texture
+HRESULT NullRenderDevice::create_texture( int width, int height, D3DFORMAT format,
+                                          TextureUsage usage, Texture ** texture )
+{
+    stats.texture_uploads++;
+    *texture = new NullTexture(width, height, format);
+    return D3D_OK;
+}
+
+// Bind texture
+void NullRenderDevice::set_texture( Texture * texture, int sampler_index )
+{
+    if (0 != sampler_index || current_texture == texture) return;
+    current_texture = texture;
+    stats.texture_changes++;
+}
+
+// Create vertex buffer
+RenderDevice::VertexBuffer * NullRenderDevice::create_vertex_buffer( UINT size, bool dynamic )
+{
+    return new NullVertexBuffer(size);
+}
+
+// Draw triangle strip from vertex buffer
+void NullRenderDevice::draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw triangle list from vertex buffer
+void NullRenderDevice::draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw untextured triangle strip
+void NullRenderDevice::draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count )
+{
+    set_texture(NULL);
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw untextured points
+void NullRenderDevice::draw_points( const ColoredVertex * vertices, UINT count, float size )
+{
+    if (0 == count) return;
+    set_texture(NULL);
+    stats.draw_calls++;
+    stats.primitives += count;
+}
+
+// Draw line strip
+void NullRenderDevice::draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color )
+{
+    if (count < 2) return;
+    stats.draw_calls++;
+    stats.primitives += count - 1;
+}
+
+// Draw line list
+void NullRenderDevice::draw_line_list( const ColoredVertex * vertices, UINT line_count )
+{
+    if (0 == line_count) return;
+    stats.draw_calls++;
+    stats.primitives += line_count;
+}
+
+// Draw glyph quads
+void NullRenderDevice::draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices )
+{
+    stats.draw_calls++;
+    stats.primitives += UINT(vertices.size() / 3);
+}
+
+// Create off-screen render target
+RenderDevice::RenderTarget * NullRenderDevice::create_render_target( int width, int height )
+{
+    return new NullRenderTarget(width, height);
+}
+
+// Copy back buffer to system memory (nothing is drawn, so image is black)
+void NullRenderDevice::read_back_buffer( int width, int height, std::vector<DWORD> & pixels )
+{
+    pixels.assign(width * height, 0xFF000000);
+}
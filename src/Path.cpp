@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "Path.h"
+#include "Profiler.h"
 #pragma warning(disable: 4312)
 
 using namespace ingame;
@@ -347,11 +348,8 @@ void Path::PathOutlineSequence::render()
 {
     if (cached_points.size() == 0) return;
 
-    Direct3D d3d;
-    D3DXMATRIX tr = transformation * d3d->get_projection_matrix();
-    d3d->line_drawer->SetWidth(1);
-    d3d->line_drawer->DrawTransform(&cached_points[0], cached_points.size()-1,
-                                    &tr, color);
+    SequenceManager sm;
+    sm->add_debug_lines(&cached_points[0], cached_points.size()-1, transformation, color);
 }
 
 // Sequence rendering
@@ -361,30 +359,8 @@ void PathFindRegion::PathFindOutline::render()
     
     if (map->nodes.size() == 0) return;
 
-    Direct3D d3d;
-
-    // Saving previous state
-    DWORD oldFVF;
-    LPDIRECT3DVERTEXBUFFER9 oldStreamData;
-    UINT oldOffsetInBytes, oldStride;
-    ASSERT_DIRECTX(d3d->device->GetStreamSource(0, &oldStreamData, &oldOffsetInBytes, &oldStride));
-    ASSERT_DIRECTX(d3d->device->GetFVF(&oldFVF));
-    DWORD psize;
-    ASSERT_DIRECTX(d3d->device->GetRenderState(D3DRS_POINTSIZE, &psize));
-    
-    // Rendering
-    ASSERT_DIRECTX(d3d->device->SetRenderState(D3DRS_POINTSIZE, 2));
-    ASSERT_DIRECTX(d3d->device->SetFVF(PathOutlineFormat::FVF));
-    ASSERT_DIRECTX(d3d->device->SetTexture(0, NULL));
-    d3d->device->SetTransform(D3DTS_WORLD, &transformation);
-    ASSERT_DIRECTX(d3d->device->DrawPrimitiveUP(D3DPT_POINTLIST, cached_node_points.size(),
-                   &cached_node_points[0], sizeof(PathOutlineFormat)));
-    
-    // Restoring previous state
-    ASSERT_DIRECTX(d3d->device->SetRenderState(D3DRS_POINTSIZE, psize));
-    ASSERT_DIRECTX(d3d->device->SetStreamSource(0, oldStreamData, oldOffsetInBytes, oldStride));
-    ASSERT_DIRECTX(d3d->device->SetFVF(oldFVF));
-    if (oldStreamData) oldStreamData->Release();
+    SequenceManager sm;
+    sm->add_debug_points(&cached_node_points[0], cached_node_points.size(), transformation, 2.0f);
 }
 
 // Return least cost estimation between two states
@@ -445,13 +421,13 @@ PathFindRegion::PathFindRegion() : pather(NULL)
 // Get path from point A to point B (or empty path if none)
 Path PathFindRegion::find_path( const D3DXVECTOR2 & A, const D3DXVECTOR2 & B )
 {
+    PROFILE_ZONE("find_path");
 #define TOINT(a) (int(a) / RegionMap::grid_size * RegionMap::grid_size)
 #define TOSTATE(x, y) (void *)(TOINT(y) * map.width * RegionMap::grid_size + TOINT(x))
 
     // Transforming points to local coordinates
-    D3DXVECTOR4 va_tmp, vb_tmp;
-    D3DXVec2Transform(&va_tmp, &A, &transformation_inv);
-    D3DXVec2Transform(&vb_tmp, &B, &transformation_inv);
+    D3DXVECTOR2 va_tmp = get_transformation_inv().transform(A),
+                vb_tmp = get_transformation_inv().transform(B);
     D3DXVECTOR2 va(va_tmp.x - float(map.left), va_tmp.y - float(map.down)),
                 vb(vb_tmp.x - float(map.left), vb_tmp.y - float(map.down));
 
@@ -524,9 +500,7 @@ Path PathFindRegion::find_path( const D3DXVECTOR2 & A, const D3DXVECTOR2 & B )
                     D3DXVECTOR2 point(vb_tmp.x, vb_tmpy);
                     if (is_local_point_inside(point))
                     {
-                        D3DXVECTOR4 pt4;
-                        D3DXVec2Transform(&pt4, &point, &transformation);
-                        D3DXVECTOR2 point_transformed(pt4.x, pt4.y);
+                        D3DXVECTOR2 point_transformed = transformation.transform(point);
 
                         bool blocked = false;
                         for (int i = 0; i < block_reg_count; ++i)
@@ -572,9 +546,7 @@ Path PathFindRegion::find_path( const D3DXVECTOR2 & A, const D3DXVECTOR2 & B )
                     D3DXVECTOR2 point(vb_tmpx, vb_tmp.y);
                     if (is_local_point_inside(point))
                     {
-                        D3DXVECTOR4 pt4;
-                        D3DXVec2Transform(&pt4, &point, &transformation);
-                        D3DXVECTOR2 point_transformed(pt4.x, pt4.y);
+                        D3DXVECTOR2 point_transformed = transformation.transform(point);
 
                         bool blocked = false;
                         for (int i = 0; i < block_reg_count; ++i)
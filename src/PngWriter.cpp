@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "PngWriter.h"
+#include "zlib/zlib.h"
+
+// Append 32-bit big-endian value
+static void put_dword( std::vector<BYTE> & out, DWORD value )
+{
+    out.push_back(BYTE(value >> 24));
+    out.push_back(BYTE(value >> 16));
+    out.push_back(BYTE(value >> 8));
+    out.push_back(BYTE(value));
+}
+
+// Append PNG chunk with length and checksum
+static void put_chunk( std::vector<BYTE> & out, const char * type,
+                       const BYTE * data, DWORD size )
+{
+    put_dword(out, size);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (size)
+        out.insert(out.end(), data, data + size);
+    put_dword(out, crc32(0, &out[start], uInt(out.size() - start)));
+}
+
+// Encode 32-bit image to PNG format
+void encode_png( std::vector<BYTE> & out, const DWORD * pixels,
+                 int width, int height, int pitch )
+{
+    // Converting to RGBA rows, each prefixed with filter type (none)
+    std::vector<BYTE> raw((width * 4 + 1) * height);
+    BYTE * p = &raw[0];
+    for (int y = 0; y < height; ++y)
+    {
+        const DWORD * row = pixels + y * pitch;
+        *p++ = 0;
+        for (int x = 0; x < width; ++x)
+        {
+            DWORD c = row[x];
+            *p++ = BYTE(c >> 16);
+            *p++ = BYTE(c >> 8);
+            *p++ = BYTE(c);
+            *p++ = BYTE(c >> 24);
+        }
+    }
+
+    // Compressing image data
+    uLongf packed_size = compressBound(uLong(raw.size()));
+    std::vector<BYTE> packed(packed_size);
+    if (Z_OK != compress2(&packed[0], &packed_size, &raw[0], uLong(raw.size()),
+                          Z_DEFAULT_COMPRESSION))
+        throw Exception("PNG image compression failed");
+
+    // Header: 8-bit RGBA, no interlacing
+    BYTE header[13];
+    header[0] = BYTE(width >> 24);  header[1] = BYTE(width >> 16);
+    header[2] = BYTE(width >> 8);   header[3] = BYTE(width);
+    header[4] = BYTE(height >> 24); header[5] = BYTE(height >> 16);
+    header[6] = BYTE(height >> 8);  header[7] = BYTE(height);
+    header[8] = 8;
+    header[9] = 6;
+    header[10] = header[11] = header[12] = 0;
+
+    static const BYTE signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.clear();
+    out.reserve(packed_size + 64);
+    out.insert(out.end(), signature, signature + 8);
+    put_chunk(out, "IHDR", header, sizeof(header));
+    put_chunk(out, "IDAT", &packed[0], packed_size);
+    put_chunk(out, "IEND", NULL, 0);
+}
+
+// Save 32-bit image to PNG file
+void save_png( const std::string & filename, const DWORD * pixels,
+               int width, int height, int pitch )
+{
+    std::vector<BYTE> png;
+    encode_png(png, pixels, width, height, pitch);
+
+    FILE * f = fopen(filename.c_str(), "wb");
+    if (NULL == f)
+        throw Exception("Unable to create image file " + filename);
+    fwrite(&png[0], png.size(), 1, f);
+    fclose(f);
+}
@@ -0,0 +1,135 @@
+#include "stdafx.h"
+#include "Profiler.h"
+
+// Recording enabled flag
+volatile LONG Profiler::enabled = 0;
+
+// Registry of thread ring buffers
+static struct ProfilerThreads
+{
+    // Constructor
+    ProfilerThreads() : cleared_at(0)
+    {
+        InitializeCriticalSection(&lock);
+        LARGE_INTEGER t;
+        QueryPerformanceFrequency(&t);
+        frequency = t.QuadPart;
+        QueryPerformanceCounter(&t);
+        origin = t.QuadPart;
+    }
+    // Destructor
+    ~ProfilerThreads()
+    {
+        for (size_t i = 0; i < buffers.size(); ++i)
+            delete buffers[i];
+        DeleteCriticalSection(&lock);
+    }
+
+    // Registry lock
+    CRITICAL_SECTION lock;
+    // Buffers of all threads which recorded zones
+    std::vector<Profiler::ThreadBuffer *> buffers;
+    // Performance counter frequency and profiler start time
+    LONGLONG frequency, origin;
+    // Zones finished before this time are not exported
+    LONGLONG cleared_at;
+} threads;
+
+// Ring buffer of current thread
+static __declspec(thread) Profiler::ThreadBuffer * thread_buffer;
+
+// Ring buffer constructor
+Profiler::ThreadBuffer::ThreadBuffer()
+    : thread_id(GetCurrentThreadId()), events(ring_size), count(0), full(0)
+{}
+
+// Get ring buffer of calling thread
+Profiler::ThreadBuffer & Profiler::get_buffer()
+{
+    if (NULL == thread_buffer)
+    {
+        ThreadBuffer * buffer = new ThreadBuffer;
+        EnterCriticalSection(&threads.lock);
+        threads.buffers.push_back(buffer);
+        LeaveCriticalSection(&threads.lock);
+        thread_buffer = buffer;
+    }
+    return *thread_buffer;
+}
+
+// Enable or disable recording
+void Profiler::enable( bool value )
+{
+    InterlockedExchange(&enabled, value ? 1 : 0);
+}
+
+// Record finished zone
+void Profiler::record( const char * name, LONGLONG start, LONGLONG end )
+{
+    ThreadBuffer & buffer = get_buffer();
+    DWORD index = DWORD(buffer.count);
+    Event & e = buffer.events[index & (ring_size - 1)];
+    e.name = name;
+    e.start = start;
+    e.end = end;
+
+    // Publishing event after it was written
+    if (ring_size - 1 == (index & (ring_size - 1)))
+        InterlockedExchange(&buffer.full, 1);
+    InterlockedIncrement(&buffer.count);
+}
+
+// Forget all recorded zones
+void Profiler::clear()
+{
+    EnterCriticalSection(&threads.lock);
+    threads.cleared_at = now();
+    LeaveCriticalSection(&threads.lock);
+}
+
+// Write recorded zones to Chrome trace file
+void Profiler::save_trace( const std::string & filename )
+{
+    FILE * f = fopen(filename.c_str(), "wt");
+    if (NULL == f)
+        throw Exception("Unable to create trace file " + filename);
+
+    const double us_per_tick = 1000000.0 / double(threads.frequency);
+    bool first = true;
+    std::vector<Event> events;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    EnterCriticalSection(&threads.lock);
+    for (size_t b = 0; b < threads.buffers.size(); ++b)
+    {
+        ThreadBuffer & buffer = *threads.buffers[b];
+
+        // Copying ring while owner thread may still record zones
+        DWORD count = DWORD(buffer.count);
+        DWORD n = buffer.full ? ring_size : count;
+        events.resize(n);
+        for (DWORD i = 0; i < n; ++i)
+            events[i] = buffer.events[(count - n + i) & (ring_size - 1)];
+
+        // Dropping events which could be overwritten during copying
+        DWORD skip = DWORD(buffer.count) - count;
+        if (ring_size == n)
+            skip++;
+        skip = min(skip, n);
+
+        for (DWORD i = skip; i < n; ++i)
+        {
+            const Event & e = events[i];
+            if (e.end < threads.cleared_at)
+                continue;
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                       "\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",", e.name, buffer.thread_id,
+                    double(e.start - threads.origin) * us_per_tick,
+                    double(e.end - e.start) * us_per_tick);
+            first = false;
+        }
+    }
+    LeaveCriticalSection(&threads.lock);
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
@@ -4,6 +4,7 @@
 #include "Application.h"
 #include "GameObject.h"
 #include "Helpers.h"
+#include "Profiler.h"
 #include <windows.h>
 #include <d3dx9.h>
 
@@ -133,6 +134,117 @@ inline void save_screenshot( char * filename, int width, int height )
     d3d->save_screenshot(filename, width, height);
 }
 
+// Wait until requested screenshots are written
+inline void wait_screenshots()
+{
+    Direct3D d3d;
+    d3d->wait_screenshots();
+}
+
+// Get rendering statistics
+inline bp::dict render_stats()
+{
+    Direct3D d3d;
+    RenderDevice::Stats & s = d3d->render_device->stats;
+    bp::dict stats;
+    stats["frames"] = s.frames;
+    stats["draw_calls"] = s.draw_calls;
+    stats["primitives"] = s.primitives;
+    stats["texture_changes"] = s.texture_changes;
+    stats["texture_uploads"] = s.texture_uploads;
+    
+    // Render queue reordering report
+    SequenceManager sm;
+    stats["reordered_sprites"] = sm->reorder_stats.sprites;
+    stats["batches_before_reorder"] = sm->reorder_stats.batches_before;
+    stats["batches_after_reorder"] = sm->reorder_stats.batches_after;
+    
+    // View culling report
+    stats["sequences_submitted"] = sm->cull_stats.submitted;
+    stats["sequences_drawn"] = sm->cull_stats.drawn;
+    return stats;
+}
+
+// Reset rendering statistics
+inline void reset_render_stats()
+{
+    Direct3D d3d;
+    d3d->render_device->stats = RenderDevice::Stats();
+    SequenceManager sm;
+    sm->reorder_stats = Direct3DInstance::SequenceManagerInstance::ReorderStats();
+    sm->cull_stats = Direct3DInstance::SequenceManagerInstance::CullStats();
+}
+
+// Find drawn sequences under point, topmost first
+inline bp::list pick_sequences( const D3DXVECTOR2 & p )
+{
+    SequenceManager sm;
+    std::vector<SequenceID> found;
+    sm->pick(p, found);
+    bp::list result;
+    for (size_t i = 0; i < found.size(); ++i)
+        result.append(found[i]);
+    return result;
+}
+
+// Find drawn sequences intersecting rectangle, topmost first
+inline bp::list query_sequences( const D3DXVECTOR2 & p1, const D3DXVECTOR2 & p2 )
+{
+    Direct3DInstance::SequenceManagerInstance::Bounds rect =
+        {min(p1.x, p2.x), min(p1.y, p2.y), max(p1.x, p2.x), max(p1.y, p2.y)};
+    SequenceManager sm;
+    std::vector<SequenceID> found;
+    sm->query(rect, found);
+    bp::list result;
+    for (size_t i = 0; i < found.size(); ++i)
+        result.append(found[i]);
+    return result;
+}
+
+// Get frame pacing statistics (durations in milliseconds)
+inline bp::dict frame_stats()
+{
+    FrameClock & clock = ApplicationInstance::frame_clock;
+    bp::dict stats;
+    stats["frames"] = clock.get_frame_count();
+    stats["mean"] = clock.get_mean() * 1000;
+    stats["p50"] = clock.get_percentile(50) * 1000;
+    stats["p95"] = clock.get_percentile(95) * 1000;
+    stats["p99"] = clock.get_percentile(99) * 1000;
+    stats["max"] = clock.get_percentile(100) * 1000;
+    return stats;
+}
+
+// Set fixed update rate (0 for variable time step)
+inline void set_fixed_update_rate( int rate )
+{
+    ApplicationInstance::frame_clock.set_fixed_step(rate > 0 ? 1.0 / rate : 0);
+}
+
+// Get fraction of fixed step not simulated yet (for interpolation)
+inline float get_frame_alpha()
+{
+    return float(ApplicationInstance::frame_clock.get_alpha());
+}
+
+// Forget recorded frame durations
+inline void reset_frame_stats()
+{
+    ApplicationInstance::frame_clock.clear_stats();
+}
+
+// Enable or disable profiler
+inline void profiler_enable( bool enable )
+{
+    Profiler::enable(enable);
+}
+
+// Save recorded profiler zones as Chrome trace
+inline void profiler_save_trace( char * filename )
+{
+    Profiler::save_trace(filename);
+}
+
 // Module definitions for engine python interface
 BOOST_PYTHON_MODULE(Tanita2)
 {
@@ -145,6 +257,18 @@ BOOST_PYTHON_MODULE(Tanita2)
     
     def("quit_game", quit_game);
     def("save_screenshot", save_screenshot);
+    def("wait_screenshots", wait_screenshots);
+    def("render_stats", render_stats);
+    def("reset_render_stats", reset_render_stats);
+    def("pick", pick_sequences);
+    def("query", query_sequences);
+    def("frame_stats", frame_stats);
+    def("reset_frame_stats", reset_frame_stats);
+    def("set_fixed_update_rate", set_fixed_update_rate);
+    def("get_frame_alpha", get_frame_alpha);
+    def("profiler_enable", profiler_enable);
+    def("profiler_clear", Profiler::clear);
+    def("profiler_save_trace", profiler_save_trace);
     def("set_sound_volume", set_sound_volume);
     def("set_music_volume", set_music_volume);
     
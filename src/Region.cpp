@@ -43,11 +43,8 @@ void PointContainer::OutlineSequence::render()
 {
     if (cached_points.size() == 0) return;
     
-    Direct3D d3d;
-    D3DXMATRIX tr = transformation * d3d->get_projection_matrix();
-    d3d->line_drawer->SetWidth(1);
-    d3d->line_drawer->DrawTransform(&cached_points[0], cached_points.size(),
-                                    &tr, color);
+    SequenceManager sm;
+    sm->add_debug_lines(&cached_points[0], cached_points.size(), transformation, color);
 }
 
 #define UPDATE_POINTS {on_points_change(); seq->rebuild_cache();}
@@ -155,9 +152,7 @@ Region::Region()
 // Check if object is inside region
 bool Region::is_inside( const GameObject & obj )
 {
-    D3DXVECTOR4 v_tmp;
-    D3DXVec2Transform(&v_tmp, &obj.get_absolute_position(), &transformation_inv);
-    return is_local_point_inside(D3DXVECTOR2(v_tmp.x, v_tmp.y));
+    return is_local_point_inside(get_transformation_inv().transform(obj.get_absolute_position()));
 }
 
 // Updating region
@@ -188,7 +183,5 @@ bool Region::is_local_point_inside( const D3DXVECTOR2 & v )
 // Check if point (in absolute coordinates) inside region
 bool Region::is_point_inside( const D3DXVECTOR2 & p )
 {
-    D3DXVECTOR4 v_tmp;
-    D3DXVec2Transform(&v_tmp, &p, &transformation_inv);
-    return is_local_point_inside(D3DXVECTOR2(v_tmp.x, v_tmp.y));
+    return is_local_point_inside(get_transformation_inv().transform(p));
 }
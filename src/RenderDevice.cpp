@@ -0,0 +1,24 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+#include "GlyphAtlas.h"
+
+// Get glyph atlas of text font
+const GlyphAtlas & RenderDevice::get_glyph_atlas()
+{
+    static GlyphAtlas atlas("Courier", 15);
+    return atlas;
+}
+
+// Lay out text to glyph quads
+void RenderDevice::draw_text( const std::string & text, int x, int y, D3DCOLOR color )
+{
+    get_glyph_atlas().layout(text, x, y, color, text_vertices);
+}
+
+// Draw and forget laid out text
+void RenderDevice::flush_text()
+{
+    if (text_vertices.empty()) return;
+    draw_text_quads(get_glyph_atlas(), text_vertices);
+    text_vertices.clear();
+}
@@ -1,7 +1,11 @@
 #include "stdafx.h"
 #include "SequenceManager.h"
 #include "Log.h"
+#include "Config.h"
+#include "Profiler.h"
 #include <d3dx9.h>
+#include <algorithm>
+#include <functional>
 
 #define D3D_SM Direct3DInstance::SequenceManagerInstance
 #define D3D_SMBASE Direct3DInstance::SequenceManagerInstanceBase
@@ -18,24 +22,37 @@ void D3D_SMBASE::SequenceBase::update_transformation_matrix()
 {
     const bool hflip = (flags & horizontal_flip),
                vflip = (flags & vertical_flip);
-    D3DXMATRIX local_transform;
     
-    // Flip handling
-    if (vflip || hflip)
+    // Flip handling: mirror and shift by bounding box size
+    Affine2 local_transform(hflip ? -1.0f : 1.0f, 0, 0, vflip ? -1.0f : 1.0f,
+                            position.x + (hflip ? bounding_box.x : 0.0f),
+                            position.y + (vflip ? bounding_box.y : 0.0f));
+    
+    Direct3D d3d;
+    transformation = local_transform * d3d->get_transform();
+}
+
+// Check if transformed bounding box intersects visible area
+bool D3D_SMBASE::SequenceBase::is_visible() const
+{
+    if (0 == bounding_box.x || 0 == bounding_box.y)
+        return true;
+    
+    // Bounds of transformed box
+    float left = 0, top = 0, right = 0, bottom = 0;
+    for (int c = 0; c < 4; ++c)
     {
-        D3DXMATRIX flip_matrix;
-        
-        D3DXMatrixTranslation(&local_transform, position.x + (hflip ? bounding_box.x : 0.0f),
-                                                position.y + (vflip ? bounding_box.y : 0.0f), 0.0f);
-        D3DXMatrixScaling(&flip_matrix, hflip ? -1.0f : 1.0f, vflip ? -1.0f : 1.0f, 1.0f);
-        local_transform = flip_matrix * local_transform;
+        D3DXVECTOR2 t = transformation.transform((c & 1) ? float(bounding_box.x) : 0.0f,
+                                                 (c & 2) ? float(bounding_box.y) : 0.0f);
+        if (0 == c || t.x < left)   left = t.x;
+        if (0 == c || t.x > right)  right = t.x;
+        if (0 == c || t.y < top)    top = t.y;
+        if (0 == c || t.y > bottom) bottom = t.y;
     }
-    else
-        D3DXMatrixTranslation(&local_transform, position.x, position.y, 0.0f);
     
     Direct3D d3d;
-    transformation = d3d->get_transform();
-    transformation = local_transform * transformation;
+    D3DXVECTOR2 view = d3d->get_view_size();
+    return left < view.x && right > 0 && top < view.y && bottom > 0;
 }
 
 // Constructor
@@ -50,21 +67,23 @@ D3D_SMBASE::SequenceID::SequenceID( ID id )
 void D3D_SMBASE::SequenceID::render( float dt )
 {
     SequenceManager sm;
-    if (s->on_adding_to_queue(dt))
-		sm->add_to_render_queue(*this);
+    // Animation is updated even if sequence is not visible
+    if (!s->on_adding_to_queue(dt))
+        return;
+    
+    sm->cull_stats.submitted++;
+    if (sm->cull_queue && !s->is_visible())
+        return;
+    sm->cull_stats.drawn++;
+    sm->add_to_render_queue(*this);
 }
 
 // Check if point lays inside sequence bounding box
 bool D3D_SMBASE::SequenceID::is_inside( const D3DXVECTOR2 & p )
 {
-    Direct3D d3d;
-    D3DXMATRIX m = s->transformation;
-    
-    D3DXVECTOR2 one(0, 0), two(float(s->bounding_box.x),
-                               float(s->bounding_box.y));
-    D3DXVECTOR4 v1, v2;
-    D3DXVec2Transform(&v1, &one, &m);
-    D3DXVec2Transform(&v2, &two, &m);
+    D3DXVECTOR2 v1 = s->transformation.transform(0, 0),
+                v2 = s->transformation.transform(float(s->bounding_box.x),
+                                                 float(s->bounding_box.y));
 
 #define SWAP(a, b) { float tmp = a; a = b; b = tmp; }
     if (v1.x > v2.x) SWAP(v1.x, v2.x);
@@ -83,6 +102,9 @@ void D3D_SMBASE::SequenceID::create_bindings()
     class_<SequenceID>("Sequence")
         .def("render",                    &SequenceID::render)
         .def("is_inside",                 &SequenceID::is_inside)
+        .def(self == self)
+        .def(self != self)
+        .add_property("id",               &SequenceID::get_id)
         .add_property("position",         &SequenceID::get_position, &SequenceID::set_position)
         .add_property("bounding_box",     &SequenceID::get_bounding_box)
         .add_property("fps",              &SequenceID::get_fps, &SequenceID::set_fps)
@@ -104,13 +126,556 @@ void D3D_SMBASE::SequenceID::create_bindings()
         ;
 }
 
+// Animation sequence manager initialization
+D3D_SM::SequenceManagerInstance()
+    : batch_texture(NULL), debug_point_size(1), drawn_valid(false), pick_mark(0),
+      pick_cell_size(1, 1), reorder_queue(false), cull_queue(true)
+{
+    Config config;
+    try { reorder_queue = config->get<bool>("reorder_render_queue"); }
+    catch (...) {}
+    try { cull_queue = config->get<bool>("view_culling"); }
+    catch (...) {}
+}
+
 // Sequence rendering
 void D3D_SM::draw_queue()
 {
+    PROFILE_ZONE("draw_queue");
+    if (reorder_queue)
+        sort_queue();
+    build_pick_index();
+    
+    SequenceBase::Sprite sprite;
     for (int i = 0; queue_end != i; ++i)
-        queue[i].s->render();
+    {
+        SequenceBase * s = queue[i].s;
+        if (s->get_sprite(sprite))
+            add_to_batch(*s, sprite);
+        else
+        {
+            // Painter's order: batched sprites are drawn first
+            flush_batch();
+            s->render();
+        }
+    }
+    flush_batch();
+    // Region and path overlays are drawn over scene
+    flush_debug_geometry();
 }
 
+// Add sprite to current batch
+void D3D_SM::add_to_batch( SequenceBase & s, const SequenceBase::Sprite & sprite )
+{
+    if (sprite.texture != batch_texture)
+    {
+        flush_batch();
+        batch_texture = sprite.texture;
+    }
+    
+    // Transforming sprite corners on CPU
+    const Affine2 & m = s.transformation;
+    float w = float(sprite.width), h = float(sprite.height);
+    TexturedVertex corners[4] =
+    {
+        TexturedVertex(0, 0, 0.0f, 0.0f),
+        TexturedVertex(w, 0, 1.0f, 0.0f),
+        TexturedVertex(0, h, 0.0f, 1.0f),
+        TexturedVertex(w, h, 1.0f, 1.0f),
+    };
+    for (int i = 0; i < 4; ++i)
+    {
+        TexturedVertex & v = corners[i];
+        D3DXVECTOR2 t = m.transform(v.x, v.y);
+        v.x = t.x;
+        v.y = t.y;
+    }
+    
+    // Two triangles with same winding as sprite strip
+    static const int indices[6] = {0, 1, 2, 2, 1, 3};
+    for (int i = 0; i < 6; ++i)
+        batch_vertices.push_back(corners[indices[i]]);
+}
+
+// Draw sprites of current batch
+void D3D_SM::flush_batch()
+{
+    if (batch_vertices.empty()) return;
+    
+    Direct3D d3d;
+    VertexManager vm;
+    TRY(batch_texture->bind());
+    d3d->render_device->set_world_transform(Affine2::identity().to_matrix());
+    
+    // Splitting batch larger than dynamic buffer
+    const UINT max_count = VertexManagerInstance::dynamic_buffer_size -
+                           VertexManagerInstance::dynamic_buffer_size % 6;
+    for (UINT start = 0; start < batch_vertices.size(); start += max_count)
+    {
+        UINT count = min(max_count, (UINT)batch_vertices.size() - start);
+        UINT offset = vm->write_dynamic(&batch_vertices[start], count);
+        d3d->render_device->draw_triangles(vm->get_dynamic_buffer(), offset, count / 3);
+    }
+    
+    batch_vertices.clear();
+    batch_texture = NULL;
+}
+
+// Add line strip to debug geometry
+void D3D_SM::add_debug_lines( const D3DXVECTOR3 * points, UINT count,
+                              const Affine2 & transform, D3DCOLOR color )
+{
+    if (count < 2) return;
+    D3DXVECTOR2 a = transform.transform(points[0].x, points[0].y);
+    for (UINT i = 1; i < count; ++i)
+    {
+        D3DXVECTOR2 b = transform.transform(points[i].x, points[i].y);
+        debug_lines.push_back(ColoredVertex(a.x, a.y, color));
+        debug_lines.push_back(ColoredVertex(b.x, b.y, color));
+        a = b;
+    }
+}
+
+// Add points to debug geometry
+void D3D_SM::add_debug_points( const ColoredVertex * points, UINT count,
+                               const Affine2 & transform, float size )
+{
+    // Points of different size are drawn by separate call
+    if (size != debug_point_size && !debug_points.empty())
+        flush_debug_geometry();
+    debug_point_size = size;
+    
+    for (UINT i = 0; i < count; ++i)
+    {
+        D3DXVECTOR2 t = transform.transform(points[i].x, points[i].y);
+        debug_points.push_back(ColoredVertex(t.x, t.y, points[i].color));
+    }
+}
+
+// Draw accumulated debug geometry
+void D3D_SM::flush_debug_geometry()
+{
+    if (debug_lines.empty() && debug_points.empty()) return;
+    
+    Direct3D d3d;
+    d3d->render_device->set_world_transform(Affine2::identity().to_matrix());
+    if (!debug_lines.empty())
+        d3d->render_device->draw_line_list(&debug_lines[0], UINT(debug_lines.size() / 2));
+    if (!debug_points.empty())
+        d3d->render_device->draw_points(&debug_points[0], UINT(debug_points.size()),
+                                        debug_point_size);
+    
+    debug_lines.clear();
+    debug_points.clear();
+}
+
+// Reorder render queue keeping overlapping sprites in submission order
+void D3D_SM::sort_queue()
+{
+    // Other sequences keep their places, sprites are reordered between them
+    SequenceBase::Sprite sprite;
+    int begin = 0;
+    for (int i = 0; queue_end != i; ++i)
+        if (!queue[i].s->get_sprite(sprite))
+        {
+            sort_sprites(begin, i);
+            begin = i + 1;
+        }
+    sort_sprites(begin, queue_end);
+}
+
+// Count texture changes in sequence of sprites
+template<class Iter>
+static DWORD count_batches( Iter begin, Iter end )
+{
+    DWORD batches = 0;
+    Direct3DInstance::TextureManagerInstance::TextureInstance * texture = NULL;
+    for (Iter i = begin; end != i; ++i)
+        if (i->texture != texture)
+        {
+            texture = i->texture;
+            batches++;
+        }
+    return batches;
+}
+
+// Reorder sequence of sprites not separated by other sequences
+void D3D_SM::sort_sprites( int begin, int end )
+{
+    const int n = end - begin;
+    if (n <= 0) return;
+    
+    // Calculating sprite bounds
+    sort_sprites_info.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        SequenceBase * s = queue[begin + i].s;
+        SequenceBase::Sprite sprite;
+        s->get_sprite(sprite);
+        
+        QueuedSprite & q = sort_sprites_info[i];
+        q.texture = sprite.texture;
+        for (int c = 0; c < 4; ++c)
+        {
+            D3DXVECTOR2 t = s->transformation.transform((c & 1) ? float(sprite.width) : 0.0f,
+                                                        (c & 2) ? float(sprite.height) : 0.0f);
+            if (0 == c || t.x < q.left)   q.left = t.x;
+            if (0 == c || t.x > q.right)  q.right = t.x;
+            if (0 == c || t.y < q.top)    q.top = t.y;
+            if (0 == c || t.y > q.bottom) q.bottom = t.y;
+        }
+    }
+    reorder_stats.sprites += n;
+    DWORD batches = count_batches(sort_sprites_info.begin(), sort_sprites_info.end());
+    reorder_stats.batches_before += batches;
+    if (n < 3 || batches <= 1)
+    {
+        reorder_stats.batches_after += batches;
+        return;
+    }
+    
+    // Later sprite overlapping earlier one must be drawn after it. Sprites are
+    // swept in order of left edge, only sprites not ended by then are tested
+    sort_blockers.assign(n, 0);
+    sort_overlaps.clear();
+    sort_order.resize(n);
+    for (int i = 0; i < n; ++i)
+        sort_order[i] = std::make_pair(sort_sprites_info[i].left, i);
+    std::sort(sort_order.begin(), sort_order.end());
+    sort_active.clear();
+    for (int k = 0; k < n; ++k)
+    {
+        const int j = sort_order[k].second;
+        const QueuedSprite & b = sort_sprites_info[j];
+        size_t kept = 0;
+        for (size_t m = 0; m < sort_active.size(); ++m)
+        {
+            const int i = sort_active[m];
+            const QueuedSprite & a = sort_sprites_info[i];
+            if (a.right <= b.left) continue;
+            sort_active[kept++] = i;
+            if (a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom)
+            {
+                sort_overlaps.push_back(std::make_pair(min(i, j), max(i, j)));
+                sort_blockers[max(i, j)]++;
+            }
+        }
+        sort_active.resize(kept);
+        sort_active.push_back(j);
+    }
+    std::sort(sort_overlaps.begin(), sort_overlaps.end());
+    
+    // Ready sprites are kept in min-heaps by queue position: one for each
+    // texture and one for all of them (emitted sprites are skipped there)
+    sort_textures.resize(n);
+    for (int i = 0; i < n; ++i)
+        sort_textures[i] = sort_sprites_info[i].texture;
+    std::sort(sort_textures.begin(), sort_textures.end());
+    sort_textures.erase(std::unique(sort_textures.begin(), sort_textures.end()),
+                        sort_textures.end());
+    sort_texture_index.resize(n);
+    for (int i = 0; i < n; ++i)
+        sort_texture_index[i] = int(std::lower_bound(sort_textures.begin(), sort_textures.end(),
+                                    sort_sprites_info[i].texture) - sort_textures.begin());
+    if (sort_texture_ready.size() < sort_textures.size())
+        sort_texture_ready.resize(sort_textures.size());
+    for (size_t t = 0; t < sort_textures.size(); ++t)
+        sort_texture_ready[t].clear();
+    
+    // Indices are pushed in increasing order, so vectors are valid heaps
+    sort_ready.clear();
+    for (int i = 0; i < n; ++i)
+        if (0 == sort_blockers[i])
+        {
+            sort_ready.push_back(i);
+            sort_texture_ready[sort_texture_index[i]].push_back(i);
+        }
+    
+    // Emitting sprites, preferring texture of previous one
+    sort_result.clear();
+    std::vector<Direct3DInstance::TextureManagerInstance::TextureInstance *>::iterator
+        first = std::lower_bound(sort_textures.begin(), sort_textures.end(),
+                                 (Direct3DInstance::TextureManagerInstance::TextureInstance *)NULL);
+    int texture = (sort_textures.end() != first && NULL == *first) ? 0 : -1;
+    std::greater<int> later;
+    while (!sort_ready.empty())
+    {
+        int i;
+        if (-1 != texture && !sort_texture_ready[texture].empty())
+        {
+            std::vector<int> & ready = sort_texture_ready[texture];
+            i = ready.front();
+            std::pop_heap(ready.begin(), ready.end(), later);
+            ready.pop_back();
+        }
+        else
+        {
+            // Earliest ready sprite of any texture is also earliest of its texture
+            for (;;)
+            {
+                i = sort_ready.front();
+                std::pop_heap(sort_ready.begin(), sort_ready.end(), later);
+                sort_ready.pop_back();
+                if (-1 != sort_blockers[i]) break;
+            }
+            texture = sort_texture_index[i];
+            std::vector<int> & ready = sort_texture_ready[texture];
+            ASSERT(ready.front() == i);
+            std::pop_heap(ready.begin(), ready.end(), later);
+            ready.pop_back();
+            reorder_stats.batches_after++;
+        }
+        sort_blockers[i] = -1;
+        sort_result.push_back(queue[begin + i]);
+        
+        // Releasing sprites drawn over emitted one
+        std::vector<std::pair<int, int> >::iterator e =
+            std::lower_bound(sort_overlaps.begin(), sort_overlaps.end(), std::make_pair(i, 0));
+        for (; sort_overlaps.end() != e && e->first == i; ++e)
+            if (0 == --sort_blockers[e->second])
+            {
+                const int j = e->second;
+                sort_ready.push_back(j);
+                std::push_heap(sort_ready.begin(), sort_ready.end(), later);
+                std::vector<int> & ready = sort_texture_ready[sort_texture_index[j]];
+                ready.push_back(j);
+                std::push_heap(ready.begin(), ready.end(), later);
+            }
+        
+        // Emitted sprites left in heap of all ready sprites are dropped
+        while (!sort_ready.empty() && -1 == sort_blockers[sort_ready.front()])
+        {
+            std::pop_heap(sort_ready.begin(), sort_ready.end(), later);
+            sort_ready.pop_back();
+        }
+    }
+    ASSERT(n == (int)sort_result.size());
+    std::copy(sort_result.begin(), sort_result.end(), queue.begin() + begin);
+}
+
+// Bounds of area covered by sequences without bounding box
+static const float UNBOUNDED = 1e30f;
+
+// Compare render queue with queue of previously drawn frame
+bool D3D_SM::update_drawn_queue( Bounds & dirty )
+{
+    current_queue.resize(queue_end);
+    for (int i = 0; queue_end != i; ++i)
+    {
+        SequenceBase * s = queue[i].s;
+        DrawnSequence & d = current_queue[i];
+        d.id = queue[i].id;
+        d.transformation = s->transformation;
+        d.bounding_box = s->bounding_box;
+        d.frame = s->current_frame_number;
+        d.flags = s->flags;
+        d.content = s->get_content_hash();
+        
+        // Texture may be reloaded with another resolution level in background
+        TextureRef texture = s->get_texture();
+        d.texture = texture ? texture->revision : 0;
+    }
+    
+    // Pixel may change only under sequence which has moved in queue or changed
+    // its state, in either of frames
+    dirty.left = dirty.top = dirty.right = dirty.bottom = 0;
+    bool changed = !drawn_valid;
+    if (!drawn_valid)
+    {
+        dirty.left = dirty.top = -UNBOUNDED;
+        dirty.right = dirty.bottom = UNBOUNDED;
+    }
+    else
+    {
+        const size_t n = max(drawn_queue.size(), current_queue.size());
+        for (size_t i = 0; i < n; ++i)
+        {
+            const bool drawn = i < drawn_queue.size(), current = i < current_queue.size();
+            if (drawn && current)
+            {
+                const DrawnSequence & a = drawn_queue[i], & b = current_queue[i];
+                if (a.id == b.id && a.frame == b.frame && a.flags == b.flags &&
+                    a.content == b.content && a.texture == b.texture &&
+                    a.bounding_box == b.bounding_box &&
+                    0 == memcmp(&a.transformation, &b.transformation, sizeof(Affine2)))
+                    continue;
+            }
+            if (drawn)
+                add_drawn_bounds(drawn_queue[i], dirty);
+            if (current)
+                add_drawn_bounds(current_queue[i], dirty);
+            changed = true;
+        }
+    }
+    
+    drawn_queue.swap(current_queue);
+    drawn_valid = true;
+    return changed;
+}
+
+// Add transformed bounding box of sequence to rectangle
+void D3D_SM::add_drawn_bounds( const DrawnSequence & d, Bounds & dirty )
+{
+    // Sequences without bounding box may draw anywhere
+    Bounds b = {-UNBOUNDED, -UNBOUNDED, UNBOUNDED, UNBOUNDED};
+    if (0 != d.bounding_box.x && 0 != d.bounding_box.y)
+        for (int c = 0; c < 4; ++c)
+        {
+            D3DXVECTOR2 t = d.transformation.transform((c & 1) ? d.bounding_box.x : 0.0f,
+                                                       (c & 2) ? d.bounding_box.y : 0.0f);
+            if (0 == c || t.x < b.left)   b.left = t.x;
+            if (0 == c || t.x > b.right)  b.right = t.x;
+            if (0 == c || t.y < b.top)    b.top = t.y;
+            if (0 == c || t.y > b.bottom) b.bottom = t.y;
+        }
+    
+    if (dirty.left >= dirty.right || dirty.top >= dirty.bottom)
+        dirty = b;
+    else
+    {
+        dirty.left = min(dirty.left, b.left);
+        dirty.top = min(dirty.top, b.top);
+        dirty.right = max(dirty.right, b.right);
+        dirty.bottom = max(dirty.bottom, b.bottom);
+    }
+}
+
+// Picking grid cells per side of visible area
+static const int PICK_GRID = 16;
+
+// Build picking index from render queue
+void D3D_SM::build_pick_index()
+{
+    // Sequences with empty bounding box can't be picked
+    pick_entries.clear();
+    for (int i = 0; queue_end != i; ++i)
+    {
+        SequenceBase * s = queue[i].s;
+        if (0 == s->bounding_box.x || 0 == s->bounding_box.y)
+            continue;
+        
+        PickEntry e;
+        e.sequence = queue[i];
+        e.inverse = s->transformation.inverse();
+        e.bounding_box = s->bounding_box;
+        for (int c = 0; c < 4; ++c)
+        {
+            D3DXVECTOR2 t = s->transformation.transform((c & 1) ? s->bounding_box.x : 0.0f,
+                                                        (c & 2) ? s->bounding_box.y : 0.0f);
+            if (0 == c || t.x < e.bounds.left)   e.bounds.left = t.x;
+            if (0 == c || t.x > e.bounds.right)  e.bounds.right = t.x;
+            if (0 == c || t.y < e.bounds.top)    e.bounds.top = t.y;
+            if (0 == c || t.y > e.bounds.bottom) e.bounds.bottom = t.y;
+        }
+        pick_entries.push_back(e);
+    }
+    pick_marks.assign(pick_entries.size(), pick_mark);
+    
+    // Grid covers visible area, outer cells also hold entries beyond it
+    Direct3D d3d;
+    D3DXVECTOR2 view = d3d->get_view_size();
+    pick_cell_size = D3DXVECTOR2(view.x / PICK_GRID, view.y / PICK_GRID);
+    
+    // Counting entries of each cell, then placing them
+    pick_cell_start.assign(PICK_GRID * PICK_GRID + 1, 0);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (UINT i = 0; i < pick_entries.size(); ++i)
+        {
+            int x0, y0, x1, y1;
+            get_pick_cells(pick_entries[i].bounds, x0, y0, x1, y1);
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                    if (0 == pass)
+                        pick_cell_start[y * PICK_GRID + x + 1]++;
+                    else
+                        pick_cells[pick_cell_start[y * PICK_GRID + x]++] = i;
+        }
+        if (0 == pass)
+        {
+            for (int c = 0; c < PICK_GRID * PICK_GRID; ++c)
+                pick_cell_start[c + 1] += pick_cell_start[c];
+            pick_cells.resize(pick_cell_start.back());
+        }
+    }
+    // Placing has moved cell starts to next cells
+    for (int c = PICK_GRID * PICK_GRID; c > 0; --c)
+        pick_cell_start[c] = pick_cell_start[c - 1];
+    pick_cell_start[0] = 0;
+}
+
+// Get range of picking grid cells covered by rectangle
+void D3D_SM::get_pick_cells( const Bounds & rect, int & x0, int & y0, int & x1, int & y1 ) const
+{
+    x0 = int(max(0.0f, min(float(PICK_GRID - 1), floorf(rect.left / pick_cell_size.x))));
+    y0 = int(max(0.0f, min(float(PICK_GRID - 1), floorf(rect.top / pick_cell_size.y))));
+    x1 = int(max(0.0f, min(float(PICK_GRID - 1), floorf(rect.right / pick_cell_size.x))));
+    y1 = int(max(0.0f, min(float(PICK_GRID - 1), floorf(rect.bottom / pick_cell_size.y))));
+}
+
+// Find sequences of previously drawn frame containing point
+void D3D_SM::pick( const D3DXVECTOR2 & p, std::vector<SequenceID> & result )
+{
+    result.clear();
+    if (pick_entries.empty()) return;
+    
+    Bounds point = {p.x, p.y, p.x, p.y};
+    int x, y, x1, y1;
+    get_pick_cells(point, x, y, x1, y1);
+    const int cell = y * PICK_GRID + x;
+    
+    // Entries of cell are in drawing order, so topmost is the last
+    for (UINT k = pick_cell_start[cell + 1]; k > pick_cell_start[cell]; --k)
+    {
+        const PickEntry & e = pick_entries[pick_cells[k - 1]];
+        D3DXVECTOR2 t = e.inverse.transform(p);
+        if (t.x > 0 && t.x < e.bounding_box.x && t.y > 0 && t.y < e.bounding_box.y &&
+            NULL != find(e.sequence.id))
+            result.push_back(e.sequence);
+    }
+}
+
+// Find sequences of previously drawn frame with bounds intersecting rectangle
+void D3D_SM::query( const Bounds & rect, std::vector<SequenceID> & result )
+{
+    result.clear();
+    if (pick_entries.empty()) return;
+    
+    // Entries overlapping several cells are reported once
+    if (0 == ++pick_mark)
+    {
+        pick_marks.assign(pick_entries.size(), 0);
+        pick_mark = 1;
+    }
+    pick_found.clear();
+    
+    int x0, y0, x1, y1;
+    get_pick_cells(rect, x0, y0, x1, y1);
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+        {
+            const int cell = y * PICK_GRID + x;
+            for (UINT k = pick_cell_start[cell]; k < pick_cell_start[cell + 1]; ++k)
+            {
+                const UINT i = pick_cells[k];
+                const Bounds & b = pick_entries[i].bounds;
+                if (pick_mark == pick_marks[i] || b.left >= rect.right || b.right <= rect.left ||
+                    b.top >= rect.bottom || b.bottom <= rect.top)
+                    continue;
+                pick_marks[i] = pick_mark;
+                pick_found.push_back(i);
+            }
+        }
+    
+    // Topmost sequences are drawn last
+    std::sort(pick_found.begin(), pick_found.end(), std::greater<UINT>());
+    for (size_t k = 0; k < pick_found.size(); ++k)
+    {
+        const SequenceID & s = pick_entries[pick_found[k]].sequence;
+        if (NULL != find(s.id))
+            result.push_back(s);
+    }
+}
 
 // Flushing rendering queue
 void D3D_SM::flush()
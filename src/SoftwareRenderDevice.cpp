@@ -0,0 +1,759 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+#include "WorkerPool.h"
+#include "PngWriter.h"
+#include "Profiler.h"
+#include "GlyphAtlas.h"
+#include <ddraw.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <math.h>
+
+typedef SoftwareRenderDevice::Surface Surface;
+typedef SoftwareRenderDevice::SurfaceRef SurfaceRef;
+
+// Height of render target part rasterized by one job
+static const int TILE_HEIGHT = 32;
+
+// SSE2 instructions are available (checked in device constructor)
+static bool use_sse2 = false;
+
+
+// Size of texture row in bytes
+static int row_size( int width, D3DFORMAT format )
+{
+    if (D3DFMT_DXT3 == format)
+        return max(1, (width + 3) / 4) * 16;
+    return width * 4;
+}
+
+// Number of texture rows (DXT rows are 4 pixels high)
+static int row_count( int height, D3DFORMAT format )
+{
+    if (D3DFMT_DXT3 == format)
+        return max(1, (height + 3) / 4);
+    return height;
+}
+
+// Expand R5G6B5 color to A8R8G8B8
+static DWORD expand_565( WORD c )
+{
+    DWORD r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+    return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+// Mix colors in proportion 2:1
+static DWORD mix_colors( DWORD a, DWORD b )
+{
+    DWORD result = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+        result |= ((2 * ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF)) / 3) << shift;
+    return result;
+}
+
+// Decode texture data to A8R8G8B8 image
+static SurfaceRef decode_image( const BYTE * data, int width, int height, D3DFORMAT format )
+{
+    boost::shared_ptr<Surface> image(new Surface(width, height));
+    if (D3DFMT_DXT3 == format)
+    {
+        int blocks_x = row_size(width, format) / 16, blocks_y = row_count(height, format);
+        for (int by = 0; by < blocks_y; ++by)
+            for (int bx = 0; bx < blocks_x; ++bx)
+            {
+                // Block: 4-bit alpha values, two R5G6B5 colors, 2-bit color indices
+                const BYTE * block = data + (by * blocks_x + bx) * 16;
+                DWORD colors[4];
+                colors[0] = expand_565(WORD(block[8] | block[9] << 8));
+                colors[1] = expand_565(WORD(block[10] | block[11] << 8));
+                colors[2] = mix_colors(colors[0], colors[1]);
+                colors[3] = mix_colors(colors[1], colors[0]);
+                DWORD indices = block[12] | block[13] << 8 | block[14] << 16 | block[15] << 24;
+
+                for (int i = 0; i < 16; ++i)
+                {
+                    int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                    if (x >= width || y >= height) continue;
+                    DWORD alpha = (block[i / 2] >> ((i & 1) * 4)) & 0xF;
+                    image->pixels[y * width + x] = (alpha * 17) << 24 |
+                                                   colors[(indices >> (2 * i)) & 3];
+                }
+            }
+    }
+    else
+        memcpy(&image->pixels[0], data, width * height * 4);
+    return image;
+}
+
+
+// Blend pixel with SRCALPHA/INVSRCALPHA factors (alpha test skips zero alpha)
+static inline DWORD blend_pixel( DWORD src, DWORD dst )
+{
+    DWORD a = src >> 24;
+    if (0 == a) return dst;
+    if (255 == a) return src;
+
+    DWORD result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        // Exact rounded division by 255 (same as SSE2 code below)
+        DWORD v = ((src >> shift) & 0xFF) * a + ((dst >> shift) & 0xFF) * (255 - a) + 128;
+        result |= ((v + (v >> 8)) >> 8) << shift;
+    }
+    return result;
+}
+
+// Blend two pixels unpacked to 16-bit channels
+static inline __m128i blend_pixels_sse2( __m128i src, __m128i dst )
+{
+    const __m128i full = _mm_set1_epi16(255), half = _mm_set1_epi16(128);
+
+    // Broadcasting alpha to all channels of each pixel
+    __m128i a = _mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(src, a),
+                              _mm_mullo_epi16(dst, _mm_sub_epi16(full, a)));
+    v = _mm_add_epi16(v, half);
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+// Blend span of pixels
+static void blend_span( DWORD * dst, const DWORD * src, int count )
+{
+    int i = 0;
+    if (use_sse2)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+            // Skipping fully transparent pixels
+            if (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(s, 24), zero)))
+                continue;
+
+            __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            __m128i lo = blend_pixels_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+            __m128i hi = blend_pixels_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+    }
+    for (; i < count; ++i)
+        dst[i] = blend_pixel(src[i], dst[i]);
+}
+
+// Multiply texel by diffuse color (MODULATE texture operation)
+static inline DWORD modulate_pixel( DWORD texel, DWORD color )
+{
+    DWORD result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        DWORD v = ((texel >> shift) & 0xFF) * ((color >> shift) & 0xFF) + 128;
+        result |= ((v + (v >> 8)) >> 8) << shift;
+    }
+    return result;
+}
+
+
+// Clamp coordinate and round it up to pixel center
+static inline int ceil_clamped( float value, int low, int high )
+{
+    if (value <= low) return low;
+    if (value >= high) return high;
+    return (int)ceil(value);
+}
+
+// Rasterize triangle to rows [top, bottom)
+static void draw_triangle( Surface & image, const SoftwareRenderDevice::Vertex * v,
+                           const Surface * texture, int top, int bottom, DWORD * span )
+{
+    // Rows with pixel centers inside triangle
+    float min_y = min(v[0].y, min(v[1].y, v[2].y)),
+          max_y = max(v[0].y, max(v[1].y, v[2].y));
+    int y0 = ceil_clamped(min_y, top, bottom), y1 = ceil_clamped(max_y, top, bottom);
+    if (y0 >= y1) return;
+
+    // Texture coordinate gradients
+    float ex1 = v[1].x - v[0].x, ey1 = v[1].y - v[0].y,
+          ex2 = v[2].x - v[0].x, ey2 = v[2].y - v[0].y;
+    float det = ex1 * ey2 - ex2 * ey1;
+    if (fabs(det) < 1e-6f) return;
+    float du1 = v[1].u - v[0].u, du2 = v[2].u - v[0].u,
+          dv1 = v[1].v - v[0].v, dv2 = v[2].v - v[0].v;
+    float du_dx = (du1 * ey2 - du2 * ey1) / det, du_dy = (du2 * ex1 - du1 * ex2) / det,
+          dv_dx = (dv1 * ey2 - dv2 * ey1) / det, dv_dy = (dv2 * ex1 - dv1 * ex2) / det;
+
+    for (int y = y0; y < y1; ++y)
+    {
+        // Finding where row crosses triangle edges (top-left fill rule)
+        float fy = float(y), left = 0, right = 0;
+        bool found = false;
+        for (int e = 0; e < 3; ++e)
+        {
+            const SoftwareRenderDevice::Vertex & a = v[e], & b = v[(e + 1) % 3];
+            if ((a.y <= fy && fy < b.y) || (b.y <= fy && fy < a.y))
+            {
+                float x = a.x + (fy - a.y) * (b.x - a.x) / (b.y - a.y);
+                if (!found) left = right = x;
+                else { left = min(left, x); right = max(right, x); }
+                found = true;
+            }
+        }
+        int x0 = ceil_clamped(left, 0, image.width), x1 = ceil_clamped(right, 0, image.width);
+        if (!found || x0 >= x1) continue;
+
+        int count = x1 - x0;
+        if (texture)
+        {
+            // Point sampling with clamp addressing
+            float u0 = v[0].u + du_dx * (x0 - v[0].x) + du_dy * (fy - v[0].y),
+                  v0 = v[0].v + dv_dx * (x0 - v[0].x) + dv_dy * (fy - v[0].y);
+            int tw = texture->width, th = texture->height;
+            for (int i = 0; i < count; ++i)
+            {
+                float u = u0 + du_dx * i, w = v0 + dv_dx * i;
+                int tx = u <= 0 ? 0 : min(tw - 1, int(u * tw)),
+                    ty = w <= 0 ? 0 : min(th - 1, int(w * th));
+                span[i] = texture->pixels[ty * tw + tx];
+            }
+            if (0xFFFFFFFF != v[0].color)
+                for (int i = 0; i < count; ++i)
+                    span[i] = modulate_pixel(span[i], v[0].color);
+        }
+        else
+            std::fill(span, span + count, v[0].color);
+        blend_span(&image.pixels[y * image.width + x0], span, count);
+    }
+}
+
+// Rasterize square point to rows [top, bottom)
+static void draw_point( Surface & image, const SoftwareRenderDevice::Vertex & v, float size,
+                        int top, int bottom, DWORD * span )
+{
+    int x0 = ceil_clamped(v.x - size / 2, 0, image.width),
+        x1 = ceil_clamped(v.x + size / 2, 0, image.width),
+        y0 = ceil_clamped(v.y - size / 2, top, bottom),
+        y1 = ceil_clamped(v.y + size / 2, top, bottom);
+    if (x0 >= x1) return;
+
+    std::fill(span, span + (x1 - x0), v.color);
+    for (int y = y0; y < y1; ++y)
+        blend_span(&image.pixels[y * image.width + x0], span, x1 - x0);
+}
+
+// Rasterize one pixel wide line segment to rows [top, bottom)
+static void draw_line( Surface & image, const SoftwareRenderDevice::Vertex & a,
+                       const SoftwareRenderDevice::Vertex & b, int top, int bottom )
+{
+    // Clipping segment to pixel centers area of tile (Liang-Barsky)
+    float dx = b.x - a.x, dy = b.y - a.y, t0 = 0, t1 = 1;
+    float p[4] = {-dx, dx, -dy, dy},
+          q[4] = {a.x + 0.5f, image.width - 0.5f - a.x, a.y - (top - 0.5f), bottom - 0.5f - a.y};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (0 == p[i])
+        {
+            if (q[i] < 0) return;
+            continue;
+        }
+        float r = q[i] / p[i];
+        if (p[i] < 0) { if (r > t1) return; t0 = max(t0, r); }
+        else          { if (r < t0) return; t1 = min(t1, r); }
+    }
+
+    // Stepping along major axis
+    float x = a.x + t0 * dx, y = a.y + t0 * dy,
+          length = (t1 - t0) * max(fabs(dx), fabs(dy));
+    int steps = max(1, (int)ceil(length));
+    float sx = (t1 - t0) * dx / steps, sy = (t1 - t0) * dy / steps;
+    for (int i = 0; i <= steps; ++i, x += sx, y += sy)
+    {
+        int px = (int)floor(x + 0.5f), py = (int)floor(y + 0.5f);
+        if (px < 0 || px >= image.width || py < top || py >= bottom) continue;
+        DWORD & pixel = image.pixels[py * image.width + px];
+        pixel = blend_pixel(a.color, pixel);
+    }
+}
+
+
+// Texture in system memory
+class SoftwareTexture: public RenderDevice::Texture
+{
+public:
+    // Constructor
+    inline SoftwareTexture( const SurfaceRef & image, D3DFORMAT format )
+        : RenderDevice::Texture(image->width, image->height, format), image(image)
+        { InitializeCriticalSection(&lock_image); }
+    // Destructor
+    virtual ~SoftwareTexture() { DeleteCriticalSection(&lock_image); }
+
+    // Lock texture (locked data is kept in texture format)
+    virtual BYTE * lock( int & pitch, bool discard )
+    {
+        pitch = row_size(width, format);
+        if (data.empty())
+            data.resize(pitch * row_count(height, format));
+        return &data[0];
+    }
+    // Unlock texture
+    virtual void unlock()
+    {
+        // Recorded commands keep previous image
+        SurfaceRef decoded = decode_image(&data[0], width, height, format);
+        EnterCriticalSection(&lock_image);
+        image.swap(decoded);
+        LeaveCriticalSection(&lock_image);
+    }
+
+    // Get decoded image (texture may be updated by thread other than drawing one)
+    inline SurfaceRef get_image()
+    {
+        EnterCriticalSection(&lock_image);
+        SurfaceRef result = image;
+        LeaveCriticalSection(&lock_image);
+        return result;
+    }
+
+    // Decoded image (replaced under lock)
+    SurfaceRef image;
+    CRITICAL_SECTION lock_image;
+    // Locked data
+    std::vector<BYTE> data;
+};
+
+// Vertex buffer in system memory
+class SoftwareVertexBuffer: public RenderDevice::VertexBuffer
+{
+public:
+    // Constructor
+    inline SoftwareVertexBuffer( UINT size )
+        : RenderDevice::VertexBuffer(size), vertices(size) {}
+
+    // Lock vertices
+    virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode )
+        { return &vertices[start]; }
+    // Unlock vertex buffer
+    virtual void unlock() {}
+
+    // Vertex data
+    std::vector<TexturedVertex> vertices;
+};
+
+// Render target in system memory
+class SoftwareRenderTarget: public RenderDevice::RenderTarget
+{
+public:
+    // Constructor
+    inline SoftwareRenderTarget( int width, int height )
+        : RenderDevice::RenderTarget(width, height), image(width, height) {}
+
+    // Save contents to PNG file
+    virtual void save( const std::string & filename )
+    {
+        save_png(filename, &image.pixels[0], width, height, width);
+    }
+
+    // Render target image
+    Surface image;
+};
+
+// Job rasterizing one tile of render target
+class RasterizeJob: public WorkerPoolInstance::Job
+{
+public:
+    // Constructor
+    inline RasterizeJob( const SoftwareRenderDevice * device, int top, int bottom )
+        : device(device), top(top), bottom(bottom) {}
+
+    // Rasterize tile
+    virtual void run()
+    {
+        PROFILE_ZONE("rasterize_tile");
+        device->rasterize(top, bottom);
+    }
+
+protected:
+    // Device with recorded commands
+    const SoftwareRenderDevice * device;
+    // Tile rows
+    int top, bottom;
+};
+
+
+// Constructor
+SoftwareRenderDevice::SoftwareRenderDevice( int width, int height, HWND window, UINT texture_mem )
+    : texture_mem(texture_mem), window(window), back_buffer(new Surface(width, height)),
+      current_texture(NULL)
+{
+    target = back_buffer.get();
+    use_sse2 = FALSE != IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+    D3DXMatrixIdentity(&world);
+    D3DXMatrixIdentity(&view_projection);
+    D3DXMatrixIdentity(&transform);
+}
+
+// Destructor
+SoftwareRenderDevice::~SoftwareRenderDevice()
+{
+}
+
+// End rendering
+void SoftwareRenderDevice::end_scene()
+{
+    flush_text();
+    flush();
+}
+
+// Clear current render target
+void SoftwareRenderDevice::clear( D3DCOLOR color )
+{
+    add_command(Command::CLEAR, color);
+}
+
+// Present back buffer
+bool SoftwareRenderDevice::present()
+{
+    flush();
+    stats.frames++;
+
+    // Showing frame in window
+    if (window)
+    {
+        BITMAPINFO info;
+        ZeroMemory(&info, sizeof(info));
+        info.bmiHeader.biSize = sizeof(info.bmiHeader);
+        info.bmiHeader.biWidth = back_buffer->width;
+        info.bmiHeader.biHeight = -back_buffer->height;
+        info.bmiHeader.biPlanes = 1;
+        info.bmiHeader.biBitCount = 32;
+        info.bmiHeader.biCompression = BI_RGB;
+
+        HDC dc = GetDC(window);
+        SetDIBitsToDevice(dc, 0, 0, back_buffer->width, back_buffer->height, 0, 0,
+                          0, back_buffer->height, &back_buffer->pixels[0], &info, DIB_RGB_COLORS);
+        ReleaseDC(window, dc);
+    }
+    return true;
+}
+
+// Create texture from DDS file in memory
+HRESULT SoftwareRenderDevice::create_texture( const char * dds, int size, int width, int height,
+                                              D3DFORMAT format, int skip_levels, Texture ** texture )
+{
+    if (size < 4 + (int)sizeof(DDSURFACEDESC2))
+        return D3DERR_INVALIDCALL;
+    const DDSURFACEDESC2 * desc = (const DDSURFACEDESC2 *)(dds + 4);
+    const DDPIXELFORMAT & pf = desc->ddpfPixelFormat;
+    D3DFORMAT file_format = D3DFMT_A8R8G8B8;
+    if (pf.dwFlags & DDPF_FOURCC)
+    {
+        if (MAKEFOURCC('D', 'X', 'T', '3') != pf.dwFourCC)
+            return D3DERR_INVALIDCALL;
+        file_format = D3DFMT_DXT3;
+    }
+    else if (32 != pf.dwRGBBitCount)
+        return D3DERR_INVALIDCALL;
+
+    // Skipping top mip levels
+    const BYTE * data = (const BYTE *)dds + 4 + sizeof(DDSURFACEDESC2);
+    int w = desc->dwWidth, h = desc->dwHeight;
+    for (int i = 0; i < skip_levels; ++i)
+    {
+        data += row_size(w, file_format) * row_count(h, file_format);
+        w = max(1, w / 2);
+        h = max(1, h / 2);
+    }
+    if (data + row_size(w, file_format) * row_count(h, file_format) > (const BYTE *)dds + size)
+        return D3DERR_INVALIDCALL;
+
+    stats.texture_uploads++;
+    *texture = new SoftwareTexture(decode_image(data, w, h, file_format), file_format);
+    return D3D_OK;
+}
+
+// Create empty texture
+HRESULT SoftwareRenderDevice::create_texture( int width, int height, D3DFORMAT format,
+                                              TextureUsage usage, Texture ** texture )
+{
+    stats.texture_uploads++;
+    *texture = new SoftwareTexture(SurfaceRef(new Surface(width, height)), format);
+    return D3D_OK;
+}
+
+// Bind texture
+void SoftwareRenderDevice::set_texture( Texture * texture, int sampler_index )
+{
+    if (0 != sampler_index || current_texture == texture) return;
+    current_texture = texture;
+    stats.texture_changes++;
+}
+
+// Create vertex buffer
+RenderDevice::VertexBuffer * SoftwareRenderDevice::create_vertex_buffer( UINT size, bool dynamic )
+{
+    return new SoftwareVertexBuffer(size);
+}
+
+// Record textured triangles from vertex buffer
+void SoftwareRenderDevice::add_triangles( VertexBuffer * buffer, UINT start_vertex,
+                                          UINT primitive_count, bool strip )
+{
+    const TexturedVertex * source = &static_cast<SoftwareVertexBuffer *>(buffer)->vertices[start_vertex];
+    Command & command = add_command(Command::TRIANGLES, 0xFFFFFFFF);
+    if (current_texture)
+        command.texture = static_cast<SoftwareTexture *>(current_texture)->get_image();
+
+    // Strips are converted to triangle list
+    command.vertices.reserve(primitive_count * 3);
+    for (UINT i = 0; i < primitive_count; ++i)
+        for (UINT j = 0; j < 3; ++j)
+        {
+            const TexturedVertex & v = source[strip ? i + j : i * 3 + j];
+            command.vertices.push_back(transform_vertex(v.x, v.y, v.z, v.u, v.v, 0xFFFFFFFF));
+        }
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw triangle strip from vertex buffer
+void SoftwareRenderDevice::draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    add_triangles(buffer, start_vertex, primitive_count, true);
+}
+
+// Draw triangle list from vertex buffer
+void SoftwareRenderDevice::draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    add_triangles(buffer, start_vertex, primitive_count, false);
+}
+
+// Draw untextured triangle strip (flat shaded with first vertex color)
+void SoftwareRenderDevice::draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count )
+{
+    set_texture(NULL);
+    Command & command = add_command(Command::TRIANGLES, vertices[0].color);
+    command.vertices.reserve(primitive_count * 3);
+    for (UINT i = 0; i < primitive_count; ++i)
+        for (UINT j = 0; j < 3; ++j)
+        {
+            const ColoredVertex & v = vertices[i + j];
+            command.vertices.push_back(transform_vertex(v.x, v.y, v.z, 0, 0, vertices[0].color));
+        }
+    stats.draw_calls++;
+    stats.primitives += primitive_count;
+}
+
+// Draw untextured points
+void SoftwareRenderDevice::draw_points( const ColoredVertex * vertices, UINT count, float size )
+{
+    if (0 == count) return;
+    set_texture(NULL);
+    Command & command = add_command(Command::POINTS, vertices[0].color);
+    command.point_size = size;
+    command.vertices.reserve(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        const ColoredVertex & v = vertices[i];
+        command.vertices.push_back(transform_vertex(v.x, v.y, v.z, 0, 0, v.color));
+    }
+    stats.draw_calls++;
+    stats.primitives += count;
+}
+
+// Draw line strip
+void SoftwareRenderDevice::draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color )
+{
+    if (count < 2) return;
+    Command & command = add_command(Command::LINE_STRIP, color);
+    command.vertices.reserve(count);
+    for (UINT i = 0; i < count; ++i)
+        command.vertices.push_back(transform_vertex(points[i].x, points[i].y, points[i].z, 0, 0, color));
+    stats.draw_calls++;
+    stats.primitives += count - 1;
+}
+
+// Draw line list
+void SoftwareRenderDevice::draw_line_list( const ColoredVertex * vertices, UINT line_count )
+{
+    if (0 == line_count) return;
+    Command & command = add_command(Command::LINES, vertices[0].color);
+    command.vertices.reserve(line_count * 2);
+    for (UINT i = 0; i < line_count * 2; ++i)
+    {
+        const ColoredVertex & v = vertices[i];
+        command.vertices.push_back(transform_vertex(v.x, v.y, v.z, 0, 0, v.color));
+    }
+    stats.draw_calls++;
+    stats.primitives += line_count;
+}
+
+// Record glyph quads textured with glyph atlas
+void SoftwareRenderDevice::draw_text_quads( const GlyphAtlas & atlas, std::vector<TextVertex> & vertices )
+{
+    if (!glyph_surface)
+    {
+        boost::shared_ptr<Surface> image(new Surface(atlas.width, atlas.height));
+        image->pixels = atlas.pixels;
+        glyph_surface = image;
+    }
+
+    // Texels are modulated by color of first vertex of each triangle
+    Command & command = add_command(Command::TRIANGLES, 0xFFFFFFFF);
+    command.texture = glyph_surface;
+    command.vertices.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        const TextVertex & tv = vertices[i];
+        Vertex v = {tv.x, tv.y, tv.u, tv.v, tv.color};
+        command.vertices.push_back(v);
+    }
+    stats.draw_calls++;
+    stats.primitives += UINT(vertices.size() / 3);
+}
+
+// Set world transformation matrix
+void SoftwareRenderDevice::set_world_transform( const D3DXMATRIX & world )
+{
+    this->world = world;
+    transform = world * view_projection;
+}
+
+// Set view and projection matrices
+void SoftwareRenderDevice::set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection )
+{
+    view_projection = view * projection;
+    transform = world * view_projection;
+}
+
+// Create off-screen render target
+RenderDevice::RenderTarget * SoftwareRenderDevice::create_render_target( int width, int height )
+{
+    return new SoftwareRenderTarget(width, height);
+}
+
+// Set render target for following drawing
+void SoftwareRenderDevice::set_render_target( RenderTarget * target )
+{
+    flush();
+    this->target = target ? &static_cast<SoftwareRenderTarget *>(target)->image : back_buffer.get();
+}
+
+// Copy back buffer to system memory
+void SoftwareRenderDevice::read_back_buffer( int width, int height, std::vector<DWORD> & pixels )
+{
+    flush();
+
+    // Averaging source pixels covered by each destination pixel
+    const Surface & image = *back_buffer;
+    pixels.resize(width * height);
+    for (int y = 0; y < height; ++y)
+    {
+        int y0 = y * image.height / height, y1 = max(y0 + 1, (y + 1) * image.height / height);
+        for (int x = 0; x < width; ++x)
+        {
+            int x0 = x * image.width / width, x1 = max(x0 + 1, (x + 1) * image.width / width);
+            DWORD r = 0, g = 0, b = 0, n = 0;
+            for (int sy = y0; sy < y1 && sy < image.height; ++sy)
+                for (int sx = x0; sx < x1 && sx < image.width; ++sx, ++n)
+                {
+                    DWORD c = image.pixels[sy * image.width + sx];
+                    r += (c >> 16) & 0xFF;
+                    g += (c >> 8) & 0xFF;
+                    b += c & 0xFF;
+                }
+            pixels[y * width + x] = n ? D3DCOLOR_XRGB(r / n, g / n, b / n) : 0xFF000000;
+        }
+    }
+}
+
+// Rasterize recorded commands to part of current render target
+void SoftwareRenderDevice::rasterize( int top, int bottom ) const
+{
+    Surface & image = *target;
+    if (0 == image.width) return;
+    std::vector<DWORD> span(image.width);
+
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        const Command & command = commands[i];
+        const std::vector<Vertex> & v = command.vertices;
+        switch (command.type)
+        {
+        case Command::CLEAR:
+            std::fill(image.pixels.begin() + top * image.width,
+                      image.pixels.begin() + bottom * image.width, command.color);
+            break;
+
+        case Command::TRIANGLES:
+            for (size_t j = 0; j + 2 < v.size(); j += 3)
+                draw_triangle(image, &v[j], command.texture.get(), top, bottom, &span[0]);
+            break;
+
+        case Command::POINTS:
+            for (size_t j = 0; j < v.size(); ++j)
+                draw_point(image, v[j], command.point_size, top, bottom, &span[0]);
+            break;
+
+        case Command::LINE_STRIP:
+            for (size_t j = 0; j + 1 < v.size(); ++j)
+                draw_line(image, v[j], v[j + 1], top, bottom);
+            break;
+
+        case Command::LINES:
+            for (size_t j = 0; j + 1 < v.size(); j += 2)
+                draw_line(image, v[j], v[j + 1], top, bottom);
+            break;
+        }
+    }
+}
+
+// Rasterize recorded commands to whole render target
+void SoftwareRenderDevice::flush()
+{
+    if (commands.empty()) return;
+
+    // Tiles are of fixed size, so result doesn't depend on number of threads
+    std::vector< boost::shared_ptr<RasterizeJob> > jobs;
+    for (int top = 0; top < target->height; top += TILE_HEIGHT)
+    {
+        jobs.push_back(boost::shared_ptr<RasterizeJob>(
+            new RasterizeJob(this, top, min(target->height, top + TILE_HEIGHT))));
+        worker_pool->submit(*jobs.back());
+    }
+    for (size_t i = 0; i < jobs.size(); ++i)
+        worker_pool->wait(*jobs[i]);
+
+    commands.clear();
+}
+
+// Start recording new command
+SoftwareRenderDevice::Command & SoftwareRenderDevice::add_command( Command::Type type, D3DCOLOR color )
+{
+    commands.push_back(Command());
+    Command & command = commands.back();
+    command.type = type;
+    command.color = color;
+    command.point_size = 1;
+    return command;
+}
+
+// Transform vertex to render target coordinates
+SoftwareRenderDevice::Vertex SoftwareRenderDevice::transform_vertex( float x, float y, float z,
+                                                                     float u, float v,
+                                                                     D3DCOLOR color ) const
+{
+    D3DXVECTOR4 p;
+    D3DXVECTOR3 position(x, y, z);
+    D3DXVec3Transform(&p, &position, &transform);
+    if (0 != p.w)
+        p /= p.w;
+
+    // Viewport mapping (pixel centers are at integer coordinates)
+    Vertex result;
+    result.x = (p.x + 1) * 0.5f * target->width;
+    result.y = (1 - p.y) * 0.5f * target->height;
+    result.u = u;
+    result.v = v;
+    result.color = color;
+    return result;
+}
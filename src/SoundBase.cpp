@@ -78,9 +78,7 @@ void D3D_SMBASE::SoundBase::unload()
 bool D3D_SMBASE::SoundBase::on_adding_to_queue( float dt )
 {
     Direct3D d3d;
-    D3DXMATRIX m;
-    D3DXMatrixTranslation(&m, position.x, position.y, 0.0f);
-    transformation = m * d3d->get_transform();
+    transformation = Affine2::translation(position.x, position.y) * d3d->get_transform();
     return true;
 }
 
@@ -26,14 +26,13 @@ void D3D_SM::update( DWORD dt )
     // Updating all currently playing sounds
     for (ObjectIter i = objects.begin(); objects.end() != i; ++i)
     {
-        SoundBase & s = *i->second;
+        SoundBase & s = **i;
         
         if (ApplicationInstance::active)
             s.is_over = false;
         
         // Panning and volume fading
-        D3DXVECTOR4 screen_point;
-        D3DXVec2Transform(&screen_point, &D3DXVECTOR2(0, 0), &s.transformation);
+        D3DXVECTOR2 screen_point = s.transformation.transform(0, 0);
         float dx = screen_point.x - 512,
               dy = screen_point.y - 384;
         s.set_pan(s.pan + int(dx) * 100 / 2048);
@@ -91,9 +90,9 @@ SoundID D3D_SM::load_music( PATH & path )
 
     // Checking if sound was loaded before
     for (ObjectIter i = objects.begin(); objects.end() != i; ++i)
-        if (i->second->is_static)
+        if ((*i)->is_static)
         {
-            StaticSound & s = dynamic_cast<StaticSound &>(*i->second);
+            StaticSound & s = dynamic_cast<StaticSound &>(**i);
             if (s.path == path)
             {
                 // We should duplicate this sound
@@ -134,9 +133,9 @@ SoundID D3D_SM::load( PATH & path )
 
     // Checking if sound was loaded before
     for (ObjectIter i = objects.begin(); objects.end() != i; ++i)
-        if (i->second->is_static)
+        if ((*i)->is_static)
         {
-            StaticSound & s = dynamic_cast<StaticSound &>(*i->second);
+            StaticSound & s = dynamic_cast<StaticSound &>(**i);
             if (s.path == path)
             {
                 // We should duplicate this sound
@@ -206,11 +205,9 @@ void D3D_SMBASE::SoundID::render( float dt )
 // Destructor
 D3D_SM::~SoundManagerInstance()
 {
-    for (ObjectIter i = objects.begin(); objects.end() != i;)
-    {
-        i->second->unload();
-        i = objects.erase(i);
-    }
+    for (ObjectIter i = objects.begin(); objects.end() != i; ++i)
+        (*i)->unload();
+    clear_objects();
 }
 
 #undef D3D_SM
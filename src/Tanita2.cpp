@@ -5,7 +5,12 @@
 #endif
 
 #include "Application.h"
+#include "Benchmark.h"
 #include "Python.h"
+#include "RenderDevice.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <sstream>
 
 // Application handle
 HINSTANCE hInstance;
@@ -20,6 +25,42 @@ void display_exception( const std::string & info )
                "Tanita2", MB_ICONERROR | MB_OK);
 }
 
+//! Replay render capture and report frame time statistics
+/** Command line: -render-replay capture_file [null|software] [report_file] */
+void render_replay( const std::string & args )
+{
+    std::istringstream parser(args);
+    std::string option, capture, backend = "null", report;
+    parser >> option >> capture >> backend >> report;
+
+    // Software device rasterizes tiles in worker threads
+    WorkerPool pool;
+    std::vector<double> times;
+    CaptureRenderDevice::replay(capture, backend, times);
+    if (times.empty())
+        throw Exception("Render capture " + capture + " contains no frames");
+
+    double total = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+        total += times[i];
+    std::sort(times.begin(), times.end());
+    std::string result = boost::str(boost::format(
+        "frames=%d total_ms=%.3f mean_ms=%.3f min_ms=%.3f median_ms=%.3f p95_ms=%.3f max_ms=%.3f")
+        % times.size() % total % (total / times.size()) % times.front()
+        % times[times.size() / 2] % times[times.size() * 95 / 100] % times.back());
+
+    Log log;
+    log->print("Render replay of " + capture + " on " + backend + " device: " + result);
+    if (!report.empty())
+    {
+        FILE * f = fopen(report.c_str(), "wt");
+        if (NULL == f)
+            throw Exception("Unable to create report file " + report);
+        fprintf(f, "%s\n", result.c_str());
+        fclose(f);
+    }
+}
+
 // Main function
 int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance,
                     char * cmdl, int cmdShow )
@@ -44,6 +85,19 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
     try
     {
+        // Replaying render capture instead of running game
+        if (0 == strncmp(cmdl, "-render-replay", 14))
+        {
+            render_replay(cmdl);
+            return 0;
+        }
+        // Running micro benchmarks instead of running game
+        if (0 == strncmp(cmdl, "-bench", 6))
+        {
+            Benchmark::run(cmdl);
+            return 0;
+        }
+        
         // Starting application game loop
         SINGLETON(Application) app;
         
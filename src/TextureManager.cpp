@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "TextureManager.h"
 #include "Application.h"
+#include "Profiler.h"
+#include <algorithm>
 
 #define D3D_TM Direct3DInstance::TextureManagerInstance
 
@@ -14,10 +16,14 @@ unsigned int D3D_TM::percents_to_free;
 int D3D_TM::DXT_METHOD = D3DFMT_DXT3;
 //! Height divider (for compression method)
 int D3D_TM::DXT_METHOD_height_shift = 2;
+// Maximal number of texture reloads per frame
+int D3D_TM::uploads_per_frame;
+// Lookahead time for animation frames prefetching
+int D3D_TM::prefetch_time;
 
 // Constructor
 D3D_TM::TextureInstance::TextureInstance( PATH & path, bool compressed )
-    : texture(NULL), compressed(compressed)
+    : texture(NULL), compressed(compressed), lod_count(1), lod(0), revision(0)
 {
     ZeroMemory(&texture_desc, sizeof(DDSURFACEDESC2));
     
@@ -35,6 +41,10 @@ D3D_TM::TextureInstance::TextureInstance( PATH & path, bool compressed )
     gc_info.size = texture_desc.dwWidth * texture_desc.dwHeight * 4 / 1024;
     if (compressed) 
         gc_info.size /= 4;
+    
+    // Downscaled variants are stored in mip chain of cooked texture
+    if ((texture_desc.dwFlags & DDSD_MIPMAPCOUNT) && texture_desc.dwMipMapCount > 1)
+        lod_count = min((int)texture_desc.dwMipMapCount, TextureManagerInstance::LOD_COUNT);
 }
 
 // Macro for creating texture with E_OUTOFMEMORY handling
@@ -61,17 +71,21 @@ D3D_TM::TextureInstance::TextureInstance( PATH & path, bool compressed )
 bool D3D_TM::TextureInstance::load()
 {
     if (texture) return false;
+    PROFILE_ZONE("texture_load");
     Direct3D d3d;
     
     //    M$   ,    ???
     DWORD w = *((DWORD *)file->get_contents() + 4);
     DWORD h = *((DWORD *)file->get_contents() + 3);
-    CREATE_TEXTURE(D3DXCreateTextureFromFileInMemoryEx(d3d->device, 
-                       file->get_contents(), file->get_size(), w, 
-                       h, 1, 0, compressed ? (D3DFORMAT)D3D_TM::DXT_METHOD : D3DFMT_A8R8G8B8,
-                       D3DPOOL_DEFAULT, D3DX_FILTER_NONE, D3DX_FILTER_NONE, 0,
-                       NULL, NULL, &texture));
-    TextureManagerInstance::utilized_mem += gc_info.size;
+    
+    // Skipping top levels of mip chain for downscaled variant
+    w = (w >> lod) ? (w >> lod) : 1;
+    h = (h >> lod) ? (h >> lod) : 1;
+    CREATE_TEXTURE(d3d->render_device->create_texture(file->get_contents(), file->get_size(),
+                       w, h, compressed ? (D3DFORMAT)D3D_TM::DXT_METHOD : D3DFMT_A8R8G8B8,
+                       lod, &texture));
+    TextureManagerInstance::utilized_mem += loaded_size();
+    ++revision;
     return true;
 }
 
@@ -79,19 +93,62 @@ bool D3D_TM::TextureInstance::load()
 void D3D_TM::TextureInstance::unload()
 {
     if (!texture) return;
-    texture->Release();
+    delete texture;
     texture = NULL;
     
-    TextureManagerInstance::utilized_mem -= gc_info.size;
+    TextureManagerInstance::utilized_mem -= loaded_size();
+}
+
+// Reload texture with another resolution level
+void D3D_TM::TextureInstance::reload( int new_lod )
+{
+    if (new_lod == lod) return;
+    
+    bool was_loaded = (NULL != texture);
+    unload();
+    lod = new_lod;
+    if (was_loaded)
+        load();
 }
 
 // Bind texture to Direct3D
 void D3D_TM::TextureInstance::bind( int sampler_index )
 {
+    Direct3D d3d;
+    
+    // Lowest resolution is loaded first, higher ones are streamed in later
+    if (!texture && lod_count > 1)
+        lod = lod_count - 1;
     load();
     gc_info.age = 0;
-    Direct3D d3d;
-    ASSERT_DIRECTX(d3d->device->SetTexture(sampler_index, texture));
+    
+    // Requesting resolution level suitable for current zoom
+    if (lod_count > 1)
+    {
+        int wanted = TextureManagerInstance::select_lod(d3d->zoom);
+        if (wanted > lod_count - 1)
+            wanted = lod_count - 1;
+        if (wanted != lod && wanted != gc_info.wanted_lod)
+        {
+            Singleton<TextureManagerInstance> tm;
+            if (gc_info.wanted_lod < 0)
+                tm->pending_lods++;
+            gc_info.wanted_lod = wanted;
+        }
+    }
+    d3d->render_device->set_texture(texture, sampler_index);
+}
+
+// Select resolution level for given zoom factor
+int D3D_TM::select_lod( float zoom )
+{
+    int lod = 0;
+    while (lod < LOD_COUNT - 1 && zoom <= 0.5f)
+    {
+        zoom *= 2;
+        lod++;
+    }
+    return lod;
 }
 
 // Texture loading
@@ -138,25 +195,18 @@ bool D3D_TM::DynamicTextureInstance::load()
     Direct3D d3d;
     Log log;
 
-    // Some Intel cards don't support dynamic textures, using managed instead
-    static D3DPOOL pool = D3DPOOL_DEFAULT;
-    static DWORD usage = (d3d->device_caps.Caps2 & D3DCAPS2_DYNAMICTEXTURES) ? 
-                              // Device supports dynamic textures
-                              D3DUSAGE_DYNAMIC :
-                              // Device doesn't support: using managed pool
-                              (pool = D3DPOOL_MANAGED, 0);
-    CREATE_TEXTURE(d3d->device->CreateTexture(width, height, 1, usage,
+    CREATE_TEXTURE(d3d->render_device->create_texture(width, height,
                        compressed ? (D3DFORMAT)D3D_TM::DXT_METHOD : D3DFMT_A8R8G8B8, 
-                       pool, &texture, NULL));
+                       RenderDevice::TEXTURE_DYNAMIC, &texture));
     // Filling with garbage for debug
-    D3DLOCKED_RECT lr;
-    ASSERT_DIRECTX(texture->LockRect(0, &lr, NULL, usage ? D3DLOCK_DISCARD : 0));
+    int pitch;
+    BYTE * bits = texture->lock(pitch, true);
     int h = compressed ?
                 height >> Direct3DInstance::TextureManagerInstance::DXT_METHOD_height_shift :
                 height;
     for (int y = 0; y < h; ++y)
-        memset((BYTE *)lr.pBits + y * lr.Pitch, 0xcc, lr.Pitch);
-    ASSERT_DIRECTX(texture->UnlockRect(0));
+        memset(bits + y * pitch, 0xcc, pitch);
+    texture->unlock();
 
     TextureManagerInstance::utilized_mem += gc_info.size;
     return true;
@@ -166,7 +216,7 @@ bool D3D_TM::DynamicTextureInstance::load()
 D3D_TM::SurfaceTextureInstance::SurfaceTextureInstance( int width, int height, 
                                                         D3DFORMAT format, bool render_target )
     : width(width), height(height), format(format), 
-      surface(NULL), render_target(render_target)
+      render_target(render_target)
 {
     this->compressed = false;
     ZeroMemory(&texture_desc, sizeof(DDSURFACEDESC2));
@@ -184,28 +234,15 @@ bool D3D_TM::SurfaceTextureInstance::load()
     
     Direct3D d3d;
     Log log;
-    static DWORD usage = (d3d->device_caps.Caps2 & D3DCAPS2_DYNAMICTEXTURES) ? D3DUSAGE_DYNAMIC : 0;
-    const DWORD real_usage = (render_target ? D3DUSAGE_RENDERTARGET : usage);
-    CREATE_TEXTURE(d3d->device->CreateTexture(width, height, 1, real_usage, format, 
-                                              D3DPOOL_DEFAULT, &texture, NULL));
-    // Obtaining surface
-    ASSERT_DIRECTX(texture->GetSurfaceLevel(0, &surface));
+    CREATE_TEXTURE(d3d->render_device->create_texture(width, height, format, 
+                       render_target ? RenderDevice::TEXTURE_RENDER_TARGET :
+                                       RenderDevice::TEXTURE_DYNAMIC, &texture));
 
     // Updating gc info
     TextureManagerInstance::utilized_mem += gc_info.size;
     return true;
 }
 
-// Release resources
-void D3D_TM::SurfaceTextureInstance::unload()
-{
-    if (surface)
-    {
-        surface->Release();
-        surface = NULL;
-    }
-}
-
 // Constructor
 D3D_TM::RenderTargetTextureInstance::RenderTargetTextureInstance()
     : width(0), height(0)
@@ -235,8 +272,8 @@ bool D3D_TM::RenderTargetTextureInstance::load()
     if (texture) return false;
     Direct3D d3d;
     Log log;
-    CREATE_TEXTURE(d3d->device->CreateTexture(width, height, 1, D3DUSAGE_RENDERTARGET,
-                                              D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &texture, NULL));
+    CREATE_TEXTURE(d3d->render_device->create_texture(width, height, D3DFMT_A8R8G8B8,
+                       RenderDevice::TEXTURE_RENDER_TARGET, &texture));
     TextureManagerInstance::utilized_mem += gc_info.size;
     return true;
 }
@@ -272,7 +309,7 @@ D3D_TM::TextureRef D3D_TM::create_surface_texture( int width, int height, D3DFOR
 }
 
 // Initialization
-void D3D_TM::init( LPDIRECT3DDEVICE9 device )
+void D3D_TM::init( RenderDevice * device )
 {
     Config config;
     try { percents_to_free = (UINT)config->get<int>("vmem_hyst"); }
@@ -284,7 +321,12 @@ void D3D_TM::init( LPDIRECT3DDEVICE9 device )
     catch (...) { percents_to_free = 20; }
     
     if (0 == available_mem)
-        available_mem = device->GetAvailableTextureMem() / 1024;
+        available_mem = device->get_available_texture_mem();
+    
+    try { uploads_per_frame = config->get<int>("texture_uploads_per_frame"); }
+    catch (...) { uploads_per_frame = 8; }
+    try { prefetch_time = config->get<int>("texture_prefetch_time"); }
+    catch (...) { prefetch_time = 500; }
     
     Log log;
     log->print(boost::str(boost::format("Available video memory: %dMb") % (available_mem / 1024)));
@@ -321,18 +363,122 @@ void D3D_TM::collect( bool low_sysmem_hint )
     if (low_sysmem_hint) return; // We've done with cleaning unneeded system memory objects
     
     // Freeing textures that are not used currently (non-visible)
+    // and are not expected to be shown by playing animations soon
+    std::vector<TextureRef> ahead;
     for (TextureIter i = textures.begin(); textures.end() > i; ++i)
     {
         TextureInstance::GCInfo & info = (*i)->gc_info;
         if (info.age > 70 /* 15fps */)
+        {
+            if (is_prefetched(info))
+            {
+                if ((*i)->texture)
+                    ahead.push_back(*i);
+                continue;
+            }
             (*i)->unload();
+        }
+        if (utilized_mem < to_reach) return;
+    }
+    
+    // Freeing upcoming animation frames, farthest from play head first
+    std::sort(ahead.begin(), ahead.end(), nearer_to_play_head);
+    for (std::vector<TextureRef>::reverse_iterator i = ahead.rbegin(); ahead.rend() != i; ++i)
+    {
+        (*i)->unload();
         if (utilized_mem < to_reach) return;
     }
 }
 
+// Request texture to be resident before it is bound
+void D3D_TM::prefetch( TextureRef & texture, int distance )
+{
+    TextureInstance::GCInfo & info = texture->gc_info;
+    prefetch_requested = true;
+    
+    // Texture may be in lookahead window of several sequences
+    const bool requested = (info.prefetch_stamp == prefetch_epoch);
+    if (requested && info.prefetch_distance <= distance)
+        return;
+    info.prefetch_stamp = prefetch_epoch;
+    info.prefetch_distance = distance;
+    
+    if (!requested && !texture->texture)
+        prefetch_queue.push_back(texture);
+}
+
+// Comparison for ordering textures by distance from play head
+bool D3D_TM::nearer_to_play_head( const TextureRef & a, const TextureRef & b )
+{
+    return a->gc_info.prefetch_distance < b->gc_info.prefetch_distance;
+}
+
+// Upload textures requested by animation lookahead
+void D3D_TM::update_prefetch( int & budget )
+{
+    // Requests made after this point belong to next frame
+    if (prefetch_requested)
+    {
+        prefetch_epoch++;
+        prefetch_requested = false;
+    }
+    if (prefetch_queue.empty()) return;
+    
+    Direct3D d3d;
+    const int wanted = select_lod(d3d->zoom);
+    std::sort(prefetch_queue.begin(), prefetch_queue.end(), nearer_to_play_head);
+    for (TextureIter i = prefetch_queue.begin(); prefetch_queue.end() != i && 0 < budget; ++i)
+    {
+        TextureInstance * t = i->get();
+        if (t->texture) continue;
+        
+        // Prefetching should never cause texture collection
+        const int lod = min(wanted, t->lod_count - 1);
+        if (utilized_mem + (t->gc_info.size >> (2 * lod)) > available_mem)
+            break;
+        t->lod = lod;
+        t->load();
+        budget--;
+    }
+    prefetch_queue.clear();
+}
+
+// Apply pending resolution level changes
+void D3D_TM::update_lods( int & budget )
+{
+    if (0 == pending_lods) return;
+    
+    pending_lods = 0;
+    for (TextureIter i = textures.begin(); textures.end() != i; ++i)
+    {
+        TextureInstance::GCInfo & info = (*i)->gc_info;
+        if (info.wanted_lod < 0) continue;
+        
+        // Unloaded texture will start from lowest resolution again
+        if (!(*i)->texture || info.wanted_lod == (*i)->lod)
+        {
+            info.wanted_lod = -1;
+            continue;
+        }
+        if (0 == budget)
+        {
+            pending_lods++;
+            continue;
+        }
+        budget--;
+        (*i)->reload(info.wanted_lod);
+        info.wanted_lod = -1;
+    }
+}
+
 // Updating textures
 void D3D_TM::update( DWORD dt )
 {
+    // Uploading upcoming animation frames, then texture variants requested by zoom
+    int budget = uploads_per_frame;
+    update_prefetch(budget);
+    update_lods(budget);
+    
     // Skipping if no actual update or if there are plenty of video mem
     if (0 == dt || utilized_mem * 100 / available_mem < 100 - percents_to_free) return;
     
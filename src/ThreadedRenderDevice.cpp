@@ -0,0 +1,581 @@
+#include "stdafx.h"
+#include "RenderDevice.h"
+#include "Profiler.h"
+
+// Size of ring buffer for vertices of recorded draws
+static const UINT RING_SIZE = 16384;
+
+// Texture of wrapped device, destroyed after frames using it are drawn
+class ThreadedTexture: public RenderDevice::Texture
+{
+public:
+    // Constructor
+    inline ThreadedTexture( ThreadedRenderDevice * owner, RenderDevice::Texture * texture )
+        : RenderDevice::Texture(texture->width, texture->height, texture->format),
+          owner(owner), texture(texture), locked_directly(false) {}
+    // Destructor
+    virtual ~ThreadedTexture() { owner->release_texture(texture); }
+
+    // Lock texture (discarded contents are uploaded in order with recorded draws)
+    virtual BYTE * lock( int & pitch, bool discard )
+    {
+        BYTE * bits = owner->lock_texture(texture, pitch, discard);
+        locked_directly = !discard;
+        return bits;
+    }
+    // Unlock texture
+    virtual void unlock()
+        { if (locked_directly) texture->unlock(); }
+
+    // Owner device
+    ThreadedRenderDevice * owner;
+    // Wrapped device texture
+    RenderDevice::Texture * texture;
+    // Wrapped device texture is locked (not recorded upload)
+    bool locked_directly;
+};
+
+// Get size of row and number of rows in locked texture data
+static void locked_size( const RenderDevice::Texture & texture, int & pitch, int & rows )
+{
+    rows = texture.height;
+    switch (texture.format)
+    {
+    // Block-compressed formats have one row of blocks per 4 pixel rows
+    case D3DFMT_DXT1:
+        pitch = (texture.width + 3) / 4 * 8;
+        rows = (texture.height + 3) / 4;
+        break;
+    case D3DFMT_DXT2: case D3DFMT_DXT3: case D3DFMT_DXT4: case D3DFMT_DXT5:
+        pitch = (texture.width + 3) / 4 * 16;
+        rows = (texture.height + 3) / 4;
+        break;
+    case D3DFMT_R5G6B5: case D3DFMT_X1R5G5B5: case D3DFMT_A1R5G5B5:
+    case D3DFMT_A4R4G4B4: case D3DFMT_X4R4G4B4: case D3DFMT_A8L8:
+    case D3DFMT_YUY2: case D3DFMT_UYVY:
+        pitch = texture.width * 2;
+        break;
+    case D3DFMT_L8: case D3DFMT_A8: case D3DFMT_P8:
+        pitch = texture.width;
+        break;
+    default:
+        pitch = texture.width * 4;
+    }
+}
+
+// Vertex buffer in system memory (vertices are copied to frame on drawing)
+class ThreadedVertexBuffer: public RenderDevice::VertexBuffer
+{
+public:
+    // Constructor
+    inline ThreadedVertexBuffer( UINT size )
+        : RenderDevice::VertexBuffer(size), vertices(size) {}
+
+    // Lock vertices
+    virtual TexturedVertex * lock( UINT start, UINT count, LockMode mode )
+        { return &vertices[start]; }
+    // Unlock vertex buffer
+    virtual void unlock() {}
+
+    // Vertex data
+    std::vector<TexturedVertex> vertices;
+};
+
+// Render target of wrapped device, destroyed after frames using it are drawn
+class ThreadedRenderTarget: public RenderDevice::RenderTarget
+{
+public:
+    // Constructor
+    inline ThreadedRenderTarget( ThreadedRenderDevice * owner, RenderDevice::RenderTarget * target )
+        : RenderDevice::RenderTarget(target->width, target->height), owner(owner), target(target) {}
+    // Destructor
+    virtual ~ThreadedRenderTarget() { owner->release_render_target(target); }
+
+    // Save contents to PNG file (after all recorded drawing)
+    virtual void save( const std::string & filename )
+    {
+        owner->finish();
+        target->save(filename);
+    }
+
+    // Owner device
+    ThreadedRenderDevice * owner;
+    // Wrapped device render target
+    RenderDevice::RenderTarget * target;
+};
+
+
+// Forget recorded calls and destroy released resources
+void ThreadedRenderDevice::Frame::clear()
+{
+    commands.clear();
+    vertices.clear();
+    colored.clear();
+    points.clear();
+    matrices.clear();
+    text.clear();
+    uploads.clear();
+    for (size_t i = 0; i < released_textures.size(); ++i)
+        delete released_textures[i];
+    released_textures.clear();
+    for (size_t i = 0; i < released_targets.size(); ++i)
+        delete released_targets[i];
+    released_targets.clear();
+}
+
+// Constructor
+ThreadedRenderDevice::ThreadedRenderDevice( RenderDevice * device )
+    : device(device), ring(NULL), ring_offset(0), recording(0), quit(0), presented(1)
+{
+    ring = device->create_vertex_buffer(RING_SIZE, true);
+
+    ASSERT_WINAPI(work_event = CreateEvent(NULL, FALSE, FALSE, NULL));
+    // Manual reset event, render thread is initially idle
+    ASSERT_WINAPI(idle_event = CreateEvent(NULL, TRUE, TRUE, NULL));
+    ASSERT_WINAPI(thread = CreateThread(NULL, 0, thread_proc, this, 0, NULL));
+}
+
+// Destructor
+ThreadedRenderDevice::~ThreadedRenderDevice()
+{
+    // Waiting for frame being drawn and stopping render thread
+    WaitForSingleObject(idle_event, INFINITE);
+    InterlockedExchange(&quit, 1);
+    SetEvent(work_event);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    CloseHandle(work_event);
+    CloseHandle(idle_event);
+
+    frames[0].clear();
+    frames[1].clear();
+    delete ring;
+    delete device;
+}
+
+// Render thread function
+DWORD WINAPI ThreadedRenderDevice::thread_proc( LPVOID param )
+{
+    ThreadedRenderDevice * self = (ThreadedRenderDevice *)param;
+    for (;;)
+    {
+        WaitForSingleObject(self->work_event, INFINITE);
+        if (self->quit)
+            break;
+
+        // Errors are reported by main thread (exception handling uses singletons)
+        try { self->execute(self->frames[1 - self->recording]); }
+        catch (std::exception & e) { self->error = e.what(); }
+        SetEvent(self->idle_event);
+    }
+    return 0;
+}
+
+// Execute frame on wrapped device
+void ThreadedRenderDevice::execute( Frame & frame )
+{
+    PROFILE_ZONE("render_thread_frame");
+    for (size_t i = 0; i < frame.commands.size(); ++i)
+    {
+        const Command & c = frame.commands[i];
+        switch (c.type)
+        {
+        case Command::BEGIN_SCENE:
+            device->begin_scene();
+            break;
+        case Command::END_SCENE:
+            device->end_scene();
+            break;
+        case Command::CLEAR:
+            device->clear(c.color);
+            break;
+        case Command::PRESENT:
+            InterlockedExchange(&presented, device->present() ? 1 : 0);
+            break;
+        case Command::SET_TEXTURE:
+            device->set_texture((Texture *)c.resource, c.sampler);
+            break;
+        case Command::DRAW_STRIP:
+        case Command::DRAW_TRIANGLES:
+            execute_draw(c.type, &frame.vertices[c.start], c.count);
+            break;
+        case Command::DRAW_COLORED_STRIP:
+            device->draw_colored_strip(&frame.colored[c.start], c.count);
+            break;
+        case Command::DRAW_POINTS:
+            device->draw_points(&frame.colored[c.start], c.count, c.size);
+            break;
+        case Command::DRAW_LINES:
+            device->draw_lines(&frame.points[c.start], c.count, c.color);
+            break;
+        case Command::DRAW_LINE_LIST:
+            device->draw_line_list(&frame.colored[c.start], c.count);
+            break;
+        case Command::DRAW_TEXT:
+            device->draw_text(frame.text.substr(c.start, c.count), c.x, c.y, c.color);
+            break;
+        case Command::WORLD_TRANSFORM:
+            device->set_world_transform(frame.matrices[c.start]);
+            break;
+        case Command::VIEW_PROJECTION:
+            device->set_view_projection(frame.matrices[c.start], frame.matrices[c.start + 1]);
+            break;
+        case Command::SET_TARGET:
+            device->set_render_target((RenderTarget *)c.resource);
+            break;
+        case Command::UPLOAD_TEXTURE:
+            execute_upload((Texture *)c.resource, &frame.uploads[c.start], c.x, c.count);
+            break;
+        }
+    }
+}
+
+// Draw textured vertices through ring buffer
+void ThreadedRenderDevice::execute_draw( Command::Type type, const TexturedVertex * vertices,
+                                         UINT primitive_count )
+{
+    // Splitting draws larger than ring buffer (strip parts keep even triangle count)
+    const bool strip = (Command::DRAW_STRIP == type);
+    const UINT max_primitives = strip ? (ring->size - 2) & ~1 : ring->size / 3;
+    for (UINT first = 0; first < primitive_count; first += max_primitives)
+    {
+        UINT n = min(max_primitives, primitive_count - first),
+             count = strip ? n + 2 : n * 3;
+
+        // Appending to buffer, discarding it when full
+        VertexBuffer::LockMode mode = VertexBuffer::LOCK_NOOVERWRITE;
+        if (0 == ring_offset || ring_offset + count > ring->size)
+        {
+            mode = VertexBuffer::LOCK_DISCARD;
+            ring_offset = 0;
+        }
+        TexturedVertex * p = ring->lock(ring_offset, count, mode);
+        CopyMemory(p, vertices + (strip ? first : first * 3), count * sizeof(TexturedVertex));
+        ring->unlock();
+
+        if (strip)
+            device->draw_strip(ring, ring_offset, n);
+        else
+            device->draw_triangles(ring, ring_offset, n);
+        ring_offset += count;
+    }
+}
+
+// Copy recorded contents to texture
+void ThreadedRenderDevice::execute_upload( Texture * texture, const BYTE * data, int pitch,
+                                           UINT size )
+{
+    int locked_pitch;
+    BYTE * bits = texture->lock(locked_pitch, true);
+    for (UINT offset = 0, y = 0; offset < size; offset += pitch, ++y)
+        CopyMemory(bits + y * locked_pitch, data + offset, min(pitch, locked_pitch));
+    texture->unlock();
+}
+
+// Start recording new call
+ThreadedRenderDevice::Command & ThreadedRenderDevice::add_command( Command::Type type )
+{
+    std::vector<Command> & commands = frames[recording].commands;
+    commands.push_back(Command());
+    Command & command = commands.back();
+    ZeroMemory(&command, sizeof(command));
+    command.type = type;
+    return command;
+}
+
+// Wait until render thread is idle
+void ThreadedRenderDevice::wait()
+{
+    {
+        PROFILE_ZONE("wait_render_thread");
+        WaitForSingleObject(idle_event, INFINITE);
+    }
+
+    // Accumulating drawing statistics of wrapped device (ours may be reset by scripts)
+    const Stats & s = device->stats;
+    stats.frames += s.frames - device_stats.frames;
+    stats.draw_calls += s.draw_calls - device_stats.draw_calls;
+    stats.primitives += s.primitives - device_stats.primitives;
+    stats.texture_changes += s.texture_changes - device_stats.texture_changes;
+    device_stats = s;
+
+    if (!error.empty())
+    {
+        std::string message = error;
+        error.clear();
+        throw Exception("Render thread error. " + message);
+    }
+}
+
+// Hand recorded frame to render thread
+void ThreadedRenderDevice::submit()
+{
+    wait();
+
+    // Frame drawn by render thread is recorded next
+    frames[1 - recording].clear();
+    recording = 1 - recording;
+    ResetEvent(idle_event);
+    SetEvent(work_event);
+}
+
+// Execute recorded calls and wait until render thread is idle
+void ThreadedRenderDevice::finish()
+{
+    if (!frames[recording].commands.empty())
+        submit();
+    wait();
+
+    // No recorded calls refer to released resources now
+    frames[0].clear();
+    frames[1].clear();
+}
+
+// Destroy texture after frames using it are drawn
+void ThreadedRenderDevice::release_texture( Texture * texture )
+{
+    frames[recording].released_textures.push_back(texture);
+}
+
+// Lock texture of wrapped device for writing
+BYTE * ThreadedRenderDevice::lock_texture( Texture * texture, int & pitch, bool discard )
+{
+    // Contents may be kept only if texture is not in use by render thread
+    if (!discard)
+    {
+        finish();
+        return texture->lock(pitch, false);
+    }
+
+    // Frame being drawn may sample texture, new contents go to recorded frame
+    Frame & frame = frames[recording];
+    int rows;
+    locked_size(*texture, pitch, rows);
+    Command & c = add_command(Command::UPLOAD_TEXTURE);
+    c.resource = texture;
+    c.start = (UINT)frame.uploads.size();
+    c.count = UINT(pitch * rows);
+    c.x = pitch;
+    frame.uploads.resize(frame.uploads.size() + c.count);
+    return &frame.uploads[c.start];
+}
+
+// Destroy render target after frames using it are drawn
+void ThreadedRenderDevice::release_render_target( RenderTarget * target )
+{
+    frames[recording].released_targets.push_back(target);
+}
+
+// Setup render state
+void ThreadedRenderDevice::setup_state()
+{
+    finish();
+    device->setup_state();
+}
+
+// Get device state
+HRESULT ThreadedRenderDevice::test_cooperative_level()
+{
+    finish();
+    return device->test_cooperative_level();
+}
+
+// Reset lost device (ring buffer is recreated)
+void ThreadedRenderDevice::reset()
+{
+    finish();
+    delete ring;
+    ring = NULL;
+    device->reset();
+    ring = device->create_vertex_buffer(RING_SIZE, true);
+    ring_offset = 0;
+    InterlockedExchange(&presented, 1);
+}
+
+// Get amount of texture memory
+UINT ThreadedRenderDevice::get_available_texture_mem()
+{
+    return device->get_available_texture_mem();
+}
+
+// Begin rendering
+void ThreadedRenderDevice::begin_scene()
+{
+    add_command(Command::BEGIN_SCENE);
+}
+
+// End rendering
+void ThreadedRenderDevice::end_scene()
+{
+    add_command(Command::END_SCENE);
+}
+
+// Clear current render target
+void ThreadedRenderDevice::clear( D3DCOLOR color )
+{
+    add_command(Command::CLEAR).color = color;
+}
+
+// Hand frame to render thread (device loss is reported one frame later)
+bool ThreadedRenderDevice::present()
+{
+    add_command(Command::PRESENT);
+    submit();
+    return 0 != presented;
+}
+
+// Create texture from DDS file in memory
+HRESULT ThreadedRenderDevice::create_texture( const char * dds, int size, int width, int height,
+                                              D3DFORMAT format, int skip_levels, Texture ** texture )
+{
+    Texture * t;
+    HRESULT hr = device->create_texture(dds, size, width, height, format, skip_levels, &t);
+    if (FAILED(hr))
+        return hr;
+
+    stats.texture_uploads++;
+    *texture = new ThreadedTexture(this, t);
+    return hr;
+}
+
+// Create empty texture
+HRESULT ThreadedRenderDevice::create_texture( int width, int height, D3DFORMAT format,
+                                              TextureUsage usage, Texture ** texture )
+{
+    Texture * t;
+    HRESULT hr = device->create_texture(width, height, format, usage, &t);
+    if (FAILED(hr))
+        return hr;
+
+    stats.texture_uploads++;
+    *texture = new ThreadedTexture(this, t);
+    return hr;
+}
+
+// Bind texture
+void ThreadedRenderDevice::set_texture( Texture * texture, int sampler_index )
+{
+    Command & c = add_command(Command::SET_TEXTURE);
+    c.resource = texture ? static_cast<ThreadedTexture *>(texture)->texture : NULL;
+    c.sampler = sampler_index;
+}
+
+// Create vertex buffer
+RenderDevice::VertexBuffer * ThreadedRenderDevice::create_vertex_buffer( UINT size, bool dynamic )
+{
+    return new ThreadedVertexBuffer(size);
+}
+
+// Draw triangle strip from vertex buffer
+void ThreadedRenderDevice::draw_strip( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_STRIP);
+    c.start = (UINT)frame.vertices.size();
+    c.count = primitive_count;
+    const TexturedVertex * v = &static_cast<ThreadedVertexBuffer *>(buffer)->vertices[start_vertex];
+    frame.vertices.insert(frame.vertices.end(), v, v + primitive_count + 2);
+}
+
+// Draw triangle list from vertex buffer
+void ThreadedRenderDevice::draw_triangles( VertexBuffer * buffer, UINT start_vertex, UINT primitive_count )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_TRIANGLES);
+    c.start = (UINT)frame.vertices.size();
+    c.count = primitive_count;
+    const TexturedVertex * v = &static_cast<ThreadedVertexBuffer *>(buffer)->vertices[start_vertex];
+    frame.vertices.insert(frame.vertices.end(), v, v + primitive_count * 3);
+}
+
+// Draw untextured triangle strip
+void ThreadedRenderDevice::draw_colored_strip( const ColoredVertex * vertices, UINT primitive_count )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_COLORED_STRIP);
+    c.start = (UINT)frame.colored.size();
+    c.count = primitive_count;
+    frame.colored.insert(frame.colored.end(), vertices, vertices + primitive_count + 2);
+}
+
+// Draw untextured points
+void ThreadedRenderDevice::draw_points( const ColoredVertex * vertices, UINT count, float size )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_POINTS);
+    c.start = (UINT)frame.colored.size();
+    c.count = count;
+    c.size = size;
+    frame.colored.insert(frame.colored.end(), vertices, vertices + count);
+}
+
+// Draw line strip
+void ThreadedRenderDevice::draw_lines( const D3DXVECTOR3 * points, UINT count, D3DCOLOR color )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_LINES);
+    c.start = (UINT)frame.points.size();
+    c.count = count;
+    c.color = color;
+    frame.points.insert(frame.points.end(), points, points + count);
+}
+
+// Draw line list
+void ThreadedRenderDevice::draw_line_list( const ColoredVertex * vertices, UINT line_count )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_LINE_LIST);
+    c.start = (UINT)frame.colored.size();
+    c.count = line_count;
+    frame.colored.insert(frame.colored.end(), vertices, vertices + line_count * 2);
+}
+
+// Draw text
+void ThreadedRenderDevice::draw_text( const std::string & text, int x, int y, D3DCOLOR color )
+{
+    Frame & frame = frames[recording];
+    Command & c = add_command(Command::DRAW_TEXT);
+    c.start = (UINT)frame.text.size();
+    c.count = (UINT)text.size();
+    c.x = x;
+    c.y = y;
+    c.color = color;
+    frame.text += text;
+}
+
+// Set world transformation matrix
+void ThreadedRenderDevice::set_world_transform( const D3DXMATRIX & world )
+{
+    Frame & frame = frames[recording];
+    add_command(Command::WORLD_TRANSFORM).start = (UINT)frame.matrices.size();
+    frame.matrices.push_back(world);
+}
+
+// Set view and projection matrices
+void ThreadedRenderDevice::set_view_projection( const D3DXMATRIX & view, const D3DXMATRIX & projection )
+{
+    Frame & frame = frames[recording];
+    add_command(Command::VIEW_PROJECTION).start = (UINT)frame.matrices.size();
+    frame.matrices.push_back(view);
+    frame.matrices.push_back(projection);
+}
+
+// Create off-screen render target
+RenderDevice::RenderTarget * ThreadedRenderDevice::create_render_target( int width, int height )
+{
+    return new ThreadedRenderTarget(this, device->create_render_target(width, height));
+}
+
+// Set render target for following drawing
+void ThreadedRenderDevice::set_render_target( RenderTarget * target )
+{
+    add_command(Command::SET_TARGET).resource =
+        target ? static_cast<ThreadedRenderTarget *>(target)->target : NULL;
+}
+
+// Copy back buffer to system memory (after all recorded drawing)
+void ThreadedRenderDevice::read_back_buffer( int width, int height, std::vector<DWORD> & pixels )
+{
+    finish();
+    device->read_back_buffer(width, height, pixels);
+}
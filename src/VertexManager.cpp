@@ -4,40 +4,56 @@
   
 #define D3D_VM Direct3DInstance::VertexManagerInstance
 
-// Force stream source update
-bool D3D_VM::VertexBufferInstance::force_update = false;
-
 // Vertex format
-struct VertexFormat
-{
-    //! Position
-    float x, y, z;
-    //! Texture coordinates
-    float u, v;
+typedef TexturedVertex VertexFormat;
 
-    //! Constructor
-    VertexFormat( float x, float y, float u, float v )
-        : x(x), y(y), z(0), u(u), v(v) {}
-    //! Flexible vertex format description
-    static const DWORD FVF = D3DFVF_XYZ | D3DFVF_TEX1 | D3DFVF_TEXCOORDSIZE2(0);
-};
+// Vertex manager initialization
+D3D_VM::VertexManagerInstance()
+    : used_space(buffer_size), collect_time(0), dynamic_offset(0)
+{
+}
 
 // Vertex buffer creation
 D3D_VM::VertexBufferRef D3D_VM::create( D3D_VM::VertexBufferData & data )
 {
-    // Checking if vertex buffer with same parameters was created previously
-    static VertexBufferData prev_data(0, 0);
-    static int prev_index;
-    if (data == prev_data)
+    // Sharing quad with other sprites of same size
+    std::pair<int, int> key(data.width, data.height);
+    QuadIter i = quads.find(key);
+    if (quads.end() != i)
     {
-        ASSERT(!vertex_buffers.empty());
-        return VertexBufferRef(new VertexBufferInstance(*vertex_buffers.back(), prev_index));
+        VertexBufferRef ref = i->second.ref.lock();
+        if (!ref)
+        {
+            // Quad is unused but not collected yet, its vertices are still valid
+            QuadSlot & slot = i->second.slot;
+            ref.reset(new VertexBufferInstance(vertex_buffers[slot.buffer], slot.start_index, data));
+            i->second.ref = ref;
+        }
+        return ref;
+    }
+    
+    // Reusing space of collected quad
+    QuadSlot slot;
+    if (!free_slots.empty())
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        // Creating vertex buffer if there are none or there is no space
+        if (used_space + 4 > buffer_size)
+        {
+            Direct3D d3d;
+            vertex_buffers.push_back(boost::shared_ptr<RenderDevice::VertexBuffer>(
+                d3d->render_device->create_vertex_buffer(buffer_size, false)));
+            used_space = 0;
+        }
+        slot.buffer = (int)vertex_buffers.size() - 1;
+        slot.start_index = used_space;
+        used_space += 4;
     }
-    // Creating vertex buffer if there are none or there is no space
-    if (vertex_buffers.empty() || vertex_buffers.back()->free_space < 4)
-        vertex_buffers.push_back(VertexBufferRef(new VertexBufferInstance(data)));
     
-    VertexBufferRef & buffer = vertex_buffers.back();
     float width = float(data.width), height = float(data.height);
     
     // Sequence sprite vertices
@@ -50,49 +66,68 @@ D3D_VM::VertexBufferRef D3D_VM::create( D3D_VM::VertexBufferData & data )
     };
     
     // Adding sequence sprite to vertex buffer
-    void * ptr;
-    ASSERT_DIRECTX(buffer->vertex_buffer->Lock(
-        (VertexBufferInstance::buffer_size - buffer->free_space) * sizeof(VertexFormat),
-        sizeof(vertices), (void **)&ptr, 0));
+    boost::shared_ptr<RenderDevice::VertexBuffer> & buffer = vertex_buffers[slot.buffer];
+    VertexFormat * ptr = buffer->lock(slot.start_index, 4, RenderDevice::VertexBuffer::LOCK_NORMAL);
     MoveMemory(ptr, vertices, sizeof(vertices));
-    ASSERT_DIRECTX(buffer->vertex_buffer->Unlock());
-    int start_index = VertexBufferInstance::buffer_size - buffer->free_space;
-    prev_index = start_index;
-    prev_data = data;
-    buffer->free_space -= 4;
+    buffer->unlock();
 
-    // \todo: add vertex buffer caching support
-    return VertexBufferRef(new VertexBufferInstance(*buffer, start_index));
+    VertexBufferRef ref(new VertexBufferInstance(buffer, slot.start_index, data));
+    CachedQuad & quad = quads[key];
+    quad.slot = slot;
+    quad.ref = ref;
+    return ref;
 }
 
-// Construct from vertex buffer data
-D3D_VM::VertexBufferInstance::VertexBufferInstance( D3D_VM::VertexBufferData & data )
-    : free_space(buffer_size), start_index(0), vertex_buffer(NULL)
+// Updating vertex buffers
+void D3D_VM::update( DWORD dt )
 {
-    Direct3D d3d;
-    ASSERT_DIRECTX(d3d->device->CreateVertexBuffer(
-        VertexBufferInstance::buffer_size * sizeof(VertexFormat),
-        D3DUSAGE_WRITEONLY, VertexFormat::FVF, D3DPOOL_MANAGED, &vertex_buffer, NULL));
-    Log log;
-    log->debug("Vertex buffer created");
+    collect_time += dt;
+    if (collect_time < collect_period) return;
+    collect_time = 0;
+    
+    // Returning space of unused quads to free list
+    for (QuadIter i = quads.begin(); quads.end() != i;)
+        if (i->second.ref.expired())
+        {
+            free_slots.push_back(i->second.slot);
+            quads.erase(i++);
+        }
+        else
+            ++i;
+}
+
+// Write vertices to dynamic vertex buffer
+UINT D3D_VM::write_dynamic( const TexturedVertex * vertices, UINT count )
+{
+    ASSERT(count <= dynamic_buffer_size);
+    if (!dynamic_buffer)
+    {
+        Direct3D d3d;
+        dynamic_buffer.reset(d3d->render_device->create_vertex_buffer(dynamic_buffer_size, true));
+        dynamic_offset = 0;
+    }
+    
+    // Appending to buffer, discarding it when full
+    RenderDevice::VertexBuffer::LockMode mode = RenderDevice::VertexBuffer::LOCK_NOOVERWRITE;
+    if (0 == dynamic_offset || dynamic_offset + count > dynamic_buffer_size)
+    {
+        mode = RenderDevice::VertexBuffer::LOCK_DISCARD;
+        dynamic_offset = 0;
+    }
+    TexturedVertex * ptr = dynamic_buffer->lock(dynamic_offset, count, mode);
+    CopyMemory(ptr, vertices, count * sizeof(TexturedVertex));
+    dynamic_buffer->unlock();
+    
+    UINT start = dynamic_offset;
+    dynamic_offset += count;
+    return start;
 }
 
 // Render from vertex buffer
 void D3D_VM::VertexBufferInstance::render()
 {
     Direct3D d3d;
-    static LPDIRECT3DVERTEXBUFFER9 previous_vb;
-    // Setting vertex buffer as stream source
-    if (previous_vb != vertex_buffer || force_update)
-    {
-        force_update = false;
-        previous_vb = vertex_buffer;
-        ASSERT_DIRECTX(d3d->device->SetVertexShader(NULL));
-        ASSERT_DIRECTX(d3d->device->SetFVF(VertexFormat::FVF));
-        ASSERT_DIRECTX(d3d->device->SetStreamSource(0, vertex_buffer,
-                       0, sizeof(VertexFormat)));
-    }
-    ASSERT_DIRECTX(d3d->device->DrawPrimitive(D3DPT_TRIANGLESTRIP, start_index, 2));    
+    d3d->render_device->draw_strip(vertex_buffer.get(), start_index, 2);
 }
 
 #undef D3D_VM
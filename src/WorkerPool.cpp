@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "WorkerPool.h"
+#include "Config.h"
+#include "Log.h"
+
+// Constructor
+WorkerPoolInstance::Job::Job()
+    : queued(false)
+{
+    // Manual reset event, job is initially finished
+    ASSERT_WINAPI(done_event = CreateEvent(NULL, TRUE, TRUE, NULL));
+}
+
+// Destructor
+WorkerPoolInstance::Job::~Job()
+{
+    ASSERT(is_done());
+    CloseHandle(done_event);
+}
+
+// Check if job is finished
+bool WorkerPoolInstance::Job::is_done() const
+{
+    return WAIT_OBJECT_0 == WaitForSingleObject(done_event, 0);
+}
+
+// Starting worker threads
+WorkerPoolInstance::WorkerPoolInstance()
+    : quit(0)
+{
+    Config config;
+    int count;
+    try { count = config->get<int>("worker_threads"); }
+    catch (...) { count = -1; }
+
+    // Leaving one processor for main thread by default
+    if (count < 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        count = (int)si.dwNumberOfProcessors - 1;
+    }
+
+    InitializeCriticalSection(&lock);
+    ASSERT_WINAPI(jobs_semaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL));
+    for (int i = 0; i < count; ++i)
+    {
+        HANDLE thread;
+        ASSERT_WINAPI(thread = CreateThread(NULL, 0, thread_proc, this, 0, NULL));
+        threads.push_back(thread);
+    }
+
+    Log log;
+    log->print(boost::str(boost::format("Worker threads: %d") % threads.size()));
+}
+
+// Stopping worker threads
+WorkerPoolInstance::~WorkerPoolInstance()
+{
+    InterlockedExchange(&quit, 1);
+    ReleaseSemaphore(jobs_semaphore, (LONG)threads.size(), NULL);
+    if (!threads.empty())
+        WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+    for (std::vector<HANDLE>::iterator i = threads.begin(); threads.end() != i; ++i)
+        CloseHandle(*i);
+
+    // Jobs left in queue are never executed
+    for (JobIter i = jobs.begin(); jobs.end() != i; ++i)
+    {
+        (*i)->queued = false;
+        SetEvent((*i)->done_event);
+    }
+    CloseHandle(jobs_semaphore);
+    DeleteCriticalSection(&lock);
+}
+
+// Add job to queue
+void WorkerPoolInstance::submit( Job & job )
+{
+    ASSERT(job.is_done());
+    job.error.clear();
+    ResetEvent(job.done_event);
+    if (threads.empty())
+    {
+        execute(job);
+        return;
+    }
+
+    EnterCriticalSection(&lock);
+    job.queued = true;
+    jobs.push_back(&job);
+    LeaveCriticalSection(&lock);
+    ReleaseSemaphore(jobs_semaphore, 1, NULL);
+}
+
+// Remove job from queue without signaling it
+bool WorkerPoolInstance::unqueue( Job & job )
+{
+    bool removed = false;
+    EnterCriticalSection(&lock);
+    if (job.queued)
+    {
+        jobs.remove(&job);
+        job.queued = false;
+        removed = true;
+    }
+    LeaveCriticalSection(&lock);
+    // Semaphore count stays greater than queue size, workers handle it
+    return removed;
+}
+
+// Remove job from queue
+bool WorkerPoolInstance::cancel( Job & job )
+{
+    if (!unqueue(job))
+        return false;
+    SetEvent(job.done_event);
+    return true;
+}
+
+// Wait for job completion
+void WorkerPoolInstance::wait( Job & job )
+{
+    // Executing job on calling thread instead of waiting for free worker
+    if (unqueue(job))
+        execute(job);
+    else
+        WaitForSingleObject(job.done_event, INFINITE);
+
+    // Reporting job failure on waiting thread
+    if (!job.error.empty())
+    {
+        std::string message = job.error;
+        job.error.clear();
+        throw Exception("Worker job error. " + message);
+    }
+}
+
+// Execute job and mark it as finished
+void WorkerPoolInstance::execute( Job & job )
+{
+    // Exceptions can't be thrown from worker thread, they are kept
+    // in job until waiting thread takes them
+    try { job.run(); }
+    catch (std::exception & e) { job.error = e.what(); }
+    catch (...) { job.error = "Unknown exception"; }
+    SetEvent(job.done_event);
+}
+
+// Worker thread function
+DWORD WINAPI WorkerPoolInstance::thread_proc( LPVOID param )
+{
+    WorkerPoolInstance * pool = (WorkerPoolInstance *)param;
+    for (;;)
+    {
+        WaitForSingleObject(pool->jobs_semaphore, INFINITE);
+        if (pool->quit)
+            break;
+
+        // Taking first job from queue (may be already cancelled)
+        Job * job = NULL;
+        EnterCriticalSection(&pool->lock);
+        if (!pool->jobs.empty())
+        {
+            job = pool->jobs.front();
+            pool->jobs.pop_front();
+            job->queued = false;
+        }
+        LeaveCriticalSection(&pool->lock);
+
+        if (job)
+            execute(*job);
+    }
+    return 0;
+}